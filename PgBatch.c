@@ -0,0 +1,182 @@
+// Batches of independent images rendered across worker threads that steal each other's jobs
+#define _USE_MATH_DEFINES
+#include <assert.h>
+#include <ctype.h>
+#include <float.h>
+#include <emmintrin.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include <pg/pg.h>
+#include <pg/platform.h>
+#include "common.h"
+
+// Each worker owns a run of jobs, packed as first | end << 32 so both ends
+// move with one compare and swap. Owners take from the front, thieves from the back.
+typedef struct {
+    volatile int64_t    range;
+    char                pad[64 - sizeof(int64_t)];
+} Queue;
+
+typedef struct {
+    PgRenderJob *jobs;
+    Queue       *queues;
+    int         nqueues;
+    volatile long done;
+} Batch;
+
+static int64_t packRange(uint32_t first, uint32_t end) {
+    return (int64_t)((uint64_t)end << 32 | first);
+}
+static int takeJob(Queue *queue, bool own) {
+    for (;;) {
+        int64_t range = LOAD_ACQUIRE(&queue->range);
+        uint32_t first = (uint32_t)range;
+        uint32_t end = (uint64_t)range >> 32;
+        if (first >= end)
+            return -1;
+        int64_t next = own? packRange(first + 1, end): packRange(first, end - 1);
+        if (CAS_64(&queue->range, range, next))
+            return own? first: end - 1;
+    }
+}
+static int nextJob(Batch *batch, int thread) {
+    int job = takeJob(&batch->queues[thread], true);
+    for (int i = 1; job < 0 && i < batch->nqueues; i++)
+        job = takeJob(&batch->queues[(thread + i) % batch->nqueues], false);
+    return job;
+}
+
+// A worker's sized handle, with the font and size it was made from
+typedef struct {
+    PgFont          *font;
+    const PgFont    *from;
+    float           size;
+} Sized;
+
+static bool render(Pg *g, Sized *sized, PgRenderJob *job) {
+    bool ok = true;
+    if (g->width != job->width || g->height != job->height)
+        $(resize, g, job->width, job->height);
+    $(clear, g, job->background);
+
+    if (job->svg) {
+        PgPath *path = pgNewPath();
+        ok = pgAppendSvgPath(path, NULL, job->svg);
+        $(fillTransformed, g, path, &job->matrix, job->color);
+        $(free, path);
+    }
+
+    // The worker keeps one sized handle and only makes another when the font or size
+    // changes. Handles on one face may use different features, so the handle is compared.
+    if (job->text && job->font) {
+        if (!sized->font || sized->from != job->font || sized->size != job->size) {
+            if (sized->font)
+                $(free, sized->font);
+            *sized = (Sized) { $(sized, job->font, job->size, 0), job->font, job->size };
+        }
+        $(fillUtf8, g, sized->font, job->at, (const uint8_t*)job->text, -1, job->color);
+    }
+
+    if (job->finish)
+        job->finish(job, g);
+    if (job->output)
+        ok &= pgWriteImage(g, job->output, job->format);
+    return ok;
+}
+static void worker(void *arg, int thread) {
+    Batch *batch = arg;
+    Pg *g = NULL;
+    Sized sized = { NULL };
+    int done = 0;
+    for (int i; (i = nextJob(batch, thread)) >= 0; ) {
+        PgRenderJob *job = &batch->jobs[i];
+        if (job->width <= 0 || job->height <= 0) {
+            job->ok = false;
+            continue;
+        }
+        if (!g)
+            g = pgNewBitmapCanvas(job->width, job->height);
+        job->ok = render(g, &sized, job);
+        done += job->ok;
+    }
+    if (sized.font)
+        $(free, sized.font);
+    if (g)
+        $(free, g);
+    FETCH_ADD(&batch->done, done);
+}
+
+int pgRenderBatch(PgRenderJob jobs[], int njobs, int nthreads) {
+    if (njobs <= 0)
+        return 0;
+    if (nthreads <= 0)
+        nthreads = _pgGetProcessorCount();
+    nthreads = MIN(nthreads, njobs);
+
+    // Jobs are dealt out in even runs; uneven jobs are balanced by stealing
+    Batch batch = { jobs, NULL, nthreads, 0 };
+    batch.queues = NEW_ARRAY(Queue, nthreads);
+    for (int i = 0; i < nthreads; i++)
+        batch.queues[i].range = packRange(
+            (int64_t)njobs * i / nthreads,
+            (int64_t)njobs * (i + 1) / nthreads);
+    _pgRunThreads(nthreads, worker, &batch);
+    free(batch.queues);
+    return batch.done;
+}
+
+bool pgWriteImage(const Pg *g, const wchar_t *filename, PgImageFormat format) {
+    const uint32_t *data = ((PgBitmapCanvas*)g)->data;
+    int stride = ((PgBitmapCanvas*)g)->stride;
+    int n = g->width * g->height;
+    if (format == PG_IMAGE_RAW && stride == g->width)
+        return _pgWriteFile(filename, data, n * sizeof *data);
+
+    // Binary PPM is RGB without alpha
+    char header[64];
+    int len = format == PG_IMAGE_RAW? 0:
+        snprintf(header, sizeof header, "P6\n%d %d\n255\n", g->width, g->height);
+    int bytes = format == PG_IMAGE_RAW? sizeof *data: 3;
+    uint8_t *out = NEW_ARRAY(uint8_t, len + n * bytes);
+    memcpy(out, header, len);
+    uint8_t *p = out + len;
+    for (int y = 0; y < g->height; y++, data += stride)
+        if (format == PG_IMAGE_RAW) {
+            memcpy(p, data, g->width * sizeof *data);
+            p += g->width * sizeof *data;
+        } else
+            for (int x = 0; x < g->width; x++, p += 3) {
+                p[0] = data[x] >> 16;
+                p[1] = data[x] >> 8;
+                p[2] = data[x];
+            }
+    bool ok = _pgWriteFile(filename, out, len + n * bytes);
+    free(out);
+    return ok;
+}
+
+PgRenderJob pgDefaultRenderJob(void) {
+    return (PgRenderJob) {
+        .width = 0,
+        .height = 0,
+        .background = 0xffffffff,
+        .color = 0xff000000,
+        .matrix = { 1, 0, 0, 1, 0, 0 },
+        .svg = NULL,
+        .font = NULL,
+        .size = 12,
+        .text = NULL,
+        .at = { 0, 0 },
+        .output = NULL,
+        .format = PG_IMAGE_PPM,
+        .finish = NULL,
+        .data = NULL,
+        .ok = false,
+    };
+}
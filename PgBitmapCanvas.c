@@ -3,6 +3,7 @@
 #include <assert.h>
 #include <ctype.h>
 #include <float.h>
+#include <limits.h>
 #include <emmintrin.h>
 #include <math.h>
 #include <stdarg.h>
@@ -25,6 +26,7 @@ typedef struct {
 typedef struct {
     int     n;
     int     cap;
+    int     allocations;
     Segment *segs;
 } SegList;
 
@@ -32,6 +34,7 @@ static void addSeg(SegList *list, PgPt a, PgPt b) {
     if (list->n + 1 >= list->cap) {
         list->cap = list->cap? list->cap * 2: 128;
         list->segs = realloc(list->segs, list->cap * sizeof *list->segs);
+        list->allocations++;
     }
     list->segs[list->n].a = a.y < b.y? a: b;
     list->segs[list->n].b = a.y < b.y? b: a;
@@ -81,7 +84,10 @@ static int sortTops(const void *ap, const void *bp) {
             a->a.x > b->a.x? 1:
             0;
 }
-static void fillSegments(const Pg *g, const Segment *segs, int nsegs, uint32_t color) {
+// Fills the canvas as rows top onwards of an image height rows tall
+// Blends into the canvas rows from top, or writes coverage to the rows of mask
+// instead when there is one
+static void fillSegments(const Pg *g, const Segment *segs, int nsegs, uint32_t color, int top, int height, uint8_t *mask) {
     typedef struct {
         float y0;
         float y1;
@@ -96,9 +102,15 @@ static void fillSegments(const Pg *g, const Segment *segs, int nsegs, uint32_t c
         if (segs[i].a.y < min_y) min_y = segs[i].a.y;
         if (segs[i].b.y > max_y) max_y = segs[i].b.y;
     }
-    min_y = clamp(0, min_y / g->subsamples + 1, g->height - 1);
-    max_y = clamp(0, max_y / g->subsamples + 1, g->height - 1);
+    min_y = clamp(0, min_y / g->subsamples + 1, height - 1);
+    max_y = clamp(0, max_y / g->subsamples + 1, height - 1);
+    min_y = MAX(min_y, top); // only the rows this canvas holds
+    max_y = MIN(max_y, top + g->height - 1);
     
+    double                  start = STATS_NOW(g);
+    double                  blending = 0;
+    int64_t                 blended = 0;
+    int64_t                 touched = 0;
     uint8_t * __restrict    buffer = NEW_ARRAY(uint8_t, g->width);
     Edge * __restrict       edges = calloc(1, nsegs * sizeof *edges);
         
@@ -137,6 +149,8 @@ static void fillSegments(const Pg *g, const Segment *segs, int nsegs, uint32_t c
                 } else // starts after this scanline
                     break;
             
+            touched += nedges;
+            
             // Sort edges from left to right
             for (int i = 1; i < nedges; i++)
                 for (int j = i; j > 0 && edges[j - 1].x > edges[j].x; j--) {
@@ -147,22 +161,23 @@ static void fillSegments(const Pg *g, const Segment *segs, int nsegs, uint32_t c
         
             // Render edges
             for (int i = 1; i < nedges; i += 2) {
-                int start = clamp(0, edges[i - 1].x, g->width - 1);
-                int end = clamp(0, edges[i].x, g->width - 1);
+                float x0 = edges[i - 1].x;
+                float x1 = edges[i].x;
+                if (x1 <= 0 || x0 >= g->width)
+                    continue;
+                int start = clamp(0, x0, g->width - 1);
+                int end = clamp(0, x1, g->width - 1);
                 if (start < min_x) min_x = start;
                 if (end > max_x) max_x = end;
                 
+                // Spans running off the canvas only cover up to its edges
                 if (start == end)
-                    if (start == (int)edges[i-1].x)
-                        buffer[start] += (edges[i].x - edges[i - 1].x) * max_alpha;
-                    else;
+                    buffer[start] += (MIN(x1, start + 1) - MAX(x0, start)) * max_alpha;
                 else {
-                    if (start == (int)edges[i-1].x)
-                        buffer[start] += (1 - fraction(edges[i-1].x)) * max_alpha;
+                    buffer[start] += (start + 1 - MAX(x0, start)) * max_alpha;
                     for (int i = start + 1; i < end; i++)
                         buffer[i] += max_alpha;
-                    if (end == (int)edges[i].x)
-                        buffer[end] += fraction(edges[i].x) * max_alpha;
+                    buffer[end] += (MIN(x1, end + 1) - end) * max_alpha;
                 }
             }
         }
@@ -207,38 +222,83 @@ static void fillSegments(const Pg *g, const Segment *segs, int nsegs, uint32_t c
 //                *(__m128i*)(screen + i) = _mm_srli_epi32(_mm_or_si128(rb, g), 8);
 //            }
 //        } else
-        {
-            uint32_t * __restrict   screen = ((PgBitmapCanvas*)g)->data + scan_y * g->width;
+        if (mask) {
+            if (min_x <= max_x)
+                memcpy(mask + (scan_y - top) * g->width + min_x, buffer + min_x, max_x - min_x + 1);
+        } else {
+            double t = STATS_NOW(g);
+            uint32_t * __restrict   screen = ((PgBitmapCanvas*)g)->data + (scan_y - top) * ((PgBitmapCanvas*)g)->stride;
             for (int i = min_x; i <= max_x; i++)
-                if (buffer[i]) screen[i] = pgBlend(screen[i], color, buffer[i]);
+                if (buffer[i]) {
+                    screen[i] = pgBlend(screen[i], color, buffer[i]);
+                    blended++;
+                }
+            blending += STATS_NOW(g) - t;
         }
     }
     free(buffer);
     free(edges);
+    STATS_ADD(g, scan, STATS_NOW(g) - start - blending);
+    STATS_ADD(g, blend, blending);
+    STATS_ADD(g, pixels, blended);
+    STATS_ADD(g, edges, touched);
+    STATS_ADD(g, allocations, 2);
+    STATS_TRACE(g, "fillSegments", start, "blend_us", blending * 1e6);
 }
-static void _fill(const Pg *g, const PgPath *path, uint32_t color) {
-    if (path->nparts == 0) return;
-    
+// Curves wholly off the canvas cross each row as often as the line between their ends.
+// Subsamples of the first row reach a little above it, so keep a pixel's margin.
+static bool offCanvas(const Pg *g, PgPt a, PgPt b, PgPt c, PgPt d) {
+    return  MAX(MAX(a.x, b.x), MAX(c.x, d.x)) < -1 ||
+            MIN(MIN(a.x, b.x), MIN(c.x, d.x)) >= g->width + 1 ||
+            MAX(MAX(a.y, b.y), MAX(c.y, d.y)) < -1 ||
+            MIN(MIN(a.y, b.y), MIN(c.y, d.y)) >= g->height + 1;
+}
+// Points are mapped as they are read so one path can be drawn under any transform
+static PgPt pointAt(const PgPath *path, int i, const PgMatrix *m) {
+    PgPt p = pgPathPoint(path, i);
+    return m? pgTransformPoint(m, p): p;
+}
+// Sorted segments ready for scan conversion. Curves off the canvas become chords when clipping.
+static SegList flatten(const Pg *g, const PgPath *path, const PgMatrix *matrix, bool clip) {
     SegList list = { 0 };
+    double start = STATS_NOW(g);
     
     // Decompose curves into a list of lines
-    PgPt a = {0, 0};
+    PgPt a = {0, 0}, p, b, c;
+    int n;
     for (int i = 0, ip = 0; i < path->nparts; ip += pgPathPartTypeArgs(path->types[i]), i++)
         switch (path->types[i]) {
         case PG_PATH_MOVE:
-            a = path->points[ip];
+            a = pointAt(path, ip, matrix);
             break;
         case PG_PATH_LINE:
-            addSeg(&list, a, path->points[ip]);
-            a = path->points[ip];
+            p = pointAt(path, ip, matrix);
+            addSeg(&list, a, p);
+            STATS_ADD(g, line_segments, 1);
+            a = p;
             break;
         case PG_PATH_QUADRATIC:
-            decompQuad(&list, a, path->points[ip], path->points[ip+1], g->flatness, BEZIER_RECURSION_LIMIT);
-            a = path->points[ip+1];
+            p = pointAt(path, ip, matrix);
+            b = pointAt(path, ip+1, matrix);
+            n = list.n;
+            if (clip && offCanvas(g, a, p, b, a))
+                addSeg(&list, a, b);
+            else
+                decompQuad(&list, a, p, b, g->flatness, BEZIER_RECURSION_LIMIT);
+            STATS_ADD(g, quadratic_segments, list.n - n);
+            a = b;
             break;
         case PG_PATH_CUBIC:
-            decompCubic(&list, a, path->points[ip], path->points[ip+1], path->points[ip+2], g->flatness, BEZIER_RECURSION_LIMIT);
-            a = path->points[ip+2];
+            p = pointAt(path, ip, matrix);
+            b = pointAt(path, ip+1, matrix);
+            c = pointAt(path, ip+2, matrix);
+            n = list.n;
+            if (clip && offCanvas(g, a, p, b, c))
+                addSeg(&list, a, c);
+            else
+                decompCubic(&list, a, p, b, c, g->flatness, BEZIER_RECURSION_LIMIT);
+            STATS_ADD(g, cubic_segments, list.n - n);
+            a = c;
             break;
         }
         
@@ -252,18 +312,163 @@ static void _fill(const Pg *g, const PgPath *path, uint32_t color) {
     }
     
     // Sort line segments by their tops
-    const Segment *const __restrict segs = list.segs;
-    const int nsegs = list.n;
-    qsort(list.segs, nsegs, sizeof *segs, sortTops);
+    double sorting = STATS_NOW(g);
+    STATS_TRACE(g, "flatten", start, "segments", list.n);
+    qsort(list.segs, list.n, sizeof *list.segs, sortTops);
+    STATS_ADD(g, flatten, sorting - start);
+    STATS_ADD(g, sort, STATS_NOW(g) - sorting);
+    STATS_ADD(g, segments, list.n);
+    STATS_ADD(g, allocations, list.allocations);
+    STATS_TRACE(g, "sort", sorting, "segments", list.n);
+    return list;
+}
+
+// Segments kept on a path between fills. Readers hold a reference so
+// another thread can replace the cache while they are still drawing.
+struct PgSegmentCache {
+    volatile long   refs;
+    PgMatrix        matrix;
+    float           flatness;
+    float           subsamples;
+    int             nparts;     // Paths only grow, so their size says whether they changed
+    int             npoints;
+    int             n;
+    Segment         segs[];
+};
+void _pgFreeSegmentCache(PgSegmentCache *cache) {
+    if (cache && FETCH_ADD(&cache->refs, -1) == 1)
+        free(cache);
+}
+static bool sameShape(const PgSegmentCache *cache, const Pg *g, const PgPath *path, const PgMatrix *m) {
+    return  cache->matrix.a == m->a && cache->matrix.b == m->b &&
+            cache->matrix.c == m->c && cache->matrix.d == m->d &&
+            cache->flatness == g->flatness &&
+            cache->subsamples == g->subsamples &&
+            cache->nparts == path->nparts &&
+            cache->npoints == path->npoints;
+}
+static void fillCached(const Pg *g, const PgPath *_path, const PgMatrix *m, uint32_t color) {
+    PgPath *path = (PgPath*)_path;
+    _pgLock(&path->segmentsLock);
+    PgSegmentCache *cache = path->segments;
+    if (cache && sameShape(cache, g, path, m))
+        FETCH_ADD(&cache->refs, 1);
+    else
+        cache = NULL;
+    _pgUnlock(&path->segmentsLock);
     
-    fillSegments(g, segs, nsegs, color);
-    free(list.segs);
+    // Flatten the whole path, since a later translation may bring any of it on screen
+    if (!cache) {
+        SegList list = flatten(g, path, m, false);
+        cache = malloc(sizeof *cache + list.n * sizeof *list.segs);
+        STATS_ADD(g, allocations, 1);
+        cache->refs = 2;
+        cache->matrix = *m;
+        cache->flatness = g->flatness;
+        cache->subsamples = g->subsamples;
+        cache->nparts = path->nparts;
+        cache->npoints = path->npoints;
+        cache->n = list.n;
+        if (list.n)
+            memcpy(cache->segs, list.segs, list.n * sizeof *list.segs);
+        free(list.segs);
+        
+        _pgLock(&path->segmentsLock);
+        PgSegmentCache *old = path->segments;
+        path->segments = cache;
+        _pgUnlock(&path->segmentsLock);
+        _pgFreeSegmentCache(old);
+    }
+    
+    // A translation moves every segment alike and keeps them sorted
+    float dx = m->e - cache->matrix.e;
+    float dy = (m->f - cache->matrix.f) * g->subsamples;
+    if (dx || dy) {
+        double start = STATS_NOW(g);
+        Segment *segs = NEW_ARRAY(Segment, cache->n);
+        for (int i = 0; i < cache->n; i++) {
+            segs[i] = cache->segs[i];
+            segs[i].a.x += dx;
+            segs[i].a.y += dy;
+            segs[i].b.x += dx;
+            segs[i].b.y += dy;
+        }
+        STATS_ADD(g, flatten, STATS_NOW(g) - start);
+        STATS_ADD(g, allocations, 1);
+        STATS_TRACE(g, "offset", start, "segments", cache->n);
+        fillSegments(g, segs, cache->n, color, 0, g->height, NULL);
+        free(segs);
+    } else
+        fillSegments(g, cache->segs, cache->n, color, 0, g->height, NULL);
+    _pgFreeSegmentCache(cache);
+}
+// Bounds are cached on the path so offscreen paths cost almost nothing
+static bool pathOffCanvas(const Pg *g, const PgPath *path, const PgMatrix *matrix) {
+    PgRect box = $(box, (PgPath*)path);
+    if (matrix) {
+        PgPt p[] = {
+            pgTransformPoint(matrix, box.a),
+            pgTransformPoint(matrix, pgPt(box.b.x, box.a.y)),
+            pgTransformPoint(matrix, box.b),
+            pgTransformPoint(matrix, pgPt(box.a.x, box.b.y)),
+        };
+        box.a = box.b = p[0];
+        for (int i = 1; i < 4; i++) {
+            box.a.x = MIN(box.a.x, p[i].x);
+            box.a.y = MIN(box.a.y, p[i].y);
+            box.b.x = MAX(box.b.x, p[i].x);
+            box.b.y = MAX(box.b.y, p[i].y);
+        }
+    }
+    return box.b.x < -1 || box.a.x >= g->width + 1 || box.b.y < -1 || box.a.y >= g->height + 1;
+}
+static void _fillTransformed(const Pg *g, const PgPath *path, const PgMatrix *matrix, uint32_t color) {
+    if (path->nparts == 0) return;
+    STATS_ADD(g, paths, 1);
+    
+    if (pathOffCanvas(g, path, matrix))
+        return;
+    
+    double start = STATS_NOW(g);
+    if (path->cacheSegments)
+        fillCached(g, path, matrix? matrix: &PgIdentityMatrix, color);
+    else {
+        SegList list = flatten(g, path, matrix, true);
+        fillSegments(g, list.segs, list.n, color, 0, g->height, NULL);
+        free(list.segs);
+    }
+    STATS_TRACE(g, "fill", start, "parts", path->nparts);
+}
+static void _fill(const Pg *g, const PgPath *path, uint32_t color) {
+    _fillTransformed(g, path, NULL, color);
+}
+// Coverage of a path as rows of bytes, over the width by height area
+// at the matrix's origin
+uint8_t *_pgPathCoverage(const Pg *g, const PgPath *path, const PgMatrix *matrix, int width, int height) {
+    uint8_t *mask = calloc(width, height);
+    Pg area = *g;
+    area.width = width;
+    area.height = height;
+    if (path->nparts && !pathOffCanvas(&area, path, matrix)) {
+        SegList list = flatten(&area, path, matrix, true);
+        fillSegments(&area, list.segs, list.n, 0xff000000, 0, height, mask);
+        free(list.segs);
+    }
+    return mask;
 }
 static float _fillGlyph(Pg *gs, const PgFont *font, PgPt at, unsigned g, uint32_t color) {
     float width = $(getGlyphWidth, font, g);
     float em = $(getEm, font);
     if (!within(-em, at.x, gs->width+em) || !within(-em, at.y, gs->height+em))
         return width;
+    STATS_ADD(gs, glyphs, 1);
+    
+    // Large glyphs come from one distance field shared by every size
+    float pixels = em * sqrtf(fabsf(gs->ctm.a * gs->ctm.d - gs->ctm.b * gs->ctm.c));
+    if (gs->sdf_size > 0 && pixels >= gs->sdf_size) {
+        _pgFillSdfGlyph(gs, font, at, g, color);
+        return width;
+    }
     
     PgMatrix ctm = gs->ctm;
     pgTranslateMatrix(&ctm, at.x, at.y);
@@ -278,22 +483,31 @@ static float _fillChar(Pg *gs, const PgFont *font, PgPt at, unsigned c, uint32_t
     return $(fillGlyph, gs, font, at, $(getGlyph, font, c), color);
 }
 static float _fillUtf8(Pg *gs, const PgFont *font, PgPt at, const uint8_t chars[], int len, uint32_t color) {
-    wchar_t *wchars = pgUtf8To16(chars, len, &len);
+    uint16_t *utf16 = pgUtf8To16(chars, len, &len);
+    wchar_t *wchars = (wchar_t*)utf16;
+    if (sizeof *wchars != sizeof *utf16) { // widen where wchar_t is UCS-4
+        wchars = NEW_ARRAY(wchar_t, len + 1);
+        for (int i = 0; i <= len; i++)
+            wchars[i] = utf16[i];
+        free(utf16);
+    }
     float width = $(fillString, gs, font, at, wchars, len, color);
     free(wchars);
     return width;
 }
 static float _fillString( Pg *gs, const PgFont *font, PgPt at, const wchar_t chars[], int len, uint32_t color) {
     float org = at.x;
-    if (len < 0) len = wcslen(chars);
+    uint16_t *glyphs = $(shapeString, font, chars, len, &len);
     for (int i = 0; i < len; i++)
-        at.x += $(fillGlyph, gs, font, at, $(getGlyph, font, chars[i]), color);
+        at.x += $(fillGlyph, gs, font, at, glyphs[i], color);
+    free(glyphs);
     return at.x - org;
 }
 
 static void _resize(Pg *g, int width, int height) {
     g->width = width;
     g->height = height;
+    ((PgBitmapCanvas*)g)->stride = width;
     REALLOC(((PgBitmapCanvas*)g)->data, uint32_t, width * height);
 }
 static void _free(Pg *g) {
@@ -303,9 +517,14 @@ static void _free(Pg *g) {
     }
 }
 static void _clear(const Pg *g, uint32_t color) {
-    uint32_t *p = ((PgBitmapCanvas*)g)->data;
-    uint32_t *end = ((PgBitmapCanvas*)g)->data + g->width * g->height;
-    while (p < end) *p++ = color;
+    // Rows with no gap between them clear as one run
+    int stride = ((PgBitmapCanvas*)g)->stride;
+    int run = stride == g->width? g->width * g->height: g->width;
+    int rows = stride == g->width? 1: g->height;
+    uint32_t *row = ((PgBitmapCanvas*)g)->data;
+    for (int y = 0; y < rows; y++, row += stride)
+        for (uint32_t *p = row, *end = row + run; p < end; )
+            *p++ = color;
 }
 
 static void _clearSection(const Pg *_g, PgRect rect, uint32_t color) {
@@ -315,7 +534,7 @@ static void _clearSection(const Pg *_g, PgRect rect, uint32_t color) {
     int y1 = clamp(0, rect.a.y, g->_.height);
     int y2 = clamp(0, ceil(rect.b.y), g->_.height);
     
-    int stride = g->_.width;
+    int stride = g->stride;
     uint32_t *p = g->data + y1 * stride;
     for (int y = y1; y < y2; y++, p += stride)
         for (int x = x1; x < x2; x++)
@@ -330,11 +549,14 @@ PgBitmapCanvas pgDefaultBitmapCanvas() {
     g._.clear = _clear;
     g._.clearSection = _clearSection;
     g._.fill = _fill;
+    g._.fillTransformed = _fillTransformed;
     g._.fillChar = _fillChar;
     g._.fillGlyph = _fillGlyph;
     g._.fillString = _fillString;
     g._.fillUtf8 = _fillUtf8;
+    g._.drawImage = _pgDrawImage;
     g.data = NULL;
+    g.stride = 0;
     return g;
 }
 Pg *pgNewBitmapCanvas(int width, int height) {
@@ -342,4 +564,276 @@ Pg *pgNewBitmapCanvas(int width, int height) {
     *(PgBitmapCanvas*)g = pgDefaultBitmapCanvas();
     $(resize, g, width, height);
     return g;
-}
\ No newline at end of file
+}
+
+// Canvases on memory they don't own neither free nor resize it
+static void _freeBorrowed(Pg *g) {
+    free(g);
+}
+static void _resizeBorrowed(Pg *g, int width, int height) {
+}
+// Draws into the caller's pixels, such as a video frame or window surface
+Pg *pgNewBitmapCanvasOn(uint32_t *data, int width, int height, int stride) {
+    Pg *g = NEW(PgBitmapCanvas);
+    *(PgBitmapCanvas*)g = pgDefaultBitmapCanvas();
+    g->free = _freeBorrowed;
+    g->resize = _resizeBorrowed;
+    pgSetBitmapData(g, data, width, height, stride);
+    return g;
+}
+// A canvas onto part of another bitmap canvas, whose coordinates start at
+// the rectangle's corner. It is only valid until the parent is resized or freed.
+Pg *pgNewBitmapView(Pg *parent, PgRect rect) {
+    PgBitmapCanvas *p = (PgBitmapCanvas*)parent;
+    int x1 = clamp(0, rect.a.x, parent->width);
+    int x2 = clamp(0, ceil(rect.b.x), parent->width);
+    int y1 = clamp(0, rect.a.y, parent->height);
+    int y2 = clamp(0, ceil(rect.b.y), parent->height);
+    return pgNewBitmapCanvasOn(p->data + y1 * p->stride + x1,
+        MAX(x2 - x1, 0), MAX(y2 - y1, 0), p->stride);
+}
+// Points a canvas made by pgNewBitmapCanvasOn at other pixels, such as the next video frame
+void pgSetBitmapData(Pg *g, uint32_t *data, int width, int height, int stride) {
+    g->width = width;
+    g->height = height;
+    ((PgBitmapCanvas*)g)->data = data;
+    ((PgBitmapCanvas*)g)->stride = stride;
+}
+// One fill in a scene: a rectangle cleared to a color, an image, or sorted segments
+struct PgSceneFill {
+    uint32_t    color;
+    bool        clear;
+    PgRect      rect;       // Cleared, or the part of the image drawn
+    const Pg    *image;
+    PgMatrix    matrix;     // Takes the image to the page
+    float       opacity;
+    PgFilter    filter;
+    int         n;
+    Segment     segs[];
+};
+
+static void addFill(PgSceneCanvas *scene, PgSceneFill *fill) {
+    if (scene->nfills == scene->cap) {
+        scene->cap = scene->cap? scene->cap * 2: 64;
+        REALLOC(scene->fills, PgSceneFill*, scene->cap);
+    }
+    scene->fills[scene->nfills++] = fill;
+}
+static void _sceneFillTransformed(const Pg *g, const PgPath *path, const PgMatrix *matrix, uint32_t color) {
+    if (path->nparts == 0) return;
+    STATS_ADD(g, paths, 1);
+    if (pathOffCanvas(g, path, matrix))
+        return;
+    SegList list = flatten(g, path, matrix, true);
+    PgSceneFill *fill = malloc(sizeof *fill + list.n * sizeof *list.segs);
+    *fill = (PgSceneFill) { .color = color, .n = list.n };
+    if (list.n)
+        memcpy(fill->segs, list.segs, list.n * sizeof *list.segs);
+    free(list.segs);
+    addFill((PgSceneCanvas*)g, fill);
+}
+static void _sceneFill(const Pg *g, const PgPath *path, uint32_t color) {
+    _sceneFillTransformed(g, path, NULL, color);
+}
+// Glyphs are recorded as paths, since distance fields draw straight to pixels
+static float _sceneFillGlyph(Pg *g, const PgFont *font, PgPt at, unsigned glyph, uint32_t color) {
+    float sdf_size = g->sdf_size;
+    g->sdf_size = 0;
+    float width = _fillGlyph(g, font, at, glyph, color);
+    g->sdf_size = sdf_size;
+    return width;
+}
+static void _sceneClearSection(const Pg *g, PgRect rect, uint32_t color) {
+    PgSceneFill *fill = NEW(PgSceneFill);
+    *fill = (PgSceneFill) { .color = color, .clear = true, .rect = rect };
+    addFill((PgSceneCanvas*)g, fill);
+}
+// Images are only referred to, so they must outlive the scene's rendering
+static void _sceneDrawImage(const Pg *g, const Pg *image, PgRect from, const PgMatrix *matrix, float opacity, PgFilter filter) {
+    PgSceneFill *fill = NEW(PgSceneFill);
+    *fill = (PgSceneFill) {
+        .rect = from,
+        .image = image,
+        .matrix = matrix? *matrix: PgIdentityMatrix,
+        .opacity = opacity,
+        .filter = filter,
+    };
+    pgMultiplyMatrix(&fill->matrix, &g->ctm);
+    addFill((PgSceneCanvas*)g, fill);
+}
+// Clearing everything makes what was recorded before invisible
+static void _sceneClear(const Pg *g, uint32_t color) {
+    PgSceneCanvas *scene = (PgSceneCanvas*)g;
+    for (int i = 0; i < scene->nfills; i++)
+        free(scene->fills[i]);
+    scene->nfills = 0;
+    scene->background = color;
+}
+static void _sceneResize(Pg *g, int width, int height) {
+    g->width = width;
+    g->height = height;
+}
+static void _sceneFree(Pg *g) {
+    if (g) {
+        _sceneClear(g, 0);
+        free(((PgSceneCanvas*)g)->fills);
+        free(g);
+    }
+}
+
+PgSceneCanvas pgDefaultSceneCanvas() {
+    PgSceneCanvas g;
+    g._ = pgDefaultBitmapCanvas();
+    g._._.free = _sceneFree;
+    g._._.resize = _sceneResize;
+    g._._.clear = _sceneClear;
+    g._._.clearSection = _sceneClearSection;
+    g._._.fill = _sceneFill;
+    g._._.fillTransformed = _sceneFillTransformed;
+    g._._.fillGlyph = _sceneFillGlyph;
+    g._._.drawImage = _sceneDrawImage;
+    g.background = 0;
+    g.fills = NULL;
+    g.nfills = 0;
+    g.cap = 0;
+    return g;
+}
+// Records at full size without holding any pixels
+Pg *pgNewSceneCanvas(int width, int height) {
+    Pg *g = NEW(PgSceneCanvas);
+    *(PgSceneCanvas*)g = pgDefaultSceneCanvas();
+    $(resize, g, width, height);
+    return g;
+}
+
+// The segments of one fill that cross a strip, or a rectangle clear
+typedef struct {
+    int     fill;
+    int     first;
+    int     n;
+} StripFill;
+
+typedef struct {
+    StripFill   *fills;
+    int         nfills;
+    int         capFills;
+    Segment     *segs;
+    int         nsegs;
+    int         capSegs;
+} Strip;
+
+static void addToStrip(Strip *strip, int fill, const Segment *seg) {
+    if (!strip->nfills || strip->fills[strip->nfills - 1].fill != fill) {
+        if (strip->nfills == strip->capFills) {
+            strip->capFills = strip->capFills? strip->capFills * 2: 16;
+            REALLOC(strip->fills, StripFill, strip->capFills);
+        }
+        strip->fills[strip->nfills++] = (StripFill) { fill, strip->nsegs, 0 };
+    }
+    if (!seg)
+        return;
+    if (strip->nsegs == strip->capSegs) {
+        strip->capSegs = strip->capSegs? strip->capSegs * 2: 128;
+        REALLOC(strip->segs, Segment, strip->capSegs);
+    }
+    strip->segs[strip->nsegs++] = *seg;
+    strip->fills[strip->nfills - 1].n++;
+}
+static void bucket(const PgSceneCanvas *scene, Strip *strips, int nstrips, int rows) {
+    const Pg *g = &scene->_._;
+    for (int i = 0; i < scene->nfills; i++) {
+        const PgSceneFill *fill = scene->fills[i];
+        if (fill->clear || fill->image) {
+            float top = fill->rect.a.y, bottom = fill->rect.b.y;
+            if (fill->image) {
+                float w = fill->rect.b.x - fill->rect.a.x;
+                float h = fill->rect.b.y - fill->rect.a.y;
+                PgPt p[] = {
+                    pgTransformPoint(&fill->matrix, pgPt(0, 0)),
+                    pgTransformPoint(&fill->matrix, pgPt(w, 0)),
+                    pgTransformPoint(&fill->matrix, pgPt(w, h)),
+                    pgTransformPoint(&fill->matrix, pgPt(0, h)),
+                };
+                top = bottom = p[0].y;
+                for (int k = 1; k < 4; k++) {
+                    top = MIN(top, p[k].y);
+                    bottom = MAX(bottom, p[k].y);
+                }
+            }
+            int first = clamp(0, floorf(top) / rows, nstrips - 1);
+            int last = clamp(0, ceilf(bottom) / rows, nstrips - 1);
+            for (int s = first; s <= last; s++)
+                addToStrip(&strips[s], i, NULL);
+            continue;
+        }
+
+        // Subsamples reach half a row either side, so keep a row's margin.
+        // Segments stay in order within a fill, so each strip's stay sorted.
+        for (int j = 0; j < fill->n; j++) {
+            const Segment *seg = &fill->segs[j];
+            if (seg->b.y < -g->subsamples || seg->a.y > (g->height + 1) * g->subsamples)
+                continue;
+            int first = clamp(0, (floorf(seg->a.y / g->subsamples) - 1) / rows, nstrips - 1);
+            int last = clamp(0, (floorf(seg->b.y / g->subsamples) + 2) / rows, nstrips - 1);
+            for (int s = first; s <= last; s++) {
+                // The topmost segment says which row scanning starts on, as in one
+                // pass over the whole image, so every strip starts with it
+                Strip *strip = &strips[s];
+                if (j && (!strip->nfills || strip->fills[strip->nfills - 1].fill != i))
+                    addToStrip(strip, i, &fill->segs[0]);
+                addToStrip(strip, i, seg);
+            }
+        }
+    }
+}
+
+// Renders the scene a strip of rows at a time and hands each strip to the sink,
+// which returns false to stop. Segments are first sorted into every strip they
+// cross, so each strip only scans its own geometry.
+bool pgRenderStrips(const Pg *g, int rows, bool sink(void *data, int top, int height, const uint32_t *pixels, int stride), void *data) {
+    const PgSceneCanvas *scene = (const PgSceneCanvas*)g;
+    if (rows <= 0 || g->width <= 0 || g->height <= 0)
+        return false;
+    int nstrips = (g->height + rows - 1) / rows;
+    Strip *strips = NEW_ARRAY(Strip, nstrips);
+    memset(strips, 0, nstrips * sizeof *strips);
+    double start = STATS_NOW(g);
+    bucket(scene, strips, nstrips, rows);
+    STATS_TRACE(g, "bucket", start, "strips", nstrips);
+
+    // One canvas the height of a strip is drawn over and over
+    Pg *canvas = pgNewBitmapCanvas(g->width, rows);
+    canvas->subsamples = g->subsamples;
+    canvas->flatness = g->flatness;
+    canvas->stats = g->stats;
+    bool ok = true;
+    for (int s = 0; ok && s < nstrips; s++) {
+        const Strip *strip = &strips[s];
+        int top = s * rows;
+        canvas->height = MIN(rows, g->height - top);
+        $(clear, canvas, scene->background);
+        for (int i = 0; i < strip->nfills; i++) {
+            const PgSceneFill *fill = scene->fills[strip->fills[i].fill];
+            if (fill->clear)
+                $(clearSection, canvas, pgRect(
+                    pgPt(fill->rect.a.x, fill->rect.a.y - top),
+                    pgPt(fill->rect.b.x, fill->rect.b.y - top)),
+                    fill->color);
+            else if (fill->image) {
+                PgMatrix m = fill->matrix;
+                pgTranslateMatrix(&m, 0, -top);
+                $(drawImage, canvas, fill->image, fill->rect, &m, fill->opacity, fill->filter);
+            } else
+                fillSegments(canvas, strip->segs + strip->fills[i].first, strip->fills[i].n, fill->color, top, g->height, NULL);
+        }
+        ok = sink(data, top, canvas->height, ((PgBitmapCanvas*)canvas)->data, ((PgBitmapCanvas*)canvas)->stride);
+    }
+    canvas->stats = NULL;
+    $(free, canvas);
+    for (int s = 0; s < nstrips; s++) {
+        free(strips[s].fills);
+        free(strips[s].segs);
+    }
+    free(strips);
+    return ok;
+}
@@ -0,0 +1,377 @@
+// Gaussian blurs from repeated box filters, and the drop shadows drawn with them
+#define _USE_MATH_DEFINES
+#include <assert.h>
+#include <ctype.h>
+#include <float.h>
+#include <emmintrin.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include <pg/pg.h>
+#include <pg/platform.h>
+#include "common.h"
+
+#define PASSES  3   // Box filters in a row come close enough to a Gaussian
+
+// A box of 2r+1 samples, plus a fraction alpha of the sample either side,
+// so any deviation is matched rather than only those of whole boxes
+typedef struct {
+    int     r;
+    float   alpha;
+    float   scale;
+} Box;
+
+static Box box(float sigma, int limit) {
+    float variance = sigma * sigma / PASSES;
+    Box b;
+    b.r = floorf(.5f * sqrtf(12 * variance + 1) - .5f);
+    b.alpha = (2 * b.r + 1) * (b.r * (b.r + 1) - 3 * variance) / (6 * (variance - (b.r + 1) * (b.r + 1)));
+    if (b.r > limit) { // Boxes wider than the image only spread its edges further
+        b.r = limit;
+        b.alpha = 0;
+    }
+    b.scale = 1 / (2 * b.r + 1 + 2 * b.alpha);
+    return b;
+}
+
+// Filters each row in place with running sums, so the cost doesn't grow with
+// the radius. Samples beyond the ends repeat the end ones.
+static void boxRows1(float *data, int width, int height, int span, Box b, float *line) {
+    int pad = b.r + 1;
+    for (int y = 0; y < height; y++) {
+        float *row = data + y * span;
+        for (int i = 0; i < width + 2 * pad; i++)
+            line[i] = row[clamp(0, i - pad, width - 1)];
+        float sum = 0;
+        for (int i = 1; i <= 2 * b.r + 1; i++)
+            sum += line[i];
+        for (int x = 0, p = pad; x < width; x++, p++) {
+            row[x] = (sum + b.alpha * (line[p - b.r - 1] + line[p + b.r + 1])) * b.scale;
+            sum += line[p + b.r + 1] - line[p - b.r];
+        }
+    }
+}
+// The same for four channels a pixel, all at once
+static void boxRows4(float *data, int width, int height, int span, Box b, float *line) {
+    int pad = b.r + 1;
+    __m128 alpha = _mm_set1_ps(b.alpha);
+    __m128 scale = _mm_set1_ps(b.scale);
+    for (int y = 0; y < height; y++) {
+        float *row = data + y * span;
+        for (int i = 0; i < width + 2 * pad; i++)
+            _mm_storeu_ps(line + 4 * i, _mm_loadu_ps(row + 4 * clamp(0, i - pad, width - 1)));
+        __m128 sum = _mm_setzero_ps();
+        for (int i = 1; i <= 2 * b.r + 1; i++)
+            sum = _mm_add_ps(sum, _mm_loadu_ps(line + 4 * i));
+        for (int x = 0, p = pad; x < width; x++, p++) {
+            __m128 before = _mm_loadu_ps(line + 4 * (p - b.r - 1));
+            __m128 after = _mm_loadu_ps(line + 4 * (p + b.r + 1));
+            __m128 v = _mm_mul_ps(_mm_add_ps(sum, _mm_mul_ps(alpha, _mm_add_ps(before, after))), scale);
+            _mm_storeu_ps(row + 4 * x, v);
+            sum = _mm_add_ps(sum, _mm_sub_ps(after, _mm_loadu_ps(line + 4 * (p - b.r))));
+        }
+    }
+}
+// Filters down the columns, a whole row of running sums at a time.
+// Rows are span floats long, a multiple of four.
+static void boxColumns(const float *in, float *out, int span, int height, Box b, float *sum) {
+    __m128 alpha = _mm_set1_ps(b.alpha);
+    __m128 scale = _mm_set1_ps(b.scale);
+    memset(sum, 0, span * sizeof *sum);
+    for (int k = -b.r; k <= b.r; k++) {
+        const float *row = in + clamp(0, k, height - 1) * span;
+        for (int i = 0; i < span; i += 4)
+            _mm_store_ps(sum + i, _mm_add_ps(_mm_load_ps(sum + i), _mm_load_ps(row + i)));
+    }
+    for (int y = 0; y < height; y++) {
+        const float *before = in + clamp(0, y - b.r - 1, height - 1) * span;
+        const float *after = in + clamp(0, y + b.r + 1, height - 1) * span;
+        const float *leaving = in + clamp(0, y - b.r, height - 1) * span;
+        float *row = out + y * span;
+        for (int i = 0; i < span; i += 4) {
+            __m128 s = _mm_load_ps(sum + i);
+            __m128 a = _mm_load_ps(after + i);
+            __m128 edges = _mm_add_ps(_mm_load_ps(before + i), a);
+            _mm_store_ps(row + i, _mm_mul_ps(_mm_add_ps(s, _mm_mul_ps(alpha, edges)), scale));
+            _mm_store_ps(sum + i, _mm_add_ps(s, _mm_sub_ps(a, _mm_load_ps(leaving + i))));
+        }
+    }
+}
+
+// Blurs width by height pixels of one or four float channels, rows span floats
+// apart; returns whichever of data and spare holds the result
+static float *blur(float *data, float *spare, int width, int height, int channels, int span, float sigma) {
+    Box b = box(sigma, MAX(width, height));
+    float *line = _mm_malloc((width + 2 * b.r + 2) * channels * sizeof *line, 16);
+    float *sum = _mm_malloc(span * sizeof *sum, 16);
+    for (int pass = 0; pass < PASSES; pass++)
+        if (channels == 4)
+            boxRows4(data, width, height, span, b, line);
+        else
+            boxRows1(data, width, height, span, b, line);
+    for (int pass = 0; pass < PASSES; pass++) {
+        boxColumns(data, spare, span, height, b, sum);
+        float *t = data;
+        data = spare;
+        spare = t;
+    }
+    _mm_free(line);
+    _mm_free(sum);
+    return data;
+}
+
+// Blurs part of a bitmap canvas in linear light. Sigma is the standard
+// deviation in pixels; edges of the part repeat outwards.
+void pgBlur(const Pg *g, PgRect rect, float sigma) {
+    PgBitmapCanvas *bitmap = (PgBitmapCanvas*)g;
+    int x0 = clamp(0, rect.a.x, g->width);
+    int x1 = clamp(0, ceilf(rect.b.x), g->width);
+    int y0 = clamp(0, rect.a.y, g->height);
+    int y1 = clamp(0, ceilf(rect.b.y), g->height);
+    int width = x1 - x0;
+    int height = y1 - y0;
+    if (!bitmap->data || width <= 0 || height <= 0 || !(sigma > 0))
+        return;
+    double start = STATS_NOW(g);
+
+    const uint16_t *linear;
+    const uint8_t *encode;
+    _pgGammaTables(&linear, &encode);
+    int span = width * 4;
+    float *data = _mm_malloc((size_t)span * height * sizeof *data, 16);
+    float *spare = _mm_malloc((size_t)span * height * sizeof *spare, 16);
+    for (int y = 0; y < height; y++) {
+        const uint32_t *src = bitmap->data + (y0 + y) * bitmap->stride + x0;
+        float *row = data + y * span;
+        for (int x = 0; x < width; x++) {
+            uint32_t c = src[x];
+            row[4 * x + 0] = linear[c & 255];
+            row[4 * x + 1] = linear[c >> 8 & 255];
+            row[4 * x + 2] = linear[c >> 16 & 255];
+            row[4 * x + 3] = (c >> 24) * 257;
+        }
+    }
+    float *out = blur(data, spare, width, height, 4, span, sigma);
+    for (int y = 0; y < height; y++) {
+        uint32_t *dst = bitmap->data + (y0 + y) * bitmap->stride + x0;
+        const float *row = out + y * span;
+        for (int x = 0; x < width; x++) {
+            __m128i v = _mm_cvtps_epi32(_mm_loadu_ps(row + 4 * x));
+            v = _mm_sub_epi32(v, _mm_set1_epi32(32768)); // Packed unsigned by way of signed
+            v = _mm_add_epi16(_mm_packs_epi32(v, v), _mm_set1_epi16(-32768));
+            uint16_t c[8];
+            _mm_storeu_si128((__m128i*)c, v);
+            dst[x] = (uint32_t)(c[3] >> 8) << 24 | encode[c[2]] << 16 | encode[c[1]] << 8 | encode[c[0]];
+        }
+    }
+    _mm_free(data);
+    _mm_free(spare);
+    STATS_ADD(g, pixels, (int64_t)width * height);
+    STATS_ADD(g, blend, STATS_NOW(g) - start);
+    STATS_TRACE(g, "blur", start, "pixels", width * height);
+}
+
+// A blurred mask kept on a path between shadows, reused under any
+// whole-pixel move of the same shape
+struct PgShadowCache {
+    volatile long   refs;
+    PgMatrix        matrix;
+    float           sigma;
+    float           flatness;
+    float           subsamples;
+    int             nparts;     // Paths only grow, so their size says whether they changed
+    int             npoints;
+    int             x, y;       // Corner of the mask on the canvas it was made for
+    int             width;
+    int             height;
+    uint8_t         data[];
+};
+void _pgFreeShadowCache(PgShadowCache *cache) {
+    if (cache && FETCH_ADD(&cache->refs, -1) == 1)
+        free(cache);
+}
+static bool sameShadow(const PgShadowCache *cache, const Pg *g, const PgPath *path, const PgMatrix *m, float sigma) {
+    float dx = m->e - cache->matrix.e;
+    float dy = m->f - cache->matrix.f;
+    return  cache->matrix.a == m->a && cache->matrix.b == m->b &&
+            cache->matrix.c == m->c && cache->matrix.d == m->d &&
+            dx == floorf(dx) && dy == floorf(dy) &&
+            cache->sigma == sigma &&
+            cache->flatness == g->flatness &&
+            cache->subsamples == g->subsamples &&
+            cache->nparts == path->nparts &&
+            cache->npoints == path->npoints;
+}
+
+// Blurs the coverage of a path over the pixels from x, y
+static PgShadowCache *newShadow(const Pg *g, const PgPath *path, const PgMatrix *m, float sigma, int x, int y, int width, int height) {
+    PgMatrix at = *m;
+    pgTranslateMatrix(&at, -x, -y);
+    uint8_t *coverage = _pgPathCoverage(g, path, &at, width, height);
+
+    int span = (width + 3) & ~3;
+    float *data = _mm_malloc((size_t)span * height * sizeof *data, 16);
+    float *spare = _mm_malloc((size_t)span * height * sizeof *spare, 16);
+    for (int j = 0; j < height; j++)
+        for (int i = 0; i < span; i++)
+            data[j * span + i] = i < width? coverage[j * width + i]: 0;
+    float *out = blur(data, spare, width, height, 1, span, sigma);
+
+    PgShadowCache *cache = malloc(sizeof *cache + (size_t)width * height);
+    STATS_ADD(g, allocations, 6);
+    cache->refs = 1;
+    cache->matrix = *m;
+    cache->sigma = sigma;
+    cache->flatness = g->flatness;
+    cache->subsamples = g->subsamples;
+    cache->nparts = path->nparts;
+    cache->npoints = path->npoints;
+    cache->x = x;
+    cache->y = y;
+    cache->width = width;
+    cache->height = height;
+    for (int j = 0; j < height; j++)
+        for (int i = 0; i < width; i++)
+            cache->data[j * width + i] = clamp(0, out[j * span + i] + .5f, 255);
+    free(coverage);
+    _mm_free(data);
+    _mm_free(spare);
+    return cache;
+}
+
+// Blends the color through a mask whose corner is at x, y in linear light
+static void blendMask(const Pg *g, const PgShadowCache *mask, int x, int y, uint32_t color) {
+    const uint16_t *linear;
+    const uint8_t *encode;
+    _pgGammaTables(&linear, &encode);
+    int r = linear[color >> 16 & 255];
+    int gr = linear[color >> 8 & 255];
+    int b = linear[color & 255];
+    int alpha = color >> 24;
+
+    PgBitmapCanvas *bitmap = (PgBitmapCanvas*)g;
+    int x0 = MAX(x, 0), x1 = MIN(x + mask->width, g->width);
+    int y0 = MAX(y, 0), y1 = MIN(y + mask->height, g->height);
+    int64_t pixels = 0;
+    for (int j = y0; j < y1; j++) {
+        const uint8_t *coverage = mask->data + (j - y) * mask->width;
+        uint32_t *dst = bitmap->data + j * bitmap->stride;
+        for (int i = x0; i < x1; i++) {
+            int a = coverage[i - x] * alpha / 255;
+            if (!a)
+                continue;
+            uint32_t bg = dst[i];
+            int na = 255 - a;
+            dst[i] = (bg & 0xff000000) |
+                encode[(r * a + linear[bg >> 16 & 255] * na) / 255] << 16 |
+                encode[(gr * a + linear[bg >> 8 & 255] * na) / 255] << 8 |
+                encode[(b * a + linear[bg & 255] * na) / 255];
+            pixels++;
+        }
+    }
+    STATS_ADD(g, pixels, pixels);
+}
+
+// Shadow of a path already in device space
+static void shadow(const Pg *g, const PgPath *_path, const PgMatrix *m, float sigma, uint32_t color) {
+    PgPath *path = (PgPath*)_path;
+    if (!((PgBitmapCanvas*)g)->data || !path->nparts || !(color >> 24))
+        return;
+    sigma = MAX(sigma, 0);
+    double start = STATS_NOW(g);
+
+    // The shape's bounds on the canvas, widened by where the blur reaches
+    PgRect r = $(box, path);
+    PgPt p[] = {
+        pgTransformPoint(m, r.a),
+        pgTransformPoint(m, pgPt(r.b.x, r.a.y)),
+        pgTransformPoint(m, r.b),
+        pgTransformPoint(m, pgPt(r.a.x, r.b.y)),
+    };
+    r.a = r.b = p[0];
+    for (int i = 1; i < 4; i++) {
+        r.a.x = MIN(r.a.x, p[i].x);
+        r.a.y = MIN(r.a.y, p[i].y);
+        r.b.x = MAX(r.b.x, p[i].x);
+        r.b.y = MAX(r.b.y, p[i].y);
+    }
+    float margin = ceilf(3 * sigma) + 1; // Further out the Gaussian is too faint to see
+    if (r.b.x + margin < 0 || r.a.x - margin >= g->width ||
+        r.b.y + margin < 0 || r.a.y - margin >= g->height)
+        return;
+
+    PgShadowCache *cache = NULL;
+    if (path->cacheShadow) {
+        _pgLock(&path->shadowLock);
+        cache = path->shadow;
+        if (cache && sameShadow(cache, g, path, m, sigma))
+            FETCH_ADD(&cache->refs, 1);
+        else
+            cache = NULL;
+        _pgUnlock(&path->shadowLock);
+    }
+    int x, y;
+    if (cache) {
+        x = cache->x + (int)(m->e - cache->matrix.e);
+        y = cache->y + (int)(m->f - cache->matrix.f);
+    } else {
+        // Only what can reach the canvas, unless it is kept for moves elsewhere
+        if (!path->cacheShadow) {
+            r.a.x = MAX(r.a.x, -margin);
+            r.a.y = MAX(r.a.y, -margin);
+            r.b.x = MIN(r.b.x, g->width + margin);
+            r.b.y = MIN(r.b.y, g->height + margin);
+        }
+        x = floorf(r.a.x - margin);
+        y = floorf(r.a.y - margin);
+        cache = newShadow(g, path, m, sigma, x, y,
+            (int)ceilf(r.b.x + margin) - x, (int)ceilf(r.b.y + margin) - y);
+        if (path->cacheShadow) {
+            cache->refs = 2;
+            _pgLock(&path->shadowLock);
+            PgShadowCache *old = path->shadow;
+            path->shadow = cache;
+            _pgUnlock(&path->shadowLock);
+            _pgFreeShadowCache(old);
+        }
+    }
+    blendMask(g, cache, x, y, color);
+    _pgFreeShadowCache(cache);
+    STATS_ADD(g, blend, STATS_NOW(g) - start);
+    STATS_TRACE(g, "shadow", start, "parts", path->nparts);
+}
+
+// Blurred shadow of what fillTransformed() would draw with the same matrix, moved
+// by offset pixels; like it, the CTM doesn't apply. Canvases without pixels of
+// their own, such as scenes, are left alone.
+void pgFillShadow(const Pg *g, const PgPath *path, const PgMatrix *matrix, PgPt offset, float sigma, uint32_t color) {
+    PgMatrix m = matrix? *matrix: PgIdentityMatrix;
+    pgTranslateMatrix(&m, offset.x, offset.y);
+    shadow(g, path, &m, sigma, color);
+}
+// Blurred shadow of the text fillString() would draw, as one mask
+float pgFillStringShadow(Pg *g, const PgFont *font, PgPt at, const wchar_t chars[], int len, PgPt offset, float sigma, uint32_t color) {
+    PgPath *path = pgNewPath();
+    float org = at.x;
+    uint16_t *glyphs = $(shapeString, font, chars, len, &len);
+    for (int i = 0; i < len; i++) {
+        PgMatrix ctm = g->ctm;
+        pgTranslateMatrix(&ctm, at.x, at.y);
+        PgPath *glyph = $(getGlyphPath, font, &ctm, glyphs[i]);
+        if (glyph) {
+            $(appendPath, path, NULL, glyph);
+            $(free, glyph);
+        }
+        at.x += $(getGlyphWidth, font, glyphs[i]);
+    }
+    free(glyphs);
+    PgMatrix m = PgIdentityMatrix;
+    pgTranslateMatrix(&m, offset.x, offset.y);
+    shadow(g, path, &m, sigma, color);
+    $(free, path);
+    return at.x - org;
+}
@@ -0,0 +1,517 @@
+// CFF and CFF2 (PostScript) outlines in OpenType fonts
+#define _USE_MATH_DEFINES
+#include <assert.h>
+#include <ctype.h>
+#include <float.h>
+#include <emmintrin.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include <pg/pg.h>
+#include <pg/platform.h>
+#include "common.h"
+
+#define CHARSTRING_STACK 513
+#define CHARSTRING_NESTING 10
+
+typedef struct {
+    int             count;
+    const uint8_t   *data;      // Offsets are relative to the byte before this
+    uint32_t        *offsets;   // count + 1 decoded offsets
+} CffIndex;
+
+struct PgCff {
+    bool            cff2;
+    int             nglyphs;
+    CffIndex        charstrings;
+    CffIndex        gsubrs;
+    int             nfds;
+    CffIndex        *lsubrs;    // Local subroutines of each font dict
+    uint8_t         *fdselect;  // Font dict of each glyph; NULL if only one
+    int             nvsindex;
+    uint16_t        *nregions;  // Variation regions for each vsindex
+    PgPath * volatile *outlines;// Interpreted glyphs in font units
+};
+
+typedef struct {
+    float           args[48];
+    int             nargs;
+    uint32_t        charstrings;
+    uint32_t        private_size;
+    uint32_t        private_offset;
+    uint32_t        fdarray;
+    uint32_t        fdselect;
+    uint32_t        vstore;
+    uint32_t        subrs;
+} CffDict;
+
+typedef struct {
+    const PgCff     *cff;
+    const CffIndex  *lsubrs;
+    PgPath          *path;
+    float           stack[CHARSTRING_STACK];
+    int             n;
+    int             nstems;
+    int             vsindex;
+    PgPt            p;
+    bool            open;
+} CharString;
+
+static const uint8_t *readIndex(CffIndex *index, const uint8_t *p, bool cff2) {
+    int count;
+    if (cff2)
+        count = p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3], p += 4;
+    else
+        count = p[0] << 8 | p[1], p += 2;
+
+    index->count = count;
+    index->offsets = NEW_ARRAY(uint32_t, count + 1);
+    if (!count) {
+        index->data = p;
+        index->offsets[0] = 1;
+        return p;
+    }
+
+    int size = *p++;
+    for (int i = 0; i <= count; i++, p += size) {
+        uint32_t offset = 0;
+        for (int j = 0; j < size; j++)
+            offset = offset << 8 | p[j];
+        index->offsets[i] = offset;
+    }
+    index->data = p - 1;
+    return index->data + index->offsets[count];
+}
+static const uint8_t *indexItem(const CffIndex *index, int i, const uint8_t **end) {
+    *end = index->data + index->offsets[i + 1];
+    return index->data + index->offsets[i];
+}
+static int subrBias(const CffIndex *index) {
+    return  index->count < 1240? 107:
+            index->count < 33900? 1131:
+            32768;
+}
+
+static float readReal(const uint8_t **pp) {
+    const uint8_t *p = *pp;
+    char buf[64];
+    int n = 0;
+    for (bool done = false; !done; p++)
+        for (int shift = 4; shift >= 0; shift -= 4) {
+            int nibble = *p >> shift & 15;
+            const char *s =
+                nibble <= 9? (char[]){ '0' + nibble, 0 }:
+                nibble == 0xa? ".":
+                nibble == 0xb? "E":
+                nibble == 0xc? "E-":
+                nibble == 0xe? "-":
+                "";
+            if (nibble == 0xf) {
+                done = true;
+                break;
+            }
+            while (*s && n < sizeof buf - 1)
+                buf[n++] = *s++;
+        }
+    buf[n] = 0;
+    *pp = p;
+    return strtof(buf, NULL);
+}
+static void parseDict(CffDict *dict, const uint8_t *p, const uint8_t *end) {
+    dict->nargs = 0;
+    while (p < end) {
+        int b0 = *p++;
+        float value;
+
+        if (b0 <= 27) { // operator
+            int op = b0 == 12? 1200 + *p++: b0;
+            uint32_t arg0 = dict->nargs > 0? dict->args[0]: 0;
+            switch (op) {
+            case 17:   dict->charstrings = arg0; break;
+            case 18:   if (dict->nargs >= 2) {
+                            dict->private_size = dict->args[0];
+                            dict->private_offset = dict->args[1];
+                       }
+                       break;
+            case 19:   dict->subrs = arg0; break;
+            case 24:   dict->vstore = arg0; break;
+            case 1236: dict->fdarray = arg0; break;
+            case 1237: dict->fdselect = arg0; break;
+            }
+            dict->nargs = 0;
+            continue;
+        }
+
+        if (b0 == 28)
+            value = (int16_t)(p[0] << 8 | p[1]), p += 2;
+        else if (b0 == 29)
+            value = (int32_t)(p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3]), p += 4;
+        else if (b0 == 30)
+            value = readReal(&p);
+        else if (b0 >= 32 && b0 <= 246)
+            value = b0 - 139;
+        else if (b0 >= 247 && b0 <= 250)
+            value = (b0 - 247) * 256 + *p++ + 108;
+        else if (b0 >= 251 && b0 <= 254)
+            value = -(b0 - 251) * 256 - *p++ - 108;
+        else
+            continue; // reserved
+
+        if (dict->nargs < 48)
+            dict->args[dict->nargs++] = value;
+    }
+}
+static void readPrivate(PgCff *cff, const uint8_t *table, CffIndex *lsubrs, uint32_t size, uint32_t offset) {
+    CffDict dict = { 0 };
+    const uint8_t *private = table + offset;
+    parseDict(&dict, private, private + size);
+    if (size && dict.subrs)
+        readIndex(lsubrs, private + dict.subrs, cff->cff2);
+    else
+        readIndex(lsubrs, (const uint8_t*)"\0\0\0\0", cff->cff2);
+}
+static void readFdSelect(PgCff *cff, const uint8_t *p) {
+    int format = *p++;
+    cff->fdselect = calloc(cff->nglyphs, 1);
+    if (format == 0)
+        for (int g = 0; g < cff->nglyphs; g++)
+            cff->fdselect[g] = p[g];
+    else if (format == 3 || format == 4) {
+        int wide = format == 4;
+        int nranges = wide? p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3]: p[0] << 8 | p[1];
+        p += wide? 4: 2;
+        for (int i = 0; i < nranges; i++) {
+            int first = wide? p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3]: p[0] << 8 | p[1];
+            int fd = wide? p[4] << 8 | p[5]: p[2];
+            p += wide? 6: 3;
+            int next = wide? p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3]: p[0] << 8 | p[1];
+            for (int g = first; g < next && g < cff->nglyphs; g++)
+                cff->fdselect[g] = fd;
+        }
+    }
+}
+static void readVariationStore(PgCff *cff, const uint8_t *p) {
+    const uint8_t *store = p + 2; // Skip length
+    int ndata = store[6] << 8 | store[7];
+    cff->nvsindex = ndata;
+    cff->nregions = NEW_ARRAY(uint16_t, MAX(ndata, 1));
+    for (int i = 0; i < ndata; i++) {
+        const uint8_t *o = store + 8 + i * 4;
+        const uint8_t *data = store + (o[0] << 24 | o[1] << 16 | o[2] << 8 | o[3]);
+        cff->nregions[i] = data[4] << 8 | data[5];
+    }
+}
+
+PgCff *_pgLoadCff(const uint8_t *table, bool cff2, int nglyphs) {
+    PgCff *cff = calloc(1, sizeof *cff);
+    CffDict top = { 0 };
+    const uint8_t *p;
+    cff->cff2 = cff2;
+    cff->nglyphs = nglyphs;
+
+    if (cff2) {
+        int header_size = table[2];
+        int top_size = table[3] << 8 | table[4];
+        parseDict(&top, table + header_size, table + header_size + top_size);
+        readIndex(&cff->gsubrs, table + header_size + top_size, true);
+        if (top.vstore)
+            readVariationStore(cff, table + top.vstore);
+    } else {
+        CffIndex names, tops, strings;
+        const uint8_t *end;
+        p = table + table[2];
+        p = readIndex(&names, p, false);
+        p = readIndex(&tops, p, false);
+        p = readIndex(&strings, p, false);
+        readIndex(&cff->gsubrs, p, false);
+
+        // Only the first font in a FontSet is used
+        if (tops.count) {
+            const uint8_t *dict = indexItem(&tops, 0, &end);
+            parseDict(&top, dict, end);
+        }
+        free(names.offsets);
+        free(tops.offsets);
+        free(strings.offsets);
+    }
+
+    if (!top.charstrings) {
+        _pgFreeCff(cff);
+        return NULL;
+    }
+    readIndex(&cff->charstrings, table + top.charstrings, cff2);
+
+    // CID-keyed fonts and CFF2 have a Private dict per font dict
+    if (top.fdarray) {
+        CffIndex fdarray;
+        readIndex(&fdarray, table + top.fdarray, cff2);
+        cff->nfds = fdarray.count;
+        cff->lsubrs = calloc(MAX(cff->nfds, 1), sizeof *cff->lsubrs);
+        for (int i = 0; i < cff->nfds; i++) {
+            const uint8_t *end;
+            const uint8_t *fd = indexItem(&fdarray, i, &end);
+            CffDict dict = { 0 };
+            parseDict(&dict, fd, end);
+            readPrivate(cff, table, &cff->lsubrs[i], dict.private_size, dict.private_offset);
+        }
+        free(fdarray.offsets);
+        if (top.fdselect && cff->nfds > 1)
+            readFdSelect(cff, table + top.fdselect);
+    } else {
+        cff->nfds = 1;
+        cff->lsubrs = calloc(1, sizeof *cff->lsubrs);
+        readPrivate(cff, table, &cff->lsubrs[0], top.private_size, top.private_offset);
+    }
+
+    cff->outlines = calloc(MAX(nglyphs, 1), sizeof *cff->outlines);
+    return cff;
+}
+void _pgFreeCff(PgCff *cff) {
+    if (cff) {
+        free(cff->charstrings.offsets);
+        free(cff->gsubrs.offsets);
+        for (int i = 0; i < cff->nfds; i++)
+            free(cff->lsubrs[i].offsets);
+        free(cff->lsubrs);
+        free(cff->fdselect);
+        free(cff->nregions);
+        if (cff->outlines)
+            for (int i = 0; i < cff->nglyphs; i++)
+                if (cff->outlines[i])
+                    $(free, cff->outlines[i]);
+        free((void*)cff->outlines);
+        free(cff);
+    }
+}
+
+static void closeContour(CharString *cs) {
+    if (cs->open)
+        $(close, cs->path);
+    cs->open = false;
+}
+static void moveTo(CharString *cs, float dx, float dy) {
+    closeContour(cs);
+    cs->p = pgPt(cs->p.x + dx, cs->p.y + dy);
+    $(move, cs->path, &PgIdentityMatrix, cs->p);
+    cs->open = true;
+}
+static void lineTo(CharString *cs, float dx, float dy) {
+    cs->p = pgPt(cs->p.x + dx, cs->p.y + dy);
+    $(line, cs->path, &PgIdentityMatrix, cs->p);
+}
+static void curveTo(CharString *cs, float dxa, float dya, float dxb, float dyb, float dxc, float dyc) {
+    PgPt a = pgPt(cs->p.x + dxa, cs->p.y + dya);
+    PgPt b = pgPt(a.x + dxb, a.y + dyb);
+    cs->p = pgPt(b.x + dxc, b.y + dyc);
+    $(cubic, cs->path, &PgIdentityMatrix, a, b, cs->p);
+}
+
+// Returns false once the glyph is finished
+static bool execute(CharString *cs, const uint8_t *p, const uint8_t *end, int depth) {
+    float *s = cs->stack;
+
+    while (p < end) {
+        int b0 = *p++;
+
+        // Operands
+        if (b0 >= 32 || b0 == 28) {
+            float value =
+                b0 == 28?   (int16_t)(p[0] << 8 | p[1]):
+                b0 <= 246?  b0 - 139:
+                b0 <= 250?  (b0 - 247) * 256 + p[0] + 108:
+                b0 <= 254?  -(b0 - 251) * 256 - p[0] - 108:
+                            (int32_t)(p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3]) / 65536.0f;
+            p +=    b0 == 28? 2:
+                    b0 <= 246? 0:
+                    b0 <= 254? 1:
+                    4;
+            if (cs->n < CHARSTRING_STACK)
+                s[cs->n++] = value;
+            continue;
+        }
+
+        int n = cs->n;
+        int i = 0;
+        switch (b0 == 12? 1200 + *p++: b0) {
+        case 1: // hstem
+        case 3: // vstem
+        case 18: // hstemhm
+        case 23: // vstemhm
+            cs->nstems += n / 2;
+            break;
+        case 19: // hintmask
+        case 20: // cntrmask
+            cs->nstems += n / 2;
+            p += (cs->nstems + 7) / 8;
+            break;
+        case 21: // rmoveto
+            if (n >= 2)
+                moveTo(cs, s[n - 2], s[n - 1]);
+            break;
+        case 22: // hmoveto
+            if (n >= 1)
+                moveTo(cs, s[n - 1], 0);
+            break;
+        case 4: // vmoveto
+            if (n >= 1)
+                moveTo(cs, 0, s[n - 1]);
+            break;
+        case 5: // rlineto
+            for ( ; i + 2 <= n; i += 2)
+                lineTo(cs, s[i], s[i + 1]);
+            break;
+        case 6: // hlineto
+        case 7: // vlineto
+            for (bool horz = b0 == 6; i < n; i++, horz = !horz)
+                if (horz)
+                    lineTo(cs, s[i], 0);
+                else
+                    lineTo(cs, 0, s[i]);
+            break;
+        case 8: // rrcurveto
+            for ( ; i + 6 <= n; i += 6)
+                curveTo(cs, s[i], s[i + 1], s[i + 2], s[i + 3], s[i + 4], s[i + 5]);
+            break;
+        case 24: // rcurveline
+            for ( ; i + 6 <= n - 2; i += 6)
+                curveTo(cs, s[i], s[i + 1], s[i + 2], s[i + 3], s[i + 4], s[i + 5]);
+            if (i + 2 <= n)
+                lineTo(cs, s[i], s[i + 1]);
+            break;
+        case 25: // rlinecurve
+            for ( ; i + 2 <= n - 6; i += 2)
+                lineTo(cs, s[i], s[i + 1]);
+            if (i + 6 <= n)
+                curveTo(cs, s[i], s[i + 1], s[i + 2], s[i + 3], s[i + 4], s[i + 5]);
+            break;
+        case 26: { // vvcurveto
+            float dx = 0;
+            if (n & 1)
+                dx = s[i++];
+            for ( ; i + 4 <= n; i += 4, dx = 0)
+                curveTo(cs, dx, s[i], s[i + 1], s[i + 2], 0, s[i + 3]);
+            break;
+        }
+        case 27: { // hhcurveto
+            float dy = 0;
+            if (n & 1)
+                dy = s[i++];
+            for ( ; i + 4 <= n; i += 4, dy = 0)
+                curveTo(cs, s[i], dy, s[i + 1], s[i + 2], s[i + 3], 0);
+            break;
+        }
+        case 30: // vhcurveto
+        case 31: // hvcurveto
+            for (bool horz = b0 == 31; i + 4 <= n; horz = !horz) {
+                float last = n - i == 5? s[i + 4]: 0;
+                if (horz)
+                    curveTo(cs, s[i], 0, s[i + 1], s[i + 2], last, s[i + 3]);
+                else
+                    curveTo(cs, 0, s[i], s[i + 1], s[i + 2], s[i + 3], last);
+                i += n - i == 5? 5: 4;
+            }
+            break;
+        case 1235: // flex
+            if (n >= 12) {
+                curveTo(cs, s[0], s[1], s[2], s[3], s[4], s[5]);
+                curveTo(cs, s[6], s[7], s[8], s[9], s[10], s[11]);
+            }
+            break;
+        case 1234: // hflex
+            if (n >= 7) {
+                curveTo(cs, s[0], 0, s[1], s[2], s[3], 0);
+                curveTo(cs, s[4], 0, s[5], -s[2], s[6], 0);
+            }
+            break;
+        case 1236: // hflex1
+            if (n >= 9) { // Ends on the line it started from
+                float y = cs->p.y;
+                curveTo(cs, s[0], s[1], s[2], s[3], s[4], 0);
+                curveTo(cs, s[5], 0, s[6], s[7], s[8], y - (cs->p.y + s[7]));
+            }
+            break;
+        case 1237: // flex1
+            if (n >= 11) {
+                PgPt start = cs->p;
+                float dx = s[0] + s[2] + s[4] + s[6] + s[8];
+                float dy = s[1] + s[3] + s[5] + s[7] + s[9];
+                curveTo(cs, s[0], s[1], s[2], s[3], s[4], s[5]);
+                if (fabsf(dx) > fabsf(dy))
+                    curveTo(cs, s[6], s[7], s[8], s[9], s[10], start.y - (cs->p.y + s[7] + s[9]));
+                else
+                    curveTo(cs, s[6], s[7], s[8], s[9], start.x - (cs->p.x + s[6] + s[8]), s[10]);
+            }
+            break;
+        case 10: // callsubr
+        case 29: { // callgsubr
+            if (!n || depth >= CHARSTRING_NESTING)
+                return false;
+            const CffIndex *subrs = b0 == 10? cs->lsubrs: &cs->cff->gsubrs;
+            int index = s[--cs->n] + subrBias(subrs);
+            if (index < 0 || index >= subrs->count)
+                return false;
+            const uint8_t *subr_end;
+            const uint8_t *subr = indexItem(subrs, index, &subr_end);
+            if (!execute(cs, subr, subr_end, depth + 1))
+                return false;
+            continue; // Keeps the stack
+        }
+        case 11: // return
+            return true;
+        case 14: // endchar
+            closeContour(cs);
+            return false;
+        case 15: // vsindex
+            if (n)
+                cs->vsindex = s[n - 1];
+            break;
+        case 16: { // blend keeps the default master's values
+            if (!n)
+                break;
+            int nvalues = s[n - 1];
+            int nregions = cs->vsindex >= 0 && cs->vsindex < cs->cff->nvsindex
+                ? cs->cff->nregions[cs->vsindex]
+                : 0;
+            int base = n - 1 - nvalues * (nregions + 1);
+            if (base >= 0)
+                cs->n = base + nvalues;
+            continue;
+        }
+        }
+        cs->n = 0;
+    }
+    return true;
+}
+
+static PgPath *interpret(const PgCff *cff, unsigned g) {
+    CharString cs = { 0 };
+    const uint8_t *end;
+    const uint8_t *data = indexItem(&cff->charstrings, g, &end);
+    cs.cff = cff;
+    cs.lsubrs = &cff->lsubrs[cff->fdselect && cff->fdselect[g] < cff->nfds? cff->fdselect[g]: 0];
+    cs.path = pgNewPath();
+    execute(&cs, data, end, 0);
+    closeContour(&cs);
+    return cs.path;
+}
+
+void _pgCffGlyphPath(PgPath *path, PgCff *cff, const PgMatrix *ctm, unsigned g) {
+    if (g >= cff->nglyphs || g >= cff->charstrings.count)
+        g = 0;
+
+    // Glyphs are interpreted once per face; threads racing on one keep the first
+    PgPath *outline = LOAD_ACQUIRE(&cff->outlines[g]);
+    if (!outline) {
+        outline = interpret(cff, g);
+        if (!CAS_POINTER(&cff->outlines[g], NULL, outline)) {
+            $(free, outline);
+            outline = LOAD_ACQUIRE(&cff->outlines[g]);
+        }
+    }
+
+    $(appendPath, path, ctm, outline);
+}
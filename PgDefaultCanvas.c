@@ -40,15 +40,19 @@ Pg pgDefaultCanvas() {
         .height = 0,
         .flatness = 1.001f,
         .subsamples = 3,
+        .sdf_size = 0,
         .ctm = { 1, 0, 0, 1, 0, 0 },
+        .stats = NULL,
         .free = (void*)_ignore,
         .clear = (void*)_ignore,
         .clearSection = (void*)_ignore,
         .fill = (void*)_ignore,
+        .fillTransformed = (void*)_ignore,
         .fillChar = (void*)_ignoreF,
         .fillGlyph = (void*)_ignoreF,
         .fillString = (void*)_ignoreF,
         .fillUtf8 = (void*)_ignoreF,
+        .drawImage = (void*)_ignore,
         .identity = _identity,
         .translate = _translate,
         .scale = _scale,
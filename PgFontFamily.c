@@ -17,49 +17,106 @@
 
 static PgFontFamily    *Families;
 static int              NFamilies;
+static volatile long    FamiliesLock;
+static volatile long    ScanLock;
+static PgFace          *Faces;
+static volatile long    FacesLock;
 
-static void scanFontsPerFile(const wchar_t *filename, void *data) {
-    int nfonts = 1;
+typedef struct {
+    wchar_t         *family;
+    int             file;       // Position in the directory listing
+    uint8_t         index;      // Position in a collection
+    int             weight;
+    bool            italic;
+} ScannedFace;
+
+typedef struct {
+    int             n;
+    int             cap;
+    ScannedFace     *faces;
+} ScanResults;
+
+typedef struct {
+    wchar_t         **files;
+    int             nfiles;
+    volatile long   next;
+    ScanResults     *results;   // One per thread
+} ScanJob;
+
+static void scanFile(ScanResults *results, const wchar_t *filename, int file) {
+    PgFont *first = _pgOpenFontFile(filename, 0, true);
+    if (!first) return;
+    
+    // Other fonts in a collection share the first one's mapping
+    int nfonts = $(getCount, first);
     for (int index = 0; index < nfonts; index++) {
-        PgFont *font = pgLoadFont(data, index, true);
+        PgFont *font = index? pgLoadFont(first->face->file, index, true): first;
         if (!font) continue;
-        nfonts = $(getCount, font);
-        
-        const wchar_t *family = $(getFamily, font);
-        int i, dir = 0;
         
-        for (i = 0; i < NFamilies; i++) {
-            dir = wcsicmp(family, Families[i].name);
-            if (dir <= 0)
-                break;
-        }
-        
-        if (dir < 0 || i == NFamilies) {
-            Families = realloc(Families, (NFamilies + 1) * sizeof *Families);
-            for (int j = NFamilies; j > i; j--)
-                Families[j] = Families[j - 1];
-            
-            memset(&Families[i], 0, sizeof *Families);
-            Families[i].name = wcsdup(family);
-            NFamilies++;
+        if (results->n + 1 >= results->cap) {
+            results->cap = results->cap? results->cap * 2: 64;
+            REALLOC(results->faces, ScannedFace, results->cap);
         }
+        results->faces[results->n++] = (ScannedFace) {
+            .family = wcsdup($(getFamily, font)),
+            .file = file,
+            .index = index,
+            .weight = $(getWeight, font) / 100,
+            .italic = $(isItalic, font),
+        };
+        if (font != first)
+            $(free, font);
+    }
+    $(free, first);
+}
+static void scanWorker(void *arg, int thread) {
+    ScanJob *job = arg;
+    ScanResults *results = &job->results[thread];
+    for (int file; (file = FETCH_ADD(&job->next, 1)) < job->nfiles; )
+        scanFile(results, job->files[file], file);
+}
+static int sortScannedFaces(const void *ap, const void *bp) {
+    const ScannedFace *a = ap;
+    const ScannedFace *b = bp;
+    int dir = wcsicmp(a->family, b->family);
+    return  dir? dir:
+            a->file != b->file? a->file - b->file:
+            a->index - b->index;
+}
+static PgFontFamily *mergeScannedFaces(wchar_t **files, ScannedFace *faces, int nfaces, int *countp) {
+    // Faces are in listing order within a family so later files win
+    qsort(faces, nfaces, sizeof *faces, sortScannedFaces);
+    
+    int nfamilies = 0;
+    for (int i = 0; i < nfaces; i++)
+        if (!i || wcsicmp(faces[i].family, faces[i - 1].family))
+            nfamilies++;
+    PgFontFamily *families = calloc(MAX(nfamilies, 1), sizeof *families);
+    
+    PgFontFamily *family = families - 1;
+    for (int i = 0; i < nfaces; i++) {
+        if (!i || wcsicmp(faces[i].family, family->name))
+            (++family)->name = faces[i].family;
+        else
+            free(faces[i].family);
         
-        int weight = $(getWeight, font) / 100;
+        int weight = faces[i].weight;
         if (weight >= 0 && weight < 10) {
-            const wchar_t **slot = $(isItalic, font)
-                ? &Families[i].italic[weight]
-                : &Families[i].roman[weight];
+            const wchar_t **slot = faces[i].italic
+                ? &family->italic[weight]
+                : &family->roman[weight];
             
             if (*slot)
                 free((void*)*slot);
-            *slot = wcsdup(filename);
-            if ($(isItalic, font))
-                Families[i].italicIndex[weight] = index;
+            *slot = wcsdup(files[faces[i].file]);
+            if (faces[i].italic)
+                family->italicIndex[weight] = faces[i].index;
             else
-                Families[i].romanIndex[weight] = index;
+                family->romanIndex[weight] = faces[i].index;
         }
-        $(free, font);
     }
+    *countp = nfamilies;
+    return families;
 }
 
 void pgFreeFontFamily(PgFontFamily *family) {
@@ -76,57 +133,179 @@ static PgFontFamily copyFontFamily(PgFontFamily *src) {
     
     out.name = wcsdup(src->name);
     for (int i = 0; i < 10; i++) {
-        out.roman[i] = src->roman[i];
-        out.italic[i] = src->italic[i];
+        out.roman[i] = src->roman[i]? wcsdup(src->roman[i]): NULL;
+        out.italic[i] = src->italic[i]? wcsdup(src->italic[i]): NULL;
         out.romanIndex[i] = src->romanIndex[i];
         out.italicIndex[i] = src->italicIndex[i];
     }
     return out;
 }
 
+static PgFontFamily *scanFamilies(const wchar_t *dir, int *countp) {
+    ScanJob job = { 0 };
+    job.files = _pgListFonts(dir, &job.nfiles);
+    
+    // Parse files in parallel then merge each thread's results at once
+    int nthreads = MIN(_pgGetProcessorCount(), job.nfiles);
+    job.results = calloc(MAX(nthreads, 1), sizeof *job.results);
+    _pgRunThreads(nthreads, scanWorker, &job);
+    
+    int nfaces = 0;
+    for (int i = 0; i < nthreads; i++)
+        nfaces += job.results[i].n;
+    ScannedFace *faces = NEW_ARRAY(ScannedFace, MAX(nfaces, 1));
+    for (int i = 0, n = 0; i < nthreads; n += job.results[i].n, i++) {
+        memcpy(faces + n, job.results[i].faces, job.results[i].n * sizeof *faces);
+        free(job.results[i].faces);
+    }
+    PgFontFamily *families = mergeScannedFaces(job.files, faces, nfaces, countp);
+    
+    for (int i = 0; i < job.nfiles; i++)
+        free(job.files[i]);
+    free(job.files);
+    free(job.results);
+    free(faces);
+    return families;
+}
+static void publishFamilies(PgFontFamily *families, int nfamilies) {
+    // Lookups only see a complete table; the old one goes once no one can reach it
+    _pgLock(&FamiliesLock);
+    PgFontFamily *old = Families;
+    int nold = NFamilies;
+    Families = families;
+    NFamilies = nfamilies;
+    _pgUnlock(&FamiliesLock);
+    
+    for (int i = 0; i < nold; i++)
+        pgFreeFontFamily(&old[i]);
+    free(old);
+}
+
 PgFontFamily *pgScanFonts(const wchar_t *dir, int *countp) {
-//    for (int i = 0; i < NFamilies; i++)
-//        pgFreeFontFamily(&Families[i]);
-    Families = NULL;
-    NFamilies = 0;
-    _pgScanDirectory(dir, scanFontsPerFile);
+    int nfamilies;
+    PgFontFamily *table = scanFamilies(dir, &nfamilies);
     
     // Copy families
-    PgFontFamily *families = malloc(NFamilies * sizeof *families);
-    for (int i = 0; i < NFamilies; i++) 
-        families[i] = copyFontFamily(&Families[i]);
+    PgFontFamily *families = malloc(MAX(nfamilies, 1) * sizeof *families);
+    for (int i = 0; i < nfamilies; i++) 
+        families[i] = copyFontFamily(&table[i]);
+    publishFamilies(table, nfamilies);
     
-    if (countp) *countp = NFamilies;
+    if (countp) *countp = nfamilies;
     return families;
 }
 PgFont *pgOpenFont(const wchar_t *family, PgFontWeight weight, bool italic, PgFontStretch stretch) {
     if (weight < 100) weight = 400;
     if (stretch < 1) stretch = 0;
     if (weight < 900 && stretch < 900) {
-        if (Families == NULL)
-            pgScanFonts(NULL, NULL);
+        // Scan the default directories once, however many threads get here first
+        if (!LOAD_ACQUIRE(&Families)) {
+            _pgLock(&ScanLock);
+            if (!LOAD_ACQUIRE(&Families)) {
+                int nfamilies;
+                PgFontFamily *table = scanFamilies(NULL, &nfamilies);
+                publishFamilies(table, nfamilies);
+            }
+            _pgUnlock(&ScanLock);
+        }
         
+        // Copy the file name out so the table can be replaced meanwhile
+        wchar_t *filename = NULL;
+        int index = 0;
+        _pgLock(&FamiliesLock);
         int f;
         for (f = 0; f < NFamilies; f++)
             if (!wcsicmp(Families[f].name, family))
                 break;
         
         if (f != NFamilies) {
-            uint8_t *index = italic? Families[f].italicIndex: Families[f].romanIndex;
-            const wchar_t **filename = italic? Families[f].italic: Families[f].roman;
+            uint8_t *indices = italic? Families[f].italicIndex: Families[f].romanIndex;
+            const wchar_t **filenames = italic? Families[f].italic: Families[f].roman;
+            int w = weight/100;
             
-            if (filename[weight/100])
-                return pgOpenFontFile(filename[weight/100], index[weight/100], false);
-            if (weight/100+1 <= 9 && filename[weight/100+1])
-                return pgOpenFontFile(filename[weight/100+1], index[weight/100+1], false);
-            if (weight/100-1 >= 0 && filename[weight/100-1])
-                return pgOpenFontFile(filename[weight/100-1], index[weight/100-1], false);
+            if (!filenames[w] && w+1 <= 9 && filenames[w+1])
+                w = w+1;
+            else if (!filenames[w] && w-1 >= 0 && filenames[w-1])
+                w = w-1;
+            if (filenames[w]) {
+                filename = wcsdup(filenames[w]);
+                index = indices[w];
+            }
+        }
+        _pgUnlock(&FamiliesLock);
+        
+        if (filename) {
+            PgFont *font = pgOpenFontFile(filename, index, false);
+            free(filename);
+            return font;
         }
     }
     return NULL;
 }
+// Retains the face already open for this file, if any; called under FacesLock
+static PgFace *findFace(const wchar_t *filename, int font_index) {
+    for (PgFace *face = Faces; face; face = face->next)
+        if (face->index == font_index && !wcscmp(face->filename, filename)) {
+            pgRetainFace(face);
+            return face;
+        }
+    return NULL;
+}
 PgFont *pgOpenFontFile(const wchar_t *filename, int font_index, bool scan_only) {
-    return _pgOpenFontFile(filename, font_index, scan_only);
+    if (scan_only)
+        return _pgOpenFontFile(filename, font_index, true);
+    
+    // Share the face if this file is already open
+    _pgLock(&FacesLock);
+    PgFace *face = findFace(filename, font_index);
+    _pgUnlock(&FacesLock);
+    if (face)
+        return $(newFont, face);
+    
+    // Parsing happens outside the lock, so another thread may open the same
+    // file meanwhile. The first face registered wins and later ones are dropped.
+    PgFont *font = _pgOpenFontFile(filename, font_index, false);
+    if (font) {
+        _pgLock(&FacesLock);
+        face = findFace(filename, font_index);
+        if (!face) {
+            font->face->filename = wcsdup(filename);
+            font->face->index = font_index;
+            font->face->next = Faces;
+            Faces = font->face;
+        }
+        _pgUnlock(&FacesLock);
+        if (face) { // The reference findFace() took passes to the new font
+            $(free, font);
+            font = $(newFont, face);
+        }
+    }
+    return font;
+}
+void pgRetainFace(PgFace *face) {
+    FETCH_ADD(&face->refs, 1);
+}
+void pgReleaseFace(PgFace *face) {
+    if (!face) return;
+    
+    // Unshare under the lock so no one can find a face being freed
+    _pgLock(&FacesLock);
+    bool last = FETCH_ADD(&face->refs, -1) == 1;
+    if (last && face->filename)
+        for (PgFace **p = &Faces; *p; p = &(*p)->next)
+            if (*p == face) {
+                *p = face->next;
+                break;
+            }
+    _pgUnlock(&FacesLock);
+    
+    if (last) {
+        if (face->_freeHost)
+            face->_freeHost(face);
+        free(face->filename);
+        _pgFreeSdfCache(face->sdf);
+        $(free, face);
+    }
 }
 
 PgFont *pgLoadFont(const void *file, int font_index, bool scan_only) {
@@ -0,0 +1,254 @@
+// Bitmaps drawn onto canvases under any transform, resampled and blended in linear light
+#define _USE_MATH_DEFINES
+#include <assert.h>
+#include <ctype.h>
+#include <float.h>
+#include <emmintrin.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include <pg/pg.h>
+#include <pg/platform.h>
+#include "common.h"
+
+typedef struct {
+    const uint32_t  *data;
+    int             stride;
+    int             x0, y0, x1, y1; // Texels that may be read
+    PgFilter        filter;
+    float           fu, fv;         // Texels under one pixel, for the box filter
+} Image;
+
+// The texels one axis of a sample reads: i0 alone, i0 and i1 mixed by w,
+// or every texel from i0 up to i1 for the box filter
+typedef struct {
+    int     i0;
+    int     i1;
+    float   w;
+} Taps;
+
+static Taps taps(PgFilter filter, float p, float footprint, int lo, int hi) {
+    Taps t;
+    if (filter == PG_FILTER_BILINEAR) {
+        float c = p - .5f;
+        t.i0 = floorf(c);
+        t.w = c - t.i0;
+        t.i1 = clamp(lo, t.i0 + 1, hi - 1);
+        t.i0 = clamp(lo, t.i0, hi - 1);
+    } else if (filter == PG_FILTER_BOX && footprint > 1) {
+        // Texels whose centres fall under the pixel
+        t.i0 = clamp(lo, ceilf(p - footprint / 2 - .5f), hi - 1);
+        t.i1 = clamp(t.i0 + 1, ceilf(p + footprint / 2 - .5f), hi);
+        t.w = 0;
+    } else {
+        t.i0 = clamp(lo, floorf(p), hi - 1);
+        t.i1 = t.i0 + 1;
+        t.w = 0;
+    }
+    return t;
+}
+
+// Texels are weighted by their alpha as well, so transparent texels don't darken
+// the edges of what they surround. The alpha lane carries 255 to sum the weights.
+static __m128 texel(uint32_t c) {
+    __m128i z = _mm_setzero_si128();
+    __m128i v = _mm_cvtsi32_si128(c | 0xff000000);
+    return _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(v, z), z));
+}
+static __m128 weigh(__m128 sum, uint32_t c, float w) {
+    return _mm_add_ps(sum, _mm_mul_ps(texel(c), _mm_set1_ps(w * (c >> 24))));
+}
+static uint32_t resolve(__m128 sum, float weight) {
+    float alpha = _mm_cvtss_f32(_mm_shuffle_ps(sum, sum, 3)) / 255;
+    if (alpha <= 0)
+        return 0;
+    __m128i v = _mm_cvtps_epi32(_mm_mul_ps(sum, _mm_set1_ps(1 / alpha)));
+    v = _mm_packs_epi32(v, v);
+    v = _mm_packus_epi16(v, v);
+    uint32_t c = _mm_cvtsi128_si32(v) & 0xffffff;
+    return c | (uint32_t)(alpha / weight + .5f) << 24;
+}
+static uint32_t sample(const Image *im, Taps u, Taps v) {
+    const uint32_t *row0 = im->data + v.i0 * im->stride;
+    const uint32_t *row1 = im->data + v.i1 * im->stride;
+    __m128 sum = _mm_setzero_ps();
+    switch (im->filter) {
+    case PG_FILTER_BILINEAR:
+        sum = weigh(sum, row0[u.i0], (1 - u.w) * (1 - v.w));
+        sum = weigh(sum, row0[u.i1], u.w * (1 - v.w));
+        sum = weigh(sum, row1[u.i0], (1 - u.w) * v.w);
+        sum = weigh(sum, row1[u.i1], u.w * v.w);
+        return resolve(sum, 1);
+    case PG_FILTER_BOX:
+        for (const uint32_t *row = row0; row < row1; row += im->stride)
+            for (int i = u.i0; i < u.i1; i++)
+                sum = weigh(sum, row[i], 1);
+        return resolve(sum, (u.i1 - u.i0) * (v.i1 - v.i0));
+    default:
+        return row0[u.i0];
+    }
+}
+
+// Blends a run of image pixels in linear light. Opaque pixels drawn at full
+// opacity are copied four at a time.
+static void blendRow(uint32_t *dst, const uint32_t *src, int n, int opacity) {
+    const uint16_t *linear;
+    const uint8_t *encode;
+    _pgGammaTables(&linear, &encode);
+    __m128i alpha = _mm_set1_epi32(0xff000000);
+    int i = 0;
+    while (i < n) {
+        if (opacity == 256)
+            for ( ; i + 4 <= n; i += 4) {
+                __m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+                if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(v, alpha), alpha)) != 0xffff)
+                    break;
+                _mm_storeu_si128((__m128i*)(dst + i), v);
+            }
+        for (int end = MIN(i + 4, n); i < end; i++) {
+            uint32_t fg = src[i];
+            uint32_t bg = dst[i];
+            int a = (fg >> 24) * opacity >> 8;
+            if (a == 255)
+                dst[i] = fg;
+            else if (a) {
+                int na = 255 - a;
+                int r = (linear[fg >> 16 & 255] * a + linear[bg >> 16 & 255] * na) / 255;
+                int g = (linear[fg >> 8 & 255] * a + linear[bg >> 8 & 255] * na) / 255;
+                int b = (linear[fg & 255] * a + linear[bg & 255] * na) / 255;
+                dst[i] = (bg & 0xff000000) | encode[r] << 16 | encode[g] << 8 | encode[b];
+            }
+        }
+    }
+}
+
+static bool invert(PgMatrix *out, const PgMatrix *m) {
+    float det = m->a * m->d - m->b * m->c;
+    if (fabsf(det) < 1e-12f)
+        return false;
+    *out = (PgMatrix) {
+        m->d / det, -m->b / det,
+        -m->c / det, m->a / det,
+        (m->c * m->f - m->d * m->e) / det,
+        (m->b * m->e - m->a * m->f) / det,
+    };
+    return true;
+}
+// Narrows [*x0, *x1) to the pixels whose centres map between lo and hi,
+// where pixel x maps to p + dp * x
+static void narrow(float p, float dp, float lo, float hi, int *x0, int *x1) {
+    if (dp == 0) {
+        if (p < lo || p >= hi)
+            *x1 = *x0;
+        return;
+    }
+    float a = (lo - p) / dp;
+    float b = (hi - p) / dp;
+    if (dp < 0) {
+        float t = a;
+        a = b;
+        b = t;
+    }
+    // Compared as floats first, since nearly level edges give huge bounds
+    if (a > *x0)
+        *x0 = a < *x1? (int)ceilf(a): *x1;
+    if (b < *x1)
+        *x1 = b > *x0? (int)ceilf(b): *x0;
+}
+
+// Draws the from rectangle of a bitmap canvas with its corner at the matrix's
+// origin. The canvas's CTM applies after the matrix.
+void _pgDrawImage(const Pg *g, const Pg *image, PgRect from, const PgMatrix *matrix, float opacity, PgFilter filter) {
+    PgMatrix m = matrix? *matrix: PgIdentityMatrix;
+    pgMultiplyMatrix(&m, &g->ctm);
+    Image im = {
+        ((PgBitmapCanvas*)image)->data,
+        ((PgBitmapCanvas*)image)->stride,
+        MAX(0, floorf(from.a.x)),
+        MAX(0, floorf(from.a.y)),
+        MIN(image->width, ceilf(from.b.x)),
+        MIN(image->height, ceilf(from.b.y)),
+        filter,
+    };
+    int alpha = clamp(0, opacity * 256 + .5f, 256);
+    PgMatrix inv;
+    if (im.x0 >= im.x1 || im.y0 >= im.y1 || !alpha || !invert(&inv, &m))
+        return;
+    inv.e += from.a.x;
+    inv.f += from.a.y;
+    im.fu = fabsf(inv.a) + fabsf(inv.c);
+    im.fv = fabsf(inv.b) + fabsf(inv.d);
+    STATS_ADD(g, images, 1);
+    double start = STATS_NOW(g);
+
+    // Rows the image covers
+    float w = from.b.x - from.a.x;
+    float h = from.b.y - from.a.y;
+    PgPt p[] = {
+        pgTransformPoint(&m, pgPt(0, 0)),
+        pgTransformPoint(&m, pgPt(w, 0)),
+        pgTransformPoint(&m, pgPt(w, h)),
+        pgTransformPoint(&m, pgPt(0, h)),
+    };
+    float top = p[0].y, bottom = p[0].y;
+    for (int i = 1; i < 4; i++) {
+        top = MIN(top, p[i].y);
+        bottom = MAX(bottom, p[i].y);
+    }
+    int y0 = clamp(0, floorf(top), g->height);
+    int y1 = clamp(0, ceilf(bottom), g->height);
+    uint32_t *data = ((PgBitmapCanvas*)g)->data;
+    int stride = ((PgBitmapCanvas*)g)->stride;
+    int64_t pixels = 0;
+
+    // Whole-pixel moves read texels straight from the image's rows
+    bool moved = m.a == 1 && m.b == 0 && m.c == 0 && m.d == 1 &&
+        inv.e == floorf(inv.e) && inv.f == floorf(inv.f);
+    // Axis-aligned scales only work out each column's taps once
+    bool scaled = !moved && m.b == 0 && m.c == 0;
+    Taps *columns = NULL;
+    uint32_t *row = NEW_ARRAY(uint32_t, g->width);
+    for (int y = y0; y < y1; y++) {
+        float cy = y + .5f;
+        float u = inv.a * .5f + inv.c * cy + inv.e;
+        float v = inv.b * .5f + inv.d * cy + inv.f;
+        int x0 = 0, x1 = g->width;
+        narrow(u, inv.a, im.x0, im.x1, &x0, &x1);
+        narrow(v, inv.b, im.y0, im.y1, &x0, &x1);
+        if (x0 >= x1)
+            continue;
+        uint32_t *screen = data + y * stride;
+        pixels += x1 - x0;
+
+        if (moved) {
+            const uint32_t *src = im.data + (int)floorf(v) * im.stride + (int)floorf(u) + x0;
+            blendRow(screen + x0, src, x1 - x0, alpha);
+            continue;
+        }
+        if (scaled) {
+            // Every row of an axis-aligned image spans the same columns
+            if (!columns) {
+                columns = NEW_ARRAY(Taps, g->width);
+                for (int x = x0; x < x1; x++)
+                    columns[x] = taps(filter, u + inv.a * x, im.fu, im.x0, im.x1);
+            }
+            Taps ty = taps(filter, v, im.fv, im.y0, im.y1);
+            for (int x = x0; x < x1; x++)
+                row[x] = sample(&im, columns[x], ty);
+        } else
+            for (int x = x0; x < x1; x++)
+                row[x] = sample(&im,
+                    taps(filter, u + inv.a * x, im.fu, im.x0, im.x1),
+                    taps(filter, v + inv.b * x, im.fv, im.y0, im.y1));
+        blendRow(screen + x0, row + x0, x1 - x0, alpha);
+    }
+    free(row);
+    free(columns);
+    STATS_ADD(g, pixels, pixels);
+    STATS_ADD(g, blend, STATS_NOW(g) - start);
+    STATS_TRACE(g, "drawImage", start, "pixels", pixels);
+}
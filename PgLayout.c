@@ -0,0 +1,359 @@
+// Paragraph layout: word wrapping and justification with cached word widths
+#define _USE_MATH_DEFINES
+#include <assert.h>
+#include <ctype.h>
+#include <float.h>
+#include <emmintrin.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include <pg/pg.h>
+#include <pg/platform.h>
+#include "common.h"
+
+typedef struct {
+    uint32_t        hash;
+    int             offset;     // Into the cache's text; -1 if the slot is empty
+    int             len;
+    float           width;
+} CachedWord;
+
+// Widths of words already measured with the layout's font at its current size and features
+struct PgWordCache {
+    CachedWord      *slots;
+    int             nslots;     // Power of two
+    int             n;
+    char            *text;
+    int             ntext;
+    int             captext;
+};
+
+static bool isSpace(int c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+static uint32_t hashWord(const char *word, int len) {
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < len; i++)
+        hash = (hash ^ (uint8_t)word[i]) * 16777619u;
+    return hash;
+}
+
+static void clearCache(PgWordCache *cache) {
+    for (int i = 0; i < cache->nslots; i++)
+        cache->slots[i].offset = -1;
+    cache->n = 0;
+    cache->ntext = 0;
+}
+static void growCache(PgWordCache *cache) {
+    CachedWord *old = cache->slots;
+    int nold = cache->nslots;
+    cache->nslots = nold? nold * 2: 256;
+    cache->slots = NEW_ARRAY(CachedWord, cache->nslots);
+    for (int i = 0; i < cache->nslots; i++)
+        cache->slots[i].offset = -1;
+    for (int i = 0; i < nold; i++)
+        if (old[i].offset >= 0) {
+            int s = old[i].hash & (cache->nslots - 1);
+            while (cache->slots[s].offset >= 0)
+                s = (s + 1) & (cache->nslots - 1);
+            cache->slots[s] = old[i];
+        }
+    free(old);
+}
+static bool findWord(const PgWordCache *cache, const char *word, int len, uint32_t hash, int *slotp) {
+    int s = hash & (cache->nslots - 1);
+    for ( ; cache->slots[s].offset >= 0; s = (s + 1) & (cache->nslots - 1)) {
+        const CachedWord *slot = &cache->slots[s];
+        if (slot->hash == hash && slot->len == len && !memcmp(cache->text + slot->offset, word, len))
+            break;
+    }
+    *slotp = s;
+    return cache->slots[s].offset >= 0;
+}
+static void cacheWord(PgWordCache *cache, const char *word, int len, float width) {
+    uint32_t hash = hashWord(word, len);
+    int s;
+    if (findWord(cache, word, len, hash, &s))
+        return;
+    if (cache->ntext + len > cache->captext) {
+        cache->captext = MAX(cache->captext * 2, cache->ntext + len + 4096);
+        REALLOC(cache->text, char, cache->captext);
+    }
+    memcpy(cache->text + cache->ntext, word, len);
+    cache->slots[s] = (CachedWord){ hash, cache->ntext, len, width };
+    cache->ntext += len;
+    if (++cache->n * 2 > cache->nslots)
+        growCache(cache);
+}
+static float measureWord(PgLayout *layout, const char *word, int len) {
+    int s;
+    if (findWord(layout->cache, word, len, hashWord(word, len), &s))
+        return layout->cache->slots[s].width;
+    float width = $(getUtf8Width, layout->font, word, len);
+    cacheWord(layout->cache, word, len, width);
+    return width;
+}
+
+static void freeParagraph(PgParagraph *para) {
+    free(para->text);
+    free(para->words);
+    free(para->lines);
+}
+static void segmentParagraph(PgLayout *layout, PgParagraph *para) {
+    PgWordCache *cache = layout->cache;
+    int nmissing = 0;
+    para->nwords = 0;
+    for (int i = 0; i < para->len; ) {
+        while (i < para->len && isSpace(para->text[i])) i++;
+        if (i == para->len) break;
+        int start = i;
+        while (i < para->len && !isSpace(para->text[i])) i++;
+
+        if (para->nwords + 1 > para->capwords) {
+            para->capwords = para->capwords? para->capwords * 2: 16;
+            REALLOC(para->words, PgLayoutWord, para->capwords);
+        }
+        int s;
+        bool found = findWord(cache, para->text + start, i - start, hashWord(para->text + start, i - start), &s);
+        para->words[para->nwords++] = (PgLayoutWord) {
+            .start = start,
+            .len = i - start,
+            .width = found? cache->slots[s].width: -1,
+        };
+        nmissing += !found;
+    }
+    
+    // Measure the words not seen before in one call to the font
+    if (nmissing) {
+        const char **strings = NEW_ARRAY(const char*, nmissing);
+        int *lens = NEW_ARRAY(int, nmissing);
+        float *widths = NEW_ARRAY(float, nmissing);
+        int n = 0;
+        for (int w = 0; w < para->nwords; w++)
+            if (para->words[w].width < 0) {
+                strings[n] = para->text + para->words[w].start;
+                lens[n++] = para->words[w].len;
+            }
+        $(getUtf8Widths, layout->font, n, strings, lens, widths);
+        for (int w = 0, i = 0; w < para->nwords; w++)
+            if (para->words[w].width < 0) {
+                para->words[w].width = widths[i];
+                cacheWord(cache, strings[i], lens[i], widths[i]);
+                i++;
+            }
+        free(strings);
+        free(lens);
+        free(widths);
+    }
+    para->measured = true;
+    para->measure = -1;
+}
+
+// Fill each line greedily then spread the words over the measure
+static void breakParagraph(PgLayout *layout, PgParagraph *para) {
+    float measure = layout->measure;
+    float space = layout->space;
+    para->nlines = 0;
+
+    for (int w = 0; w < para->nwords || !para->nlines; ) {
+        int first = w;
+        float width = w < para->nwords? para->words[w++].width: 0;
+        while (w < para->nwords && width + space + para->words[w].width <= measure)
+            width += space + para->words[w++].width;
+
+        if (para->nlines + 1 > para->caplines) {
+            para->caplines = para->caplines? para->caplines * 2: 4;
+            REALLOC(para->lines, PgLayoutLine, para->caplines);
+        }
+        para->lines[para->nlines++] = (PgLayoutLine){ first, w - first, width };
+
+        // The last line of a paragraph keeps natural spacing, as do very loose lines
+        int gaps = w - first - 1;
+        float justified = gaps > 0? space + (measure - width) / gaps: space;
+        float gap = layout->justify && w < para->nwords && justified <= space * 3? justified: space;
+        float x = 0;
+        for (int i = first; i < w; i++) {
+            para->words[i].x = x;
+            x += para->words[i].width + gap;
+        }
+        if (!para->nwords)
+            break;
+    }
+    para->measure = measure;
+}
+
+static void splitParagraphs(PgLayout *layout, int at, const char *text, int len) {
+    int count = 1;
+    for (int i = 0; i < len; i++)
+        if (text[i] == '\n')
+            count++;
+
+    int n = layout->nparagraphs + count;
+    if (n > layout->capparagraphs) {
+        layout->capparagraphs = MAX(layout->capparagraphs * 2, n);
+        REALLOC(layout->paragraphs, PgParagraph, layout->capparagraphs);
+    }
+    memmove(layout->paragraphs + at + count, layout->paragraphs + at,
+        (layout->nparagraphs - at) * sizeof *layout->paragraphs);
+    layout->nparagraphs = n;
+
+    for (int p = at, i = 0; p < at + count; p++) {
+        int end = i;
+        while (end < len && text[end] != '\n') end++;
+        PgParagraph *para = &layout->paragraphs[p];
+        *para = (PgParagraph){ 0 };
+        para->len = end - i;
+        para->text = NEW_ARRAY(char, para->len + 1);
+        memcpy(para->text, text + i, para->len);
+        para->text[para->len] = 0;
+        i = end + 1;
+    }
+}
+
+static void _free(PgLayout *layout) {
+    if (layout) {
+        for (int i = 0; i < layout->nparagraphs; i++)
+            freeParagraph(&layout->paragraphs[i]);
+        free(layout->paragraphs);
+        free(layout->cache->slots);
+        free(layout->cache->text);
+        free(layout->cache);
+        free(layout);
+    }
+}
+static void _setFont(PgLayout *layout, const PgFont *font) {
+    layout->font = font;
+    layout->generation = 0; // Measure everything again on the next update
+}
+static void _setMeasure(PgLayout *layout, float measure) {
+    layout->measure = measure;
+}
+static void _setText(PgLayout *layout, const char *text, int len) {
+    if (len < 0) len = strlen(text);
+    for (int i = 0; i < layout->nparagraphs; i++)
+        freeParagraph(&layout->paragraphs[i]);
+    layout->nparagraphs = 0;
+    splitParagraphs(layout, 0, text, len);
+}
+// Replaces bytes start to end; only the paragraphs touched are laid out again
+static void _editText(PgLayout *layout, int start, int end, const char *text, int len) {
+    if (len < 0) len = strlen(text);
+    
+    // Each paragraph is followed by the newline that ends it
+    int first = 0, last, offset = 0;
+    while (first < layout->nparagraphs - 1 && start > offset + layout->paragraphs[first].len)
+        offset += layout->paragraphs[first++].len + 1;
+    start = clamp(0, start - offset, layout->paragraphs[first].len);
+    end -= offset;
+    for (last = first; last < layout->nparagraphs - 1 && end > layout->paragraphs[last].len; )
+        end -= layout->paragraphs[last++].len + 1;
+    end = clamp(0, end, layout->paragraphs[last].len);
+    if (first == last && end < start)
+        end = start;
+    
+    // Join what is left of the first and last paragraphs around the new text
+    const PgParagraph *a = &layout->paragraphs[first];
+    const PgParagraph *b = &layout->paragraphs[last];
+    int joinlen = start + len + b->len - end;
+    char *joined = NEW_ARRAY(char, joinlen + 1);
+    memcpy(joined, a->text, start);
+    memcpy(joined + start, text, len);
+    memcpy(joined + start + len, b->text + end, b->len - end);
+    
+    for (int i = first; i <= last; i++)
+        freeParagraph(&layout->paragraphs[i]);
+    memmove(layout->paragraphs + first, layout->paragraphs + last + 1,
+        (layout->nparagraphs - last - 1) * sizeof *layout->paragraphs);
+    layout->nparagraphs -= last - first + 1;
+    splitParagraphs(layout, first, joined, joinlen);
+    free(joined);
+}
+static void _update(PgLayout *layout) {
+    if (!layout->font)
+        return;
+
+    // Widths depend on the size and features, which the font handle can change under us
+    if (layout->font->generation != layout->generation) {
+        layout->generation = layout->font->generation;
+        clearCache(layout->cache);
+        layout->space = measureWord(layout, " ", 1);
+        for (int i = 0; i < layout->nparagraphs; i++)
+            layout->paragraphs[i].measured = false;
+    }
+    float line_height = layout->line_height;
+    if (line_height <= 0)
+        line_height = $(getAscender, layout->font) - $(getDescender, layout->font) + $(getLeading, layout->font);
+
+    float y = 0;
+    for (int i = 0; i < layout->nparagraphs; i++) {
+        PgParagraph *para = &layout->paragraphs[i];
+        if (!para->measured)
+            segmentParagraph(layout, para);
+        if (para->measure != layout->measure)
+            breakParagraph(layout, para);
+        para->y = y;
+        y += para->nlines * line_height;
+    }
+    layout->height = y;
+    layout->line_spacing = line_height;
+}
+static float _fill(PgLayout *layout, Pg *g, PgPt at, uint32_t color) {
+    $(update, layout);
+    float line_height = layout->line_spacing;
+
+    // Skip to the first paragraph still on the canvas
+    int lo = 0, hi = layout->nparagraphs;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        const PgParagraph *para = &layout->paragraphs[mid];
+        if (at.y + para->y + para->nlines * line_height < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    for (int p = lo; p < layout->nparagraphs; p++) {
+        const PgParagraph *para = &layout->paragraphs[p];
+        if (at.y + para->y >= g->height)
+            break;
+        for (int l = 0; l < para->nlines; l++) {
+            float y = at.y + para->y + l * line_height;
+            if (y + line_height < 0) continue;
+            if (y >= g->height) break;
+            const PgLayoutLine *line = &para->lines[l];
+            for (int w = line->word; w < line->word + line->nwords; w++) {
+                const PgLayoutWord *word = &para->words[w];
+                $(fillUtf8, g, layout->font, pgPt(at.x + word->x, y),
+                    (const uint8_t*)para->text + word->start, word->len, color);
+            }
+        }
+    }
+    return layout->height;
+}
+
+PgLayout pgDefaultLayout() {
+    return (PgLayout) {
+        .justify = true,
+        .free = _free,
+        .setFont = _setFont,
+        .setMeasure = _setMeasure,
+        .setText = _setText,
+        .editText = _editText,
+        .update = _update,
+        .fill = _fill,
+    };
+}
+PgLayout *pgNewLayout(const PgFont *font, float measure) {
+    PgLayout *layout = NEW(PgLayout);
+    *layout = pgDefaultLayout();
+    layout->font = font;
+    layout->measure = measure;
+    layout->cache = calloc(1, sizeof *layout->cache);
+    growCache(layout->cache);
+    splitParagraphs(layout, 0, "", 0);
+    return layout;
+}
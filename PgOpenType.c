@@ -15,6 +15,8 @@
 #include <pg/platform.h>
 #include "common.h"
 
+#define ADVANCE_CHARS 0x800 // Latin through Arabic
+
 static void unpack(const void **datap, const char *fmt, ...) {
     const uint8_t *data = *datap;
     va_list ap;
@@ -32,17 +34,28 @@ static void unpack(const void **datap, const char *fmt, ...) {
     *datap = data;
 }
 
+static volatile long generations;
+
+// Drops the advances when something changes widths, and gives the font a
+// generation no font has had. Callers don't race the calls that change a font.
+static void widthsChanged(PgOpenType *otf) {
+    free(otf->advances);
+    otf->advances = NULL;
+    otf->_.generation = FETCH_ADD(&generations, 1) + 1;
+}
 static void _scale(PgFont *font, float height, float width) {
     PgOpenType *otf = (PgOpenType*)font;
+    const PgOpenTypeFace *face = (PgOpenTypeFace*)font->face;
     if (width <= 0)
         width = height;
-    otf->scale_x = width / otf->em;
-    otf->scale_y = height / otf->em;
+    otf->scale_x = width / face->em;
+    otf->scale_y = height / face->em;
+    widthsChanged(otf);
 }
 static PgPath *_getCharPath(const PgFont *font, const PgMatrix *ctm, unsigned c) {
     return $(getGlyphPath, font, ctm, $(getGlyph, font, c));
 }
-static void glyphPath(PgPath *path, const PgOpenType *font, const PgMatrix *ctm, unsigned g) {
+static void glyphPath(PgPath *path, const PgOpenTypeFace *font, const PgMatrix *ctm, unsigned g) {
     if (g >= font->nglyphs)
         g = 0;
     const void          *data;
@@ -120,6 +133,9 @@ static void glyphPath(PgPath *path, const PgOpenType *font, const PgMatrix *ctm,
         }
         const uint8_t   *xs = f;
         const uint8_t   *ys = xs + xsize;
+        
+        // Each point ends at most one part of at most two points, besides the closes
+        $(reserve, path, npoints + ncontours + 1, (npoints + ncontours + 1) * 2);
         PgPt a = {0, 0};
         PgPt b;
         bool in_curve = false;
@@ -185,91 +201,195 @@ static void glyphPath(PgPath *path, const PgOpenType *font, const PgMatrix *ctm,
 }
 static PgPath *_getGlyphPath(const PgFont *font, const PgMatrix *ctm, unsigned g) {
     PgOpenType *otf = (PgOpenType*)font;
+    const PgOpenTypeFace *face = (PgOpenTypeFace*)font->face;
     PgPath *path = pgNewPath();
     PgMatrix new_ctm = {1,0,0, 1,0,0};
-    pgTranslateMatrix(&new_ctm, 0, -otf->ascender);
+    pgTranslateMatrix(&new_ctm, 0, -face->ascender);
     pgScaleMatrix(&new_ctm, otf->scale_x, -otf->scale_y);
     pgMultiplyMatrix(&new_ctm, ctm);
-    glyphPath(path, (PgOpenType*)font, &new_ctm, g);
+    if (face->cff)
+        _pgCffGlyphPath(path, face->cff, &new_ctm, g);
+    else if (face->glyf && face->loca)
+        glyphPath(path, face, &new_ctm, g);
+    STATS_ADD(font, glyph_paths, 1);
+    STATS_ADD(font, allocations, path->nparts? 4: 1); // The path and its three arrays
     return path;
 }
 static unsigned _getGlyph(const PgFont *font, unsigned c) {
     PgOpenType *otf = (PgOpenType*)font;
-    unsigned g = otf->cmap[c & 0xffff];
+    const PgOpenTypeFace *face = (PgOpenTypeFace*)font->face;
+    unsigned g = face->cmap[c & 0xffff];
+    STATS_ADD(font, cmap_lookups, 1);
+    STATS_ADD(font, substitutions, otf->nsubst? 1: 0);
     for (int i = 0; i < otf->nsubst; i++)
         if (g == otf->subst[i][0])
             g = otf->subst[i][1];
     return g;
 }
+static uint16_t *_shapeString(const PgFont *font, const wchar_t chars[], int len, int *countp) {
+    PgOpenType *otf = (PgOpenType*)font;
+    if (len < 0) len = wcslen(chars);
+    uint16_t *glyphs = NEW_ARRAY(uint16_t, MAX(len, 1));
+    STATS_ADD(font, allocations, 1);
+    for (int i = 0; i < len; i++)
+        glyphs[i] = $(getGlyph, font, chars[i]);
+    if (otf->shaper) {
+        STATS_ADD(font, substitutions, len);
+        glyphs = _pgShape(otf->shaper, glyphs, &len);
+    }
+    *countp = len;
+    return glyphs;
+}
+struct PgAdvances {
+    float   chars[ADVANCE_CHARS];   // Code points below U+0800
+    float   glyphs[];               // Each glyph
+};
+
+// Scales every advance once rather than on each measurement. Threads
+// measuring with one font at once keep whichever table is published first.
+static const PgAdvances *glyphAdvances(const PgFont *font) {
+    PgOpenType *otf = (PgOpenType*)font;
+    const PgOpenTypeFace *face = (PgOpenTypeFace*)font->face;
+    PgAdvances *advances = LOAD_ACQUIRE(&otf->advances);
+    if (advances)
+        return advances;
+    
+    advances = malloc(sizeof *advances + face->nglyphs * sizeof *advances->glyphs);
+    for (int g = 0; g < face->nglyphs; g++)
+        advances->glyphs[g] = face->nhmtx
+            ? be16(face->hmtx[MIN(g, face->nhmtx - 1) * 2]) * otf->scale_x
+            : 0;
+    for (unsigned c = 0; c < ADVANCE_CHARS; c++) {
+        unsigned g = $(getGlyph, font, c);
+        advances->chars[c] = g < face->nglyphs? advances->glyphs[g]: 0;
+    }
+    if (!CAS_POINTER(&otf->advances, NULL, advances)) {
+        free(advances);
+        advances = LOAD_ACQUIRE(&otf->advances);
+    }
+    return advances;
+}
+static float shapedUtf8Width(const PgFont *font, const char chars[], int len) {
+    uint16_t *utf16 = pgUtf8To16((const uint8_t*)chars, len, &len);
+    wchar_t *wchars = (wchar_t*)utf16;
+    if (sizeof *wchars != sizeof *utf16) { // widen where wchar_t is UCS-4
+        wchars = NEW_ARRAY(wchar_t, len + 1);
+        for (int i = 0; i <= len; i++)
+            wchars[i] = utf16[i];
+        free(utf16);
+    }
+    float width = $(getStringWidth, font, wchars, len);
+    free(wchars);
+    return width;
+}
+static void _getUtf8Widths(const PgFont *font, int n, const char *const strings[], const int lens[], float widths[]) {
+    PgOpenType *otf = (PgOpenType*)font;
+    const PgAdvances *advances = glyphAdvances(font);
+    for (int i = 0; i < n; i++) {
+        int len = lens && lens[i] >= 0? lens[i]: strlen(strings[i]);
+        if (otf->shaper) { // Lookups may join or split glyphs
+            widths[i] = shapedUtf8Width(font, strings[i], len);
+            continue;
+        }
+        
+        const uint8_t *p = (const uint8_t*)strings[i];
+        const uint8_t *end = p + len;
+        float width = 0;
+        while (p < end) {
+            unsigned c = _pgDecodeUtf8(&p, end);
+            width += c < ADVANCE_CHARS? advances->chars[c]: $(getGlyphWidth, font, $(getGlyph, font, c));
+        }
+        widths[i] = width;
+    }
+}
 static float _getUtf8Width(const PgFont *font, const char chars[], int len) {
-    float width = 0;
-    if (len < 0) len = strlen(chars);
-    for (int i = 0; i < len; i++) width += $(getCharWidth, font, chars[i]);
+    float width;
+    $(getUtf8Widths, font, 1, &chars, &len, &width);
     return width;
 }
 static float _getStringWidth(const PgFont *font, const wchar_t chars[], int len) {
+    PgOpenType *otf = (PgOpenType*)font;
     float width = 0;
-    if (len < 0) len = wcslen(chars);
-    for (int i = 0; i < len; i++) width += $(getCharWidth, font, chars[i]);
+    if (!otf->shaper) {
+        const PgAdvances *advances = glyphAdvances(font);
+        if (len < 0) len = wcslen(chars);
+        for (int i = 0; i < len; i++)
+            width += (unsigned)chars[i] < ADVANCE_CHARS
+                ? advances->chars[chars[i]]
+                : $(getCharWidth, font, chars[i]);
+        return width;
+    }
+    uint16_t *glyphs = $(shapeString, font, chars, len, &len);
+    for (int i = 0; i < len; i++) width += $(getGlyphWidth, font, glyphs[i]);
+    free(glyphs);
     return width;
 }
 static float _getAscender(const PgFont *font) {
     PgOpenType *otf = (PgOpenType*)font;
-    return otf->ascender * otf->scale_y;
+    const PgOpenTypeFace *face = (PgOpenTypeFace*)font->face;
+    return face->ascender * otf->scale_y;
 }
 static float _getDescender(const PgFont *font) {
     PgOpenType *otf = (PgOpenType*)font;
-    return otf->descender * otf->scale_y;
+    const PgOpenTypeFace *face = (PgOpenTypeFace*)font->face;
+    return face->descender * otf->scale_y;
 }
 static float _getLeading(const PgFont *font) {
     PgOpenType *otf = (PgOpenType*)font;
-    return otf->leading * otf->scale_y;
+    const PgOpenTypeFace *face = (PgOpenTypeFace*)font->face;
+    return face->leading * otf->scale_y;
 }
 static float _getXHeight(const PgFont *font) {
     PgOpenType *otf = (PgOpenType*)font;
-    return otf->x_height * otf->scale_y;
+    const PgOpenTypeFace *face = (PgOpenTypeFace*)font->face;
+    return face->x_height * otf->scale_y;
 }
 static float _getCapHeight(const PgFont *font) {
     PgOpenType *otf = (PgOpenType*)font;
-    return otf->cap_height * otf->scale_y;
+    const PgOpenTypeFace *face = (PgOpenTypeFace*)font->face;
+    return face->cap_height * otf->scale_y;
 }
 static float _getEm(const PgFont *font) {
     PgOpenType *otf = (PgOpenType*)font;
-    return otf->em * otf->scale_y;
+    const PgOpenTypeFace *face = (PgOpenTypeFace*)font->face;
+    return face->em * otf->scale_y;
 }
 static float _getGlyphLsb(const PgFont *font, unsigned g) {
     PgOpenType *otf = (PgOpenType*)font;
-    return  g < otf->nhmtx?    be16(otf->hmtx[g * 2 + 1]) * otf->scale_x:
-            g < otf->nglyphs?  be16(otf->hmtx[(otf->nhmtx - 1) * 2 + 1]) * otf->scale_x:
+    const PgOpenTypeFace *face = (PgOpenTypeFace*)font->face;
+    return  g < face->nhmtx?    be16(face->hmtx[g * 2 + 1]) * otf->scale_x:
+            g < face->nglyphs?  be16(face->hmtx[(face->nhmtx - 1) * 2 + 1]) * otf->scale_x:
             0;
 }
 static float _getGlyphWidth(const PgFont *font, unsigned g) {
-    PgOpenType *otf = (PgOpenType*)font;
-    return  g < otf->nhmtx?    be16(otf->hmtx[g * 2]) * otf->scale_x:
-            g < otf->nglyphs?  be16(otf->hmtx[(otf->nhmtx - 1) * 2]) * otf->scale_x:
-            0;
+    const PgOpenTypeFace *face = (PgOpenTypeFace*)font->face;
+    return g < face->nglyphs? glyphAdvances(font)->glyphs[g]: 0;
 }
 static float _getCharLsb(const PgFont *font, unsigned c) {
     return $(getGlyphLsb, font, $(getGlyph, font, c));
 }
 static float _getCharWidth(const PgFont *font, unsigned c) {
+    if (c < ADVANCE_CHARS)
+        return glyphAdvances(font)->chars[c];
     return $(getGlyphWidth, font, $(getGlyph, font, c));
 }
 static PgRect _getSubscriptBox(const PgFont *font) {
     PgOpenType *otf = (PgOpenType*)font;
+    const PgOpenTypeFace *face = (PgOpenTypeFace*)font->face;
     return (PgRect) {
-        pgPt(otf->superscript_box.a.x * otf->scale_x,
-            otf->superscript_box.a.y * otf->scale_y),
-        pgPt(otf->superscript_box.b.x * otf->scale_x,
-            otf->superscript_box.b.y * otf->scale_y) };
+        pgPt(face->superscript_box.a.x * otf->scale_x,
+            face->superscript_box.a.y * otf->scale_y),
+        pgPt(face->superscript_box.b.x * otf->scale_x,
+            face->superscript_box.b.y * otf->scale_y) };
 }
 static PgRect _getSuperscriptBox(const PgFont *font) {
     PgOpenType *otf = (PgOpenType*)font;
+    const PgOpenTypeFace *face = (PgOpenTypeFace*)font->face;
     return (PgRect) {
-        pgPt(otf->subscript_box.a.x * otf->scale_x,
-            otf->subscript_box.a.y * otf->scale_y),
-        pgPt(otf->subscript_box.b.x * otf->scale_x,
-            otf->subscript_box.b.y * otf->scale_y) };
+        pgPt(face->subscript_box.a.x * otf->scale_x,
+            face->subscript_box.a.y * otf->scale_y),
+        pgPt(face->subscript_box.b.x * otf->scale_x,
+            face->subscript_box.b.y * otf->scale_y) };
 }
 static char *lookupFeatures(
     PgOpenType *font,
@@ -277,7 +397,7 @@ static char *lookupFeatures(
     uint32_t script,
     uint32_t lang,
     const char *feature_tags,
-    void subtable_handler(PgOpenType *font, uint32_t tag, const uint8_t *subtable, int lookup_type))
+    void subtable_handler(PgOpenType *font, uint32_t tag, int lookup, const uint8_t *subtable, int lookup_type))
 {
     if (!table)
         return NULL;
@@ -307,9 +427,10 @@ static char *lookupFeatures(
             uint32_t tag;
             uint16_t offset;
             unpack(&header, "LS", &tag, &offset);
-            if (tag == 'DFLT')
+            // Fall back on the default script when the font lacks this one
+            if (tag == 'DFLT' && !script_table)
                 script_table = script_list + offset;
-            else if (tag == script && !script_table) {
+            else if (tag == script) {
                 script_table = script_list + offset;
                 break;
             }
@@ -389,7 +510,7 @@ static char *lookupFeatures(
                             unpack(&lookup, "S", &subtable_offset);
                             const uint8_t *subtable = lookup_base + subtable_offset;
                             if (subtable_handler != NULL)
-                                subtable_handler(font, tag, subtable, lookup_type);
+                                subtable_handler(font, tag, index, subtable, lookup_type);
                         }
                     }
                     break;
@@ -398,7 +519,7 @@ static char *lookupFeatures(
     }
     return all_features;
 }
-static void gsub_handler(PgOpenType *font, uint32_t tag, const uint8_t *subtable_base, int lookup_type) {
+static void gsub_handler(PgOpenType *font, uint32_t tag, int lookup, const uint8_t *subtable_base, int lookup_type) {
     const uint8_t *subtable = subtable_base;
     uint16_t subst_format, coverage_offset;
 
@@ -414,7 +535,11 @@ redo_subtable:
         unpack(&subtable, "sSL", &lookup_type, &offset);
         subtable = subtable_base += offset;
         goto redo_subtable;
-    } else if (lookup_type != 5 && lookup_type != 6 && lookup_type != 8)
+    } else if (lookup_type != 1) {
+        // Lookups that change the glyph sequence run when shaping
+        _pgShaperUseLookup(font->shaper, lookup);
+        return;
+    } else
         unpack(&coverage, "SS", &coverage_format, &count);
     
     if (lookup_type == 1) { // Single Substitution
@@ -466,76 +591,177 @@ redo_subtable:
         }
     }
 }
+static void freeFeatureSet(PgFeatureSet *set) {
+    free(set->features);
+    free(set->available);
+    free(set->subst);
+    _pgFreeShaper(set->shaper);
+    free(set);
+}
+static PgFeatureSet *findFeatureSet(PgOpenTypeFace *face, uint32_t script, uint32_t lang, const char *features) {
+    PgFeatureSet *set;
+    for (set = face->feature_sets; set; set = set->next)
+        if (set->script == script && set->lang == lang
+            && (set->features && features? !strcmp(set->features, features): set->features == features))
+            break;
+    return set;
+}
+// Features are compiled once per face and script; NULL features lists them instead
+static const PgFeatureSet *featureSet(PgOpenTypeFace *face, uint32_t script, uint32_t lang, const char *features) {
+    _pgLock(&face->feature_lock);
+    PgFeatureSet *set = findFeatureSet(face, script, lang, features);
+    _pgUnlock(&face->feature_lock);
+    if (set)
+        return set;
+    
+    // Compile through a handle of our own, then keep whatever it collected
+    PgOpenType scratch = pgDefaultOpenType();
+    scratch._.face = &face->_;
+    scratch.script = script;
+    scratch.lang = lang;
+    set = NEW(PgFeatureSet);
+    *set = (PgFeatureSet) { script, lang, features? strdup(features): NULL };
+    if (!features)
+        set->available = lookupFeatures(&scratch, face->gsub, script, lang, "", NULL);
+    else if (face->gsub) {
+        scratch.shaper = _pgNewShaper(face->gsub, face->nglyphs);
+        lookupFeatures(&scratch, face->gsub, script, lang, features, gsub_handler);
+        set->subst = scratch.subst;
+        set->nsubst = scratch.nsubst;
+        set->shaper = scratch.shaper;
+    }
+    
+    // Another thread may have compiled the same set meanwhile
+    _pgLock(&face->feature_lock);
+    PgFeatureSet *existing = findFeatureSet(face, script, lang, features);
+    if (!existing) {
+        set->next = face->feature_sets;
+        face->feature_sets = set;
+    }
+    _pgUnlock(&face->feature_lock);
+    if (existing) {
+        freeFeatureSet(set);
+        set = existing;
+    }
+    return set;
+}
+static bool sharesSubst(const PgOpenType *otf) {
+    return otf->subst && otf->feature_set && otf->subst == otf->feature_set->subst;
+}
 static void _useFeatures(PgFont *font, const uint8_t *features) {
     PgOpenType *otf = (PgOpenType*)font;
+    PgOpenTypeFace *face = (PgOpenTypeFace*)font->face;
+    if (!sharesSubst(otf))
+        free(otf->subst);
     free(otf->features);
-    free(otf->subst);
-    otf->nsubst = 0;
-    otf->subst = NULL;
     otf->features = (void*)strdup(features);
-    if (*features)
-        lookupFeatures(otf, otf->gsub, otf->script, otf->lang, features, gsub_handler);
+    otf->feature_set = *features? featureSet(face, otf->script, otf->lang, features): NULL;
+    otf->subst = otf->feature_set? otf->feature_set->subst: NULL;
+    otf->nsubst = otf->feature_set? otf->feature_set->nsubst: 0;
+    otf->shaper = otf->feature_set? otf->feature_set->shaper: NULL;
+    widthsChanged(otf);
 }
 static char *_getFeatures(const PgFont *font) {
     PgOpenType *otf = (PgOpenType*)font;
-    return lookupFeatures(otf, otf->gsub, otf->script, otf->lang, "", NULL);
+    PgOpenTypeFace *face = (PgOpenTypeFace*)font->face;
+    const PgFeatureSet *set = featureSet(face, otf->script, otf->lang, NULL);
+    return set->available? strdup(set->available): NULL;
 }
 static void _substituteGlyph(PgFont *font, uint16_t in, uint16_t out) {
     PgOpenType *otf = (PgOpenType*)font;
+    if (sharesSubst(otf)) { // Copy the face's substitutions before changing them
+        uint16_t (*subst)[2] = NEW_ARRAY(uint16_t[2], otf->nsubst + 1);
+        memcpy(subst, otf->subst, otf->nsubst * sizeof *subst);
+        otf->subst = subst;
+    }
     otf->subst = realloc(otf->subst, (otf->nsubst + 1) * 2 * sizeof *otf->subst);
+    widthsChanged(otf);
     otf->subst[otf->nsubst][0] = in;
     otf->subst[otf->nsubst][1] = out;
     otf->nsubst++;
 }
 static const wchar_t *_getFamily(const PgFont *font) {
-    PgOpenType *otf = (PgOpenType*)font;
-    return otf->family;
+    const PgOpenTypeFace *face = (PgOpenTypeFace*)font->face;
+    return face->family;
 }
 static const wchar_t *_getName(const PgFont *font) {
-    PgOpenType *otf = (PgOpenType*)font;
-    return otf->name;
+    const PgOpenTypeFace *face = (PgOpenTypeFace*)font->face;
+    return face->name;
 }
 static const wchar_t *_getStyleName(const PgFont *font) {
-    PgOpenType *otf = (PgOpenType*)font;
-    return otf->styleName;
+    const PgOpenTypeFace *face = (PgOpenTypeFace*)font->face;
+    return face->styleName;
 }
 static PgFontWeight _getWeight(const PgFont *font) {
-    PgOpenType *otf = (PgOpenType*)font;
-    return otf->weight;
+    const PgOpenTypeFace *face = (PgOpenTypeFace*)font->face;
+    return face->weight;
 }
 static bool _isMonospaced(const PgFont *font) {
-    PgOpenType *otf = (PgOpenType*)font;
-    return otf->panose[3] == 9; // PANOSE porportion = 9 (monospaced)
+    const PgOpenTypeFace *face = (PgOpenTypeFace*)font->face;
+    return face->panose[3] == 9; // PANOSE porportion = 9 (monospaced)
 }
 static bool _isItalic(const PgFont *font) {
-    PgOpenType *otf = (PgOpenType*)font;
-    return otf->is_italic;
+    const PgOpenTypeFace *face = (PgOpenTypeFace*)font->face;
+    return face->is_italic;
 }
 static int _getCount(PgFont *font) {
-    PgOpenType *otf = (PgOpenType*)font;
-    return otf->nfonts;
+    const PgOpenTypeFace *face = (PgOpenTypeFace*)font->face;
+    return face->nfonts;
+}
+static PgFont *_sized(const PgFont *font, float height, float width) {
+    PgOpenType *otf = NEW(PgOpenType);
+    *otf = *(PgOpenType*)font;
+    pgRetainFace(font->face);
+    
+    // Copy changed substitutions so each size can change features alone
+    if (otf->features)
+        otf->features = (void*)strdup((char*)otf->features);
+    if (otf->subst && !sharesSubst(otf)) {
+        otf->subst = NEW_ARRAY(uint16_t[2], otf->nsubst);
+        memcpy(otf->subst, ((PgOpenType*)font)->subst, otf->nsubst * sizeof *otf->subst);
+    }
+    otf->advances = NULL;
+    otf->_.stats = NULL;
+    _scale(&otf->_, height, width);
+    return &otf->_;
 }
 static void _free(PgFont *font) {
     if (font) {
         PgOpenType *otf = (PgOpenType*)font;
-        _$(_freeHost, font);
-        free((void*)otf->family);
-        free((void*)otf->styleName);
-        free((void*)otf->name);
         free(otf->features);
-        free(otf->subst);
+        if (!sharesSubst(otf))
+            free(otf->subst);
+        free(otf->advances);
+        pgReleaseFace(font->face);
         free(font);
     }
 }
+static void _freeFace(PgFace *_face) {
+    PgOpenTypeFace *face = (PgOpenTypeFace*)_face;
+    free((void*)face->family);
+    free((void*)face->styleName);
+    free((void*)face->name);
+    _pgFreeCff(face->cff);
+    while (face->feature_sets) {
+        PgFeatureSet *next = face->feature_sets->next;
+        freeFeatureSet(face->feature_sets);
+        face->feature_sets = next;
+    }
+    free(face);
+}
 PgOpenType pgDefaultOpenType() {
     return (PgOpenType) {
         ._ = {
+            .stats = NULL,
             .free = _free,
             .scale = _scale,
+            .sized = _sized,
             .getCharPath = _getCharPath,
             .getGlyphPath = _getGlyphPath,
             .getGlyph = _getGlyph,
+            .shapeString = _shapeString,
             .getUtf8Width = _getUtf8Width,
+            .getUtf8Widths = _getUtf8Widths,
             .getStringWidth = _getStringWidth,
             .getAscender = _getAscender,
             .getDescender = _getDescender,
@@ -559,6 +785,26 @@ PgOpenType pgDefaultOpenType() {
             .isMonospaced = _isMonospaced,
             .isItalic = _isItalic,
             .getCount = _getCount,
+        },
+        .scale_x = 1,
+        .scale_y = 1,
+        .lang = 'eng ',
+        .script = 'latn',
+    };
+}
+static PgFont *_newFont(PgFace *face) {
+    PgOpenType *font = NEW(PgOpenType);
+    *font = pgDefaultOpenType();
+    font->_.face = face;
+    widthsChanged(font);
+    return &font->_;
+}
+PgOpenTypeFace pgDefaultOpenTypeFace() {
+    return (PgOpenTypeFace) {
+        ._ = {
+            .refs = 1,
+            .free = _freeFace,
+            .newFont = _newFont,
         }
     };
 }
@@ -575,6 +821,8 @@ PgOpenType *pgLoadOpenType(const void *file, int font_index, bool scan_only) {
     const void *os2  = NULL;
     const void *name  = NULL;
     const void *gsub  = NULL;
+    const void *cff   = NULL;
+    const void *cff2  = NULL;
     
     // Check that this is an OpenType
     {
@@ -584,7 +832,7 @@ PgOpenType *pgLoadOpenType(const void *file, int font_index, bool scan_only) {
 collection_item:
         unpack(&header, "LSsss", &ver, &ntab);
         
-        if (ver == 0x00010000) ;
+        if (ver == 0x00010000 || ver == 'OTTO') ;
         else if (ver == 'ttcf') { // TrueType Collection
             header = file;
             unpack(&header, "lLL", &ver, &nfonts);
@@ -613,32 +861,32 @@ collection_item:
             case 'name': name  = address; break;
             case 'OS/2': os2  = address; break;
             case 'GSUB': gsub = address; break;
+            case 'CFF ': cff = address; break;
+            case 'CFF2': cff2 = address; break;
             }
         }
     }
     
-    PgOpenType *font = NEW(PgOpenType);
-    *font = pgDefaultOpenType();
-    font->hmtx = hmtx;
-    font->glyf = glyf;
-    font->loca = loca;
-    font->gsub = gsub;
-    font->lang = 'eng ';
-    font->script = 'latn';
+    PgOpenTypeFace *face = NEW(PgOpenTypeFace);
+    *face = pgDefaultOpenTypeFace();
+    face->hmtx = hmtx;
+    face->glyf = glyf;
+    face->loca = loca;
+    face->gsub = gsub;
     
     // 'head' table
     {
         uint16_t em, long_loca;
         unpack(&head, "llllsSllllsssssssSs", &em, &long_loca);
-        font->em = em;
-        font->long_loca = long_loca;
+        face->em = em;
+        face->long_loca = long_loca;
     }
     
     // 'hhea' table
     {
         uint16_t nhmtx;
         unpack(&hhea, "lsssssssssssssssS", &nhmtx);
-        font->nhmtx = nhmtx;
+        face->nhmtx = nhmtx;
     }
     
     // 'os/2' table
@@ -653,32 +901,36 @@ collection_item:
             &stretch,
             &subsx, &subsy, &subx, &suby,
             &supsx, &supsy, &supx, &supy,
-            &font->panose[0],&font->panose[1],&font->panose[2],&font->panose[3],&font->panose[4],
-            &font->panose[5],&font->panose[6],&font->panose[7],&font->panose[8],&font->panose[9],
+            &face->panose[0],&face->panose[1],&face->panose[2],&face->panose[3],&face->panose[4],
+            &face->panose[5],&face->panose[6],&face->panose[7],&face->panose[8],&face->panose[9],
             &style,
             &ascender, &descender, &leading,
             &x_height, &cap_height);
-        font->ascender = ascender;
-        font->descender = descender;
-        font->leading = leading
+        face->ascender = ascender;
+        face->descender = descender;
+        face->leading = leading
             ? leading
-            : (font->em - (font->ascender - font->descender)) + font->em * .1f;
-        font->x_height = x_height;
-        font->cap_height = cap_height;
-        font->subscript_box = pgRect(pgPt(subx,suby), pgPt(subx+subsx, suby+subsy));
-        font->superscript_box = pgRect(pgPt(supx,supy), pgPt(supx+supsx, supy+supsy));
-        font->weight = weight;
-        font->stretch = stretch;
-        font->is_italic = style & 0x101; // includes italics and oblique
+            : (face->em - (face->ascender - face->descender)) + face->em * .1f;
+        face->x_height = x_height;
+        face->cap_height = cap_height;
+        face->subscript_box = pgRect(pgPt(subx,suby), pgPt(subx+subsx, suby+subsy));
+        face->superscript_box = pgRect(pgPt(supx,supy), pgPt(supx+supsx, supy+supsy));
+        face->weight = weight;
+        face->stretch = stretch;
+        face->is_italic = style & 0x101; // includes italics and oblique
     }
         
     // 'maxp' table
     {
         uint16_t nglyphs;
         unpack(&maxp, "lSsssssssssssss", &nglyphs);
-        font->nglyphs = nglyphs;
+        face->nglyphs = nglyphs;
     }
     
+    // PostScript outlines
+    if (!scan_only && !glyf && (cff || cff2))
+        face->cff = _pgLoadCff(cff2? cff2: cff, !!cff2, face->nglyphs);
+    
     // 'name' table
     {
         uint16_t nnames, name_string_offset;
@@ -693,20 +945,20 @@ collection_item:
             if (platform == 0 || (platform == 3 && (encoding == 0 || encoding == 1) && lang == 0x0409)) {
                 if (id == 1 || id == 2 || id == 4 || id == 16) {
                     const uint16_t *source = (uint16_t*)(name_strings + off);
-                    uint16_t *output = malloc((len/2 + 1) * sizeof *output);
+                    wchar_t *output = malloc((len/2 + 1) * sizeof *output);
                     len /= 2; // length was in bytes
                     for (int i = 0; i < len; i++)
                         output[i] = be16(source[i]);
                     output[len] = 0;
                     if (id == 1)
-                        font->family = output;
+                        face->family = output;
                     else if (id == 2)
-                        font->styleName = output;
+                        face->styleName = output;
                     else if (id == 4)
-                        font->name = output;
+                        face->name = output;
                     else if (id == 16) { // Preferred font family
-                        free((void*)font->family);
-                        font->family = output;
+                        free((void*)face->family);
+                        face->family = output;
                     }
                 }
             }
@@ -714,26 +966,26 @@ collection_item:
             else if (platform == 1 && encoding == 0)
                 if (id == 1 || id == 2 || id == 4 || id == 16) {
                     const uint8_t *source = name_strings + off;
-                    uint16_t *output = malloc((len + 1) * sizeof *output);
+                    wchar_t *output = malloc((len + 1) * sizeof *output);
                     for (int i = 0; i < len; i++)
                         output[i] = source[i];
                     output[len] = 0;
                     
                     if (id == 1)
-                        font->family = output;
+                        face->family = output;
                     else if (id == 2)
-                        font->styleName = output;
+                        face->styleName = output;
                     else if (id == 4)
-                        font->name = output;
+                        face->name = output;
                     else if (id == 16) { // Preferred font family
-                        free((void*)font->family);
-                        font->family = output;
+                        free((void*)face->family);
+                        face->family = output;
                     }
                 }
         }
-        if (!font->family) font->family = wcsdup(L"");
-        if (!font->styleName) font->styleName = wcsdup(L"");
-        if (!font->name) font->name = wcsdup(L"");
+        if (!face->family) face->family = wcsdup(L"");
+        if (!face->styleName) face->styleName = wcsdup(L"");
+        if (!face->name) face->name = wcsdup(L"");
     }
     
     // cmap table
@@ -758,7 +1010,7 @@ collection_item:
             case 0: {
                     unpack(&encoding_table, "sssssss");
                     for (int i = 0; i < 256; i++)
-                        font->cmap[i] = ((uint8_t*)encoding_table)[i];
+                        face->cmap[i] = ((uint8_t*)encoding_table)[i];
                     break;
                 }
             case 4: {
@@ -779,19 +1031,18 @@ collection_item:
                             for (int c = start; c <= end; c++) {
                                 int16_t index = offset/2 + (c - start) + i; // TODO: why must this be 16-bit maths (faults on monofur)
                                 int g = be16(offsetp[index]);
-                                font->cmap[c] = g? g + delta: 0;
+                                face->cmap[c] = g? g + delta: 0;
                             }
                         else
                             for (int c = start; c <= end; c++)
-                                font->cmap[c] = c + delta;
+                                face->cmap[c] = c + delta;
                     }
                 }
                 break;
             }
     }
     
-    font->_.file = file;
-    font->scale_x = font->scale_y = 1;
-    font->nfonts = nfonts;
-    return font;
+    face->_.file = file;
+    face->nfonts = nfonts;
+    return (PgOpenType*)$(newFont, &face->_);
 }
\ No newline at end of file
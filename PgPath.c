@@ -14,24 +14,39 @@
 #include <pg/platform.h>
 #include "common.h"
 
-static void addPart(PgPath *path, const PgMatrix *ctm, PgPathPartType type, ...) {
-    if (path->nparts + 1 >= path->cap) {
-        path->cap = path->cap? path->cap * 2: 16;
-        path->types = realloc(path->types, path->cap * sizeof *path->types);
-        path->points = realloc(path->points, path->cap * 4 * sizeof *path->points);
+static void reserve(PgPath *path, int nparts, int npoints) {
+    if (path->nparts + nparts > path->cap) {
+        path->cap = MAX(path->cap * 2, path->nparts + nparts);
+        path->cap = MAX(path->cap, 16);
+        REALLOC(path->types, PgPathPartType, path->cap);
     }
-    
-    va_list ap;
-    va_start(ap, type);
-    path->types[path->nparts] = type;
-    for (int i = 0; i < pgPathPartTypeArgs(type); i++)
-        path->points[path->npoints + i] = pgTransformPoint(ctm, *va_arg(ap, PgPt*));
-    va_end(ap);
-    path->nparts++;
-    path->npoints += pgPathPartTypeArgs(type);
+    if (path->npoints + npoints > path->cappoints) {
+        path->cappoints = MAX(path->cappoints * 2, path->npoints + npoints);
+        path->cappoints = MAX(path->cappoints, 32);
+        REALLOC(path->x, float, path->cappoints);
+        REALLOC(path->y, float, path->cappoints);
+    }
+}
+// Points are stored as given or under ctm, with x and y apart so loops over them vectorize
+static void transformPoints(PgPath *path, const PgMatrix *ctm, int n, const PgPt points[]) {
+    float * __restrict x = path->x + path->npoints;
+    float * __restrict y = path->y + path->npoints;
+    const PgMatrix m = ctm? *ctm: PgIdentityMatrix;
+    for (int i = 0; i < n; i++) {
+        x[i] = m.a * points[i].x + m.c * points[i].y + m.e;
+        y[i] = m.b * points[i].x + m.d * points[i].y + m.f;
+    }
+    path->npoints += n;
+}
+static void addPart(PgPath *path, const PgMatrix *ctm, PgPathPartType type, const PgPt points[]) {
+    int n = pgPathPartTypeArgs(type);
+    reserve(path, 1, n);
+    path->bounded = 0;
+    path->types[path->nparts++] = type;
+    transformPoints(path, ctm, n, points);
 }
 static void _move(PgPath *path, const PgMatrix *ctm, PgPt p) {
-    path->start = pgTransformPoint(ctm, p);
+    path->start = pgTransformPoint(ctm? ctm: &PgIdentityMatrix, p);
     addPart(path, ctm, PG_PATH_MOVE, &p);
 }
 static void _close(PgPath *path) {
@@ -41,26 +56,135 @@ static void _line(PgPath *path, const PgMatrix *ctm, PgPt b) {
     addPart(path, ctm, PG_PATH_LINE, &b);
 }
 static void _quadratic(PgPath *path, const PgMatrix *ctm, PgPt b, PgPt c) {
-    addPart(path, ctm, PG_PATH_QUADRATIC, &b, &c);
+    addPart(path, ctm, PG_PATH_QUADRATIC, (PgPt[]){ b, c });
 }
 static void _cubic(PgPath *path, const PgMatrix *ctm, PgPt b, PgPt c, PgPt d) {
-    addPart(path, ctm, PG_PATH_CUBIC, &b, &c, &d);
+    addPart(path, ctm, PG_PATH_CUBIC, (PgPt[]){ b, c, d });
+}
+static void _reserve(PgPath *path, int nparts, int npoints) {
+    reserve(path, nparts, npoints);
+}
+static void _append(PgPath *path, const PgMatrix *ctm, int nparts, const PgPathPartType types[], const PgPt points[]) {
+    int npoints = 0, last_move = -1;
+    for (int i = 0; i < nparts; i++) {
+        if (types[i] == PG_PATH_MOVE)
+            last_move = npoints;
+        npoints += pgPathPartTypeArgs(types[i]);
+    }
+    reserve(path, nparts, npoints);
+    path->bounded = 0;
+    memcpy(path->types + path->nparts, types, nparts * sizeof *types);
+    path->nparts += nparts;
+    if (last_move >= 0)
+        path->start = pgTransformPoint(ctm? ctm: &PgIdentityMatrix, points[last_move]);
+    transformPoints(path, ctm, npoints, points);
+}
+static void _lines(PgPath *path, const PgMatrix *ctm, int npoints, const PgPt points[]) {
+    if (npoints <= 0)
+        return;
+    reserve(path, npoints, npoints);
+    path->bounded = 0;
+    path->types[path->nparts] = PG_PATH_MOVE;
+    for (int i = 1; i < npoints; i++)
+        path->types[path->nparts + i] = PG_PATH_LINE;
+    path->nparts += npoints;
+    path->start = pgTransformPoint(ctm? ctm: &PgIdentityMatrix, points[0]);
+    transformPoints(path, ctm, npoints, points);
+}
+static void _appendPath(PgPath *path, const PgMatrix *ctm, const PgPath *src) {
+    const PgMatrix m = ctm? *ctm: PgIdentityMatrix;
+    reserve(path, src->nparts, src->npoints);
+    path->bounded = 0;
+    memcpy(path->types + path->nparts, src->types, src->nparts * sizeof *src->types);
+    path->nparts += src->nparts;
+    
+    float * __restrict x = path->x + path->npoints;
+    float * __restrict y = path->y + path->npoints;
+    const float * __restrict sx = src->x;
+    const float * __restrict sy = src->y;
+    for (int i = 0; i < src->npoints; i++) {
+        x[i] = m.a * sx[i] + m.c * sy[i] + m.e;
+        y[i] = m.b * sx[i] + m.d * sy[i] + m.f;
+    }
+    path->npoints += src->npoints;
+    if (src->nparts)
+        path->start = pgTransformPoint(&m, src->start);
+}
+static void extendRange(float v, float *lo, float *hi) {
+    if (v < *lo) *lo = v;
+    if (v > *hi) *hi = v;
+}
+// Curves reach past their end points where their derivative on an axis is zero
+static void quadraticRange(float a, float b, float c, float *lo, float *hi) {
+    float den = a - 2 * b + c;
+    if (den != 0) {
+        float t = (a - b) / den;
+        if (t > 0 && t < 1)
+            extendRange((1 - t) * (1 - t) * a + 2 * (1 - t) * t * b + t * t * c, lo, hi);
+    }
+}
+static void cubicRange(float a, float b, float c, float d, float *lo, float *hi) {
+    float p = b - a, q = c - b, r = d - c;
+    float qa = p - 2 * q + r, qb = 2 * (q - p), qc = p;
+    float roots[2];
+    int n = 0;
+    if (fabsf(qa) < 1e-12f) {
+        if (qb != 0)
+            roots[n++] = -qc / qb;
+    } else {
+        float disc = qb * qb - 4 * qa * qc;
+        if (disc >= 0) {
+            disc = sqrtf(disc);
+            roots[n++] = (-qb + disc) / (2 * qa);
+            roots[n++] = (-qb - disc) / (2 * qa);
+        }
+    }
+    for (int i = 0; i < n; i++) {
+        float t = roots[i], u = 1 - t;
+        if (t > 0 && t < 1)
+            extendRange(u * u * u * a + 3 * u * u * t * b + 3 * u * t * t * c + t * t * t * d, lo, hi);
+    }
 }
 static PgRect _box(PgPath *path) {
-    PgRect r = { {FLT_MAX,FLT_MAX}, {FLT_MIN,FLT_MIN} };
-    // TODO box is not tight since it just goes by curve control points
-    for (int i = 0; i < path->npoints; i++) {
-        r.a.x = MIN(r.a.x, path->points[i].x);
-        r.a.y = MIN(r.a.y, path->points[i].y);
-        r.b.x = MAX(r.b.x, path->points[i].x);
-        r.b.y = MAX(r.b.y, path->points[i].y);
+    if (LOAD_ACQUIRE(&path->bounded))
+        return path->bounds;
+    
+    // Empty paths get an inverted box that contains nothing
+    PgRect r = { {FLT_MAX,FLT_MAX}, {-FLT_MAX,-FLT_MAX} };
+    const float *x = path->x;
+    const float *y = path->y;
+    for (int i = 0, ip = 0; i < path->nparts; ip += pgPathPartTypeArgs(path->types[i]), i++) {
+        int last = ip + pgPathPartTypeArgs(path->types[i]) - 1;
+        extendRange(x[last], &r.a.x, &r.b.x);
+        extendRange(y[last], &r.a.y, &r.b.y);
+        if (!ip)
+            continue;
+        if (path->types[i] == PG_PATH_QUADRATIC) {
+            quadraticRange(x[ip - 1], x[ip], x[ip + 1], &r.a.x, &r.b.x);
+            quadraticRange(y[ip - 1], y[ip], y[ip + 1], &r.a.y, &r.b.y);
+        } else if (path->types[i] == PG_PATH_CUBIC) {
+            cubicRange(x[ip - 1], x[ip], x[ip + 1], x[ip + 2], &r.a.x, &r.b.x);
+            cubicRange(y[ip - 1], y[ip], y[ip + 1], y[ip + 2], &r.a.y, &r.b.y);
+        }
+    }
+    
+    // Threads filling one path may all compute the box; only the first stores it,
+    // so readers that saw bounded set never see it rewritten
+    _pgLock(&path->segmentsLock);
+    if (!path->bounded) {
+        path->bounds = r;
+        STORE_RELEASE(&path->bounded, 1);
     }
+    _pgUnlock(&path->segmentsLock);
     return r;
 }
 static void _free(PgPath *path) {
     if (path) {
         free(path->types);
-        free(path->points);
+        free(path->x);
+        free(path->y);
+        _pgFreeSegmentCache(path->segments);
+        _pgFreeShadowCache(path->shadow);
         free(path);
     }
 }
@@ -69,10 +193,19 @@ PgPath pgDefaultPath() {
         .nparts = 0,
         .npoints = 0,
         .cap = 0,
+        .cappoints = 0,
         .types = NULL,
-        .points = NULL,
+        .x = NULL,
+        .y = NULL,
         .start = {0, 0},
         .fillRule = PG_NONZERO_WINDING,
+        .bounded = 0,
+        .cacheSegments = false,
+        .segments = NULL,
+        .segmentsLock = 0,
+        .cacheShadow = false,
+        .shadow = NULL,
+        .shadowLock = 0,
         
         .free = _free,
         .move = _move,
@@ -80,6 +213,10 @@ PgPath pgDefaultPath() {
         .line = _line,
         .quadratic = _quadratic,
         .cubic = _cubic,
+        .reserve = _reserve,
+        .append = _append,
+        .lines = _lines,
+        .appendPath = _appendPath,
         .box = _box,
     };
 }
@@ -0,0 +1,169 @@
+// Compact serialized paths: one byte per part and quantized 16-bit coordinate deltas
+#define _USE_MATH_DEFINES
+#include <assert.h>
+#include <ctype.h>
+#include <float.h>
+#include <emmintrin.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include <pg/pg.h>
+#include <pg/platform.h>
+#include "common.h"
+
+// Layout, all little endian so files can be mapped and read in place:
+//   'P' 'G' version flags
+//   u32 nparts, u32 npoints
+//   f32 origin x, f32 origin y, f32 step
+//   nparts part type bytes
+//   npoints pairs of i16 deltas from the previous point, in steps
+#define HEADER_SIZE 24
+#define VERSION     1
+#define EVENODD     1
+#define MAX_STEPS   32767
+
+static void put32(uint8_t *p, uint32_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+static uint32_t get32(const uint8_t *p) {
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+static void putFloat(uint8_t *p, float f) {
+    uint32_t v;
+    memcpy(&v, &f, 4);
+    put32(p, v);
+}
+static float getFloat(const uint8_t *p) {
+    uint32_t v = get32(p);
+    float f;
+    memcpy(&f, &v, 4);
+    return f;
+}
+
+uint8_t *pgWritePathData(const PgPath *path, float precision, int *lenp) {
+    float lo_x = 0, lo_y = 0, hi_x = 0, hi_y = 0;
+    for (int i = 0; i < path->npoints; i++) {
+        if (!i || path->x[i] < lo_x) lo_x = path->x[i];
+        if (!i || path->y[i] < lo_y) lo_y = path->y[i];
+        if (!i || path->x[i] > hi_x) hi_x = path->x[i];
+        if (!i || path->y[i] > hi_y) hi_y = path->y[i];
+    }
+
+    // Coarsen the step if the path spans more than 16 bits of it
+    float step = precision > 0? precision: 1 / 64.0f;
+    float range = MAX(hi_x - lo_x, hi_y - lo_y);
+    if (range / step > MAX_STEPS)
+        step = range / MAX_STEPS;
+
+    int len = HEADER_SIZE + path->nparts + path->npoints * 4;
+    uint8_t *out = NEW_ARRAY(uint8_t, len);
+    out[0] = 'P';
+    out[1] = 'G';
+    out[2] = VERSION;
+    out[3] = path->fillRule == PG_EVENODD_WINDING? EVENODD: 0;
+    put32(out + 4, path->nparts);
+    put32(out + 8, path->npoints);
+    putFloat(out + 12, lo_x);
+    putFloat(out + 16, lo_y);
+    putFloat(out + 20, step);
+
+    uint8_t *p = out + HEADER_SIZE;
+    for (int i = 0; i < path->nparts; i++)
+        *p++ = path->types[i];
+
+    // Deltas between rounded positions so errors never accumulate
+    int px = 0, py = 0;
+    for (int i = 0; i < path->npoints; i++) {
+        int qx = clamp(0, lrintf((path->x[i] - lo_x) / step), MAX_STEPS);
+        int qy = clamp(0, lrintf((path->y[i] - lo_y) / step), MAX_STEPS);
+        int16_t dx = qx - px;
+        int16_t dy = qy - py;
+        p[0] = dx;
+        p[1] = (uint16_t)dx >> 8;
+        p[2] = dy;
+        p[3] = (uint16_t)dy >> 8;
+        p += 4;
+        px = qx;
+        py = qy;
+    }
+    if (lenp) *lenp = len;
+    return out;
+}
+
+bool pgAppendPathData(PgPath *path, const PgMatrix *ctm, const void *data, int len) {
+    const uint8_t *in = data;
+    if (len < HEADER_SIZE || in[0] != 'P' || in[1] != 'G' || in[2] != VERSION)
+        return false;
+    uint32_t nparts = get32(in + 4);
+    uint32_t npoints = get32(in + 8);
+    if (nparts > (uint32_t)(len - HEADER_SIZE) || npoints > (uint32_t)(len - HEADER_SIZE - nparts) / 4)
+        return false;
+
+    const uint8_t *types = in + HEADER_SIZE;
+    uint32_t needed = 0;
+    int last_move = -1;
+    for (uint32_t i = 0; i < nparts; i++) {
+        if (types[i] > PG_PATH_CUBIC)
+            return false;
+        if (types[i] == PG_PATH_MOVE)
+            last_move = needed;
+        needed += pgPathPartTypeArgs(types[i]);
+    }
+    if (needed != npoints)
+        return false;
+
+    // Fold the origin and step into the matrix so each point is two multiply-adds
+    float ox = getFloat(in + 12);
+    float oy = getFloat(in + 16);
+    float step = getFloat(in + 20);
+    PgMatrix m = ctm? *ctm: PgIdentityMatrix;
+    PgMatrix q = {
+        m.a * step, m.b * step,
+        m.c * step, m.d * step,
+        m.a * ox + m.c * oy + m.e,
+        m.b * ox + m.d * oy + m.f,
+    };
+
+    $(reserve, path, nparts, npoints);
+    for (uint32_t i = 0; i < nparts; i++)
+        path->types[path->nparts + i] = types[i];
+    float * __restrict x = path->x + path->npoints;
+    float * __restrict y = path->y + path->npoints;
+    const uint8_t *p = types + nparts;
+    int qx = 0, qy = 0;
+    for (uint32_t i = 0; i < npoints; i++, p += 4) {
+        qx += (int16_t)(p[0] | p[1] << 8);
+        qy += (int16_t)(p[2] | p[3] << 8);
+        x[i] = q.a * qx + q.c * qy + q.e;
+        y[i] = q.b * qx + q.d * qy + q.f;
+    }
+    if (last_move >= 0)
+        path->start = pgPt(x[last_move], y[last_move]);
+    path->nparts += nparts;
+    path->npoints += npoints;
+    path->bounded = 0;
+    if (in[3] & EVENODD)
+        path->fillRule = PG_EVENODD_WINDING;
+    return true;
+}
+PgPath *pgReadPathData(const void *data, int len, const PgMatrix *ctm) {
+    PgPath *path = pgNewPath();
+    if (!pgAppendPathData(path, ctm, data, len)) {
+        $(free, path);
+        return NULL;
+    }
+    return path;
+}
+uint8_t *pgSvgToPathData(const char *svg, float precision, int *lenp) {
+    PgPath *path = pgInterpretSvgPath(svg, NULL);
+    uint8_t *data = pgWritePathData(path, precision, lenp);
+    $(free, path);
+    return data;
+}
@@ -0,0 +1,412 @@
+// Canvases that hand their drawing to a render thread, which plays it into two buffers in turn
+#define _USE_MATH_DEFINES
+#include <assert.h>
+#include <ctype.h>
+#include <float.h>
+#include <emmintrin.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include <pg/pg.h>
+#include <pg/platform.h>
+#include "common.h"
+
+#define QUEUE_BYTES (1 << 20)
+#define ALIGNMENT   16
+#define SPIN        1000    // Polls for more commands before the render thread sleeps
+
+typedef enum {
+    CMD_PAD,                // Skips the end of the ring when a command doesn't fit there
+    CMD_CLEAR,
+    CMD_CLEAR_SECTION,
+    CMD_FILL,
+    CMD_GLYPHS,
+    CMD_IMAGE,
+    CMD_RESIZE,
+    CMD_PRESENT,
+    CMD_QUIT,
+} CommandType;
+
+typedef struct {
+    PgPt        at;
+    unsigned    glyph;
+} Glyph;
+
+// One command in the ring, followed by the path or glyphs it draws. Commands
+// carry the canvas state they were made under, since the caller moves on at once.
+typedef struct {
+    CommandType type;
+    uint32_t    size;       // Bytes to the next command
+    void        *spill;     // Path or glyphs too large for the ring, freed once played
+    PgMatrix    ctm;
+    float       flatness;
+    float       subsamples;
+    float       sdf_size;
+    uint32_t    color;
+    PgRect      rect;       // Cleared, or the part of the image drawn
+    PgMatrix    matrix;
+    bool        transformed;// The matrix applies
+    PgFillRule  rule;
+    const Pg    *image;
+    const PgFont *font;
+    float       opacity;
+    PgFilter    filter;
+    int         n;          // Path parts, glyphs, or the new width
+    int         npoints;    // Path points, or the new height
+} Command;
+
+static uint32_t align(size_t n) {
+    return (n + ALIGNMENT - 1) & ~(size_t)(ALIGNMENT - 1);
+}
+static void *payload(Command *c) {
+    return c->spill? c->spill: c + 1;
+}
+
+// Lets the render thread play everything written so far
+static void publish(PgQueueCanvas *q) {
+    STORE_RELEASE(&q->head, q->written);
+    FENCE();
+    if (LOAD_ACQUIRE(&q->renderSleeps))
+        _pgWake(&q->head);
+}
+// Lets go of the frame pgWaitQueue() returned, which the render thread may be waiting to draw over
+static void release(PgQueueCanvas *q) {
+    if (q->shown) {
+        STORE_RELEASE(&q->shown, 0);
+        _pgWake(&q->shown);
+    }
+}
+static void waitForRoom(PgQueueCanvas *q, uint32_t size) {
+    while (q->capacity - (q->written - LOAD_ACQUIRE(&q->tail)) < size) {
+        release(q); // Else a frame too large for the ring could wait on itself
+        STORE_RELEASE(&q->writerSleeps, 1);
+        FENCE();
+        uint32_t tail = LOAD_ACQUIRE(&q->tail);
+        if (q->capacity - (q->written - tail) < size)
+            _pgWait(&q->tail, tail);
+        STORE_RELEASE(&q->writerSleeps, 0);
+    }
+}
+// Makes room for a command and its payload, which goes to the heap
+// instead when it would take up much of the ring
+static Command *begin(const Pg *g, CommandType type, size_t bytes) {
+    PgQueueCanvas *q = (PgQueueCanvas*)g;
+    bool spill = sizeof(Command) + bytes > q->capacity / 4;
+    uint32_t size = align(sizeof(Command) + (spill? 0: bytes));
+    uint32_t offset = q->written & (q->capacity - 1);
+    if (offset + size > q->capacity) {
+        uint32_t pad = q->capacity - offset;
+        waitForRoom(q, pad);
+        Command *c = (Command*)(q->ring + offset);
+        c->type = CMD_PAD;
+        c->size = pad;
+        q->written += pad;
+        publish(q);
+        offset = 0;
+    }
+    waitForRoom(q, size);
+    Command *c = (Command*)(q->ring + offset);
+    c->type = type;
+    c->size = size;
+    c->spill = spill? malloc(bytes): NULL;
+    c->transformed = false;
+    c->ctm = g->ctm;
+    c->flatness = g->flatness;
+    c->subsamples = g->subsamples;
+    c->sdf_size = g->sdf_size;
+    q->written += size;
+    return c;
+}
+
+static void _clear(const Pg *g, uint32_t color) {
+    Command *c = begin(g, CMD_CLEAR, 0);
+    c->color = color;
+    publish((PgQueueCanvas*)g);
+}
+static void _clearSection(const Pg *g, PgRect rect, uint32_t color) {
+    Command *c = begin(g, CMD_CLEAR_SECTION, 0);
+    c->rect = rect;
+    c->color = color;
+    publish((PgQueueCanvas*)g);
+}
+// Paths are copied, so the caller may change or free them straight away
+static void _fillTransformed(const Pg *g, const PgPath *path, const PgMatrix *matrix, uint32_t color) {
+    if (path->nparts == 0) return;
+    size_t types = path->nparts * sizeof *path->types;
+    size_t points = path->npoints * sizeof *path->x;
+    Command *c = begin(g, CMD_FILL, types + 2 * points);
+    c->color = color;
+    c->transformed = matrix != NULL;
+    if (matrix)
+        c->matrix = *matrix;
+    c->rule = path->fillRule;
+    c->n = path->nparts;
+    c->npoints = path->npoints;
+    uint8_t *p = payload(c);
+    memcpy(p, path->types, types);
+    memcpy(p + types, path->x, points);
+    memcpy(p + types + points, path->y, points);
+    publish((PgQueueCanvas*)g);
+}
+static void _fill(const Pg *g, const PgPath *path, uint32_t color) {
+    _fillTransformed(g, path, NULL, color);
+}
+// Text is shaped and measured here, so the render thread only reads the font
+static float _fillGlyph(Pg *g, const PgFont *font, PgPt at, unsigned glyph, uint32_t color) {
+    float width = $(getGlyphWidth, font, glyph);
+    Command *c = begin(g, CMD_GLYPHS, sizeof(Glyph));
+    c->font = font;
+    c->color = color;
+    c->n = 1;
+    *(Glyph*)payload(c) = (Glyph){ at, glyph };
+    publish((PgQueueCanvas*)g);
+    return width;
+}
+static float _fillString(Pg *g, const PgFont *font, PgPt at, const wchar_t chars[], int len, uint32_t color) {
+    float org = at.x;
+    uint16_t *ids = $(shapeString, font, chars, len, &len);
+    if (len > 0) {
+        Command *c = begin(g, CMD_GLYPHS, len * sizeof(Glyph));
+        c->font = font;
+        c->color = color;
+        c->n = len;
+        Glyph *glyphs = payload(c);
+        for (int i = 0; i < len; i++) {
+            glyphs[i] = (Glyph){ at, ids[i] };
+            at.x += $(getGlyphWidth, font, ids[i]);
+        }
+        publish((PgQueueCanvas*)g);
+    }
+    free(ids);
+    return at.x - org;
+}
+static void _drawImage(const Pg *g, const Pg *image, PgRect from, const PgMatrix *matrix, float opacity, PgFilter filter) {
+    Command *c = begin(g, CMD_IMAGE, 0);
+    c->image = image;
+    c->rect = from;
+    c->transformed = matrix != NULL;
+    if (matrix)
+        c->matrix = *matrix;
+    c->opacity = opacity;
+    c->filter = filter;
+    publish((PgQueueCanvas*)g);
+}
+// Buffers take the new size as they come to be drawn
+static void _resize(Pg *g, int width, int height) {
+    g->width = width;
+    g->height = height;
+    Command *c = begin(g, CMD_RESIZE, 0);
+    c->n = width;
+    c->npoints = height;
+    publish((PgQueueCanvas*)g);
+}
+static void _free(Pg *g) {
+    if (g) {
+        PgQueueCanvas *q = (PgQueueCanvas*)g;
+        release(q);
+        begin(g, CMD_QUIT, 0);
+        publish(q);
+        _pgJoinThread(q->thread);
+        $(free, q->buffers[0]);
+        $(free, q->buffers[1]);
+        free(q->ring);
+        free(g);
+    }
+}
+
+// The render thread
+
+static uint32_t waitForCommands(PgQueueCanvas *q, uint32_t tail) {
+    uint32_t head;
+    for (int spin = 0; (head = LOAD_ACQUIRE(&q->head)) == tail; spin++)
+        if (spin < SPIN)
+            _mm_pause();
+        else {
+            STORE_RELEASE(&q->renderSleeps, 1);
+            FENCE();
+            if (LOAD_ACQUIRE(&q->head) == tail)
+                _pgWait(&q->head, tail);
+            STORE_RELEASE(&q->renderSleeps, 0);
+        }
+    return head;
+}
+// Frees a command's room for the drawing thread
+static void retire(PgQueueCanvas *q, uint32_t tail) {
+    STORE_RELEASE(&q->tail, tail);
+    FENCE();
+    if (LOAD_ACQUIRE(&q->writerSleeps))
+        _pgWake(&q->tail);
+}
+// The buffer a frame is drawn into, once pgWaitQueue()'s caller has let go of it
+static Pg *beginFrame(PgQueueCanvas *q, uint32_t frame, int width, int height) {
+    STORE_RELEASE(&q->drawing, frame);
+    FENCE();
+    uint32_t shown;
+    while ((shown = LOAD_ACQUIRE(&q->shown)) && !((shown ^ frame) & 1))
+        _pgWait(&q->shown, shown);
+    Pg *back = q->buffers[frame & 1];
+    if (back->width != width || back->height != height)
+        $(resize, back, width, height);
+    back->stats = q->_._.stats;
+    return back;
+}
+static void play(Pg *back, Command *c) {
+    back->ctm = c->ctm;
+    back->flatness = c->flatness;
+    back->subsamples = c->subsamples;
+    back->sdf_size = c->sdf_size;
+    const PgMatrix *matrix = c->transformed? &c->matrix: NULL;
+    switch (c->type) {
+    case CMD_CLEAR:
+        $(clear, back, c->color);
+        break;
+    case CMD_CLEAR_SECTION:
+        $(clearSection, back, c->rect, c->color);
+        break;
+    case CMD_FILL: {
+        // The copied points are drawn in place
+        uint8_t *p = payload(c);
+        PgPath path = pgDefaultPath();
+        path.nparts = path.cap = c->n;
+        path.npoints = path.cappoints = c->npoints;
+        path.types = (PgPathPartType*)p;
+        path.x = (float*)(p + c->n * sizeof *path.types);
+        path.y = path.x + c->npoints;
+        path.fillRule = c->rule;
+        $(fillTransformed, back, &path, matrix, c->color);
+        break;
+    }
+    case CMD_GLYPHS: {
+        const Glyph *glyphs = payload(c);
+        for (int i = 0; i < c->n; i++)
+            $(fillGlyph, back, c->font, glyphs[i].at, glyphs[i].glyph, c->color);
+        break;
+    }
+    case CMD_IMAGE:
+        $(drawImage, back, c->image, c->rect, matrix, c->opacity, c->filter);
+        break;
+    case CMD_RESIZE:
+        $(resize, back, c->n, c->npoints);
+        break;
+    default:
+        break;
+    }
+    free(c->spill);
+}
+static void render(void *arg, int thread) {
+    PgQueueCanvas *q = arg;
+    int width = q->_._.width;
+    int height = q->_._.height;
+    uint32_t frame = 1;
+    Pg *back = beginFrame(q, frame, width, height);
+    for (uint32_t tail = 0; ; ) {
+        uint32_t head = waitForCommands(q, tail);
+        while (tail != head) {
+            // The type is kept, since the command's room is handed back before a new frame begins
+            Command *c = (Command*)(q->ring + (tail & (q->capacity - 1)));
+            CommandType type = c->type;
+            if (type == CMD_RESIZE) {
+                width = c->n;
+                height = c->npoints;
+            }
+            if (type != CMD_PAD) // Pads are too short to hold a whole command
+                play(back, c);
+            tail += c->size;
+            retire(q, tail);
+
+            if (type == CMD_QUIT)
+                return;
+            if (type == CMD_PRESENT) {
+                STORE_RELEASE(&q->completed, frame);
+                _pgWake(&q->completed);
+                back = beginFrame(q, ++frame, width, height);
+            }
+        }
+    }
+}
+
+PgQueueCanvas pgDefaultQueueCanvas() {
+    PgQueueCanvas g;
+    g._ = pgDefaultBitmapCanvas();
+    g._._.free = _free;
+    g._._.resize = _resize;
+    g._._.clear = _clear;
+    g._._.clearSection = _clearSection;
+    g._._.fill = _fill;
+    g._._.fillTransformed = _fillTransformed;
+    g._._.fillGlyph = _fillGlyph;
+    g._._.fillString = _fillString;
+    g._._.drawImage = _drawImage;
+    g.buffers[0] = g.buffers[1] = NULL;
+    g.ring = NULL;
+    g.capacity = 0;
+    g.written = 0;
+    g.head = 0;
+    g.tail = 0;
+    g.renderSleeps = 0;
+    g.writerSleeps = 0;
+    g.presented = 0;
+    g.completed = 0;
+    g.drawing = 0;
+    g.shown = 0;
+    g.thread = 0;
+    return g;
+}
+// Fonts and images it draws must stay unchanged until the frame drawing them
+// has been waited for. Statistics are gathered on the render thread.
+Pg *pgNewQueueCanvas(int width, int height) {
+    PgQueueCanvas *q = NEW(PgQueueCanvas);
+    *q = pgDefaultQueueCanvas();
+    q->_._.width = width;
+    q->_._.height = height;
+    q->buffers[0] = pgNewBitmapCanvas(width, height);
+    q->buffers[1] = pgNewBitmapCanvas(width, height);
+    q->capacity = QUEUE_BYTES;
+    q->ring = malloc(q->capacity);
+    q->thread = _pgStartThread(render, q);
+    if (!q->thread) {
+        $(free, q->buffers[0]);
+        $(free, q->buffers[1]);
+        free(q->ring);
+        free(q);
+        return NULL;
+    }
+    return &q->_._;
+}
+
+// Ends the frame drawn so far and returns its number. The frame after
+// starts on the buffer drawn two frames back, with its pixels.
+uint32_t pgPresentQueue(Pg *g) {
+    PgQueueCanvas *q = (PgQueueCanvas*)g;
+    begin(g, CMD_PRESENT, 0);
+    publish(q);
+    return ++q->presented;
+}
+// Waits until a frame is drawn, 0 meaning the last one presented, and returns
+// the canvas holding the newest finished frame, or NULL if none has finished.
+// Its pixels stay put until the next wait, or until a frame runs out of room
+// in the queue while the render thread is waiting to draw over them.
+const Pg *pgWaitQueue(Pg *g, uint32_t frame) {
+    PgQueueCanvas *q = (PgQueueCanvas*)g;
+    frame = frame? MIN(frame, q->presented): q->presented;
+    release(q);
+    uint32_t done;
+    while ((done = LOAD_ACQUIRE(&q->completed)) < frame)
+        _pgWait(&q->completed, done);
+
+    // The render thread may have started over the newest frame's buffer
+    // before it saw the frame held, so then hold the next one
+    for (;;) {
+        done = LOAD_ACQUIRE(&q->completed);
+        STORE_RELEASE(&q->shown, done);
+        FENCE();
+        _pgWake(&q->shown);
+        if (LOAD_ACQUIRE(&q->drawing) != done + 2)
+            break;
+    }
+    return done? q->buffers[done & 1]: NULL;
+}
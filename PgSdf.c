@@ -0,0 +1,362 @@
+// Signed distance fields of glyphs: one field per glyph serves every size above a threshold
+#define _USE_MATH_DEFINES
+#include <assert.h>
+#include <ctype.h>
+#include <float.h>
+#include <emmintrin.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include <pg/pg.h>
+#include <pg/platform.h>
+#include "common.h"
+
+#define SDF_EM      64  // Pixels per em fields are built at
+#define SDF_SPREAD  4   // Pixels either side of the outline a field covers
+#define SDF_NEAR    (128 - 2 * 127 / SDF_SPREAD)
+
+typedef struct {
+    int         width;
+    int         height;
+    PgPt        origin;     // Top left of the field from the glyph's origin at SDF_EM
+    int16_t     (*spans)[2];// First and last texel of each row within two texels of ink
+    uint8_t     data[];     // 128 on the outline, rising inside
+} SdfGlyph;
+
+// Glyph fields in pages of 256, filled in by whichever thread draws them first
+struct PgSdfCache {
+    SdfGlyph * volatile *volatile pages[256];
+};
+
+typedef struct {
+    PgPt        a;
+    PgPt        b;
+} Line;
+
+typedef struct {
+    int         n;
+    int         cap;
+    Line        *lines;
+} LineList;
+
+static void addLine(LineList *list, PgPt a, PgPt b) {
+    if (list->n + 1 > list->cap) {
+        list->cap = list->cap? list->cap * 2: 64;
+        REALLOC(list->lines, Line, list->cap);
+    }
+    list->lines[list->n++] = (Line){ a, b };
+}
+static int curveSteps(float length) {
+    return clamp(1, sqrtf(length), 16);
+}
+static void flatten(LineList *list, const PgPath *path) {
+    PgPt a = { 0, 0 };
+    for (int i = 0, ip = 0; i < path->nparts; ip += pgPathPartTypeArgs(path->types[i]), i++) {
+        PgPt p[3];
+        for (int k = 0; k < pgPathPartTypeArgs(path->types[i]); k++)
+            p[k] = pgPathPoint(path, ip + k);
+        switch (path->types[i]) {
+        case PG_PATH_MOVE:
+            a = p[0];
+            break;
+        case PG_PATH_LINE:
+            addLine(list, a, p[0]);
+            a = p[0];
+            break;
+        case PG_PATH_QUADRATIC: {
+            int n = curveSteps(dist(p[0].x - a.x, p[0].y - a.y) + dist(p[1].x - p[0].x, p[1].y - p[0].y));
+            for (int s = 1; s <= n; s++) {
+                float t = (float)s / n, u = 1 - t;
+                PgPt b = pgPt(
+                    u * u * a.x + 2 * u * t * p[0].x + t * t * p[1].x,
+                    u * u * a.y + 2 * u * t * p[0].y + t * t * p[1].y);
+                addLine(list, a, b);
+                a = b;
+            }
+            break;
+        }
+        case PG_PATH_CUBIC: {
+            int n = curveSteps(dist(p[0].x - a.x, p[0].y - a.y) + dist(p[1].x - p[0].x, p[1].y - p[0].y)
+                + dist(p[2].x - p[1].x, p[2].y - p[1].y));
+            PgPt start = a;
+            for (int s = 1; s <= n; s++) {
+                float t = (float)s / n, u = 1 - t;
+                float k0 = u * u * u, k1 = 3 * u * u * t, k2 = 3 * u * t * t, k3 = t * t * t;
+                PgPt b = pgPt(
+                    k0 * start.x + k1 * p[0].x + k2 * p[1].x + k3 * p[2].x,
+                    k0 * start.y + k1 * p[0].y + k2 * p[1].y + k3 * p[2].y);
+                addLine(list, a, b);
+                a = b;
+            }
+            break;
+        }
+        }
+    }
+}
+static float lineDistance2(const Line *line, float x, float y) {
+    float dx = line->b.x - line->a.x;
+    float dy = line->b.y - line->a.y;
+    float len2 = dx * dx + dy * dy;
+    float t = len2 > 0? ((x - line->a.x) * dx + (y - line->a.y) * dy) / len2: 0;
+    t = t < 0? 0: t > 1? 1: t;
+    float ex = line->a.x + t * dx - x;
+    float ey = line->a.y + t * dy - y;
+    return ex * ex + ey * ey;
+}
+
+static SdfGlyph *buildGlyph(const PgFont *font, unsigned g) {
+    PgFont *ref = $(sized, font, SDF_EM, 0);
+    PgPath *path = $(getGlyphPath, ref, &PgIdentityMatrix, g);
+    $(free, ref);
+    LineList list = { 0 };
+    flatten(&list, path);
+    $(free, path);
+    if (!list.n) {
+        SdfGlyph *empty = calloc(1, sizeof *empty);
+        return empty;
+    }
+
+    PgRect box = { list.lines[0].a, list.lines[0].a };
+    for (int i = 0; i < list.n * 2; i++) {
+        PgPt p = i & 1? list.lines[i / 2].b: list.lines[i / 2].a;
+        box.a.x = MIN(box.a.x, p.x);
+        box.a.y = MIN(box.a.y, p.y);
+        box.b.x = MAX(box.b.x, p.x);
+        box.b.y = MAX(box.b.y, p.y);
+    }
+    int x0 = floorf(box.a.x) - SDF_SPREAD;
+    int y0 = floorf(box.a.y) - SDF_SPREAD;
+    int width = (int)ceilf(box.b.x) + SDF_SPREAD - x0;
+    int height = (int)ceilf(box.b.y) + SDF_SPREAD - y0;
+    int size = (width * height + 1) & ~1;
+    SdfGlyph *glyph = malloc(sizeof *glyph + size + height * sizeof *glyph->spans);
+    glyph->width = width;
+    glyph->height = height;
+    glyph->origin = pgPt(x0, y0);
+    glyph->spans = (void*)(glyph->data + size);
+
+    // Nearest outline within the spread, visiting only texels near each line
+    float *dist2 = NEW_ARRAY(float, width * height);
+    for (int i = 0; i < width * height; i++)
+        dist2[i] = SDF_SPREAD * SDF_SPREAD;
+    for (int i = 0; i < list.n; i++) {
+        const Line *line = &list.lines[i];
+        int xa = clamp(0, floorf(MIN(line->a.x, line->b.x)) - SDF_SPREAD - x0, width);
+        int xb = clamp(0, ceilf(MAX(line->a.x, line->b.x)) + SDF_SPREAD - x0, width);
+        int ya = clamp(0, floorf(MIN(line->a.y, line->b.y)) - SDF_SPREAD - y0, height);
+        int yb = clamp(0, ceilf(MAX(line->a.y, line->b.y)) + SDF_SPREAD - y0, height);
+        for (int y = ya; y < yb; y++)
+            for (int x = xa; x < xb; x++) {
+                float d2 = lineDistance2(line, x0 + x + .5f, y0 + y + .5f);
+                if (d2 < dist2[y * width + x])
+                    dist2[y * width + x] = d2;
+            }
+    }
+
+    // Sign each row by its non-zero winding from the left
+    typedef struct { float x; int dir; } Crossing;
+    Crossing *crossings = NEW_ARRAY(Crossing, list.n);
+    for (int y = 0; y < height; y++) {
+        float cy = y0 + y + .5f;
+        int n = 0;
+        for (int i = 0; i < list.n; i++) {
+            PgPt a = list.lines[i].a, b = list.lines[i].b;
+            if ((a.y <= cy) != (b.y <= cy)) {
+                Crossing c = { a.x + (cy - a.y) * (b.x - a.x) / (b.y - a.y), a.y < b.y? 1: -1 };
+                int j = n++;
+                for ( ; j > 0 && crossings[j - 1].x > c.x; j--)
+                    crossings[j] = crossings[j - 1];
+                crossings[j] = c;
+            }
+        }
+        int winding = 0;
+        for (int x = 0, c = 0; x < width; x++) {
+            float cx = x0 + x + .5f;
+            while (c < n && crossings[c].x < cx)
+                winding += crossings[c++].dir;
+            float d = sqrtf(dist2[y * width + x]) * (127.0f / SDF_SPREAD);
+            glyph->data[y * width + x] = clamp(0, 128.5f + (winding? d: -d), 255);
+        }
+        
+        const uint8_t *row = glyph->data + y * width;
+        int first = 0, last = width - 1;
+        while (first < width && row[first] <= SDF_NEAR) first++;
+        while (last >= first && row[last] <= SDF_NEAR) last--;
+        glyph->spans[y][0] = first;
+        glyph->spans[y][1] = last;
+    }
+    free(crossings);
+    free(dist2);
+    free(list.lines);
+    return glyph;
+}
+static const SdfGlyph *getGlyph(const PgFont *font, unsigned g) {
+    PgFace *face = font->face;
+    PgSdfCache *cache = LOAD_ACQUIRE(&face->sdf);
+    if (!cache) {
+        cache = calloc(1, sizeof *cache);
+        if (!CAS_POINTER(&face->sdf, NULL, cache)) {
+            free(cache);
+            cache = LOAD_ACQUIRE(&face->sdf);
+        }
+    }
+
+    g &= 0xffff;
+    SdfGlyph * volatile *page = LOAD_ACQUIRE(&cache->pages[g >> 8]);
+    if (!page) {
+        page = calloc(256, sizeof *page);
+        if (!CAS_POINTER(&cache->pages[g >> 8], NULL, page)) {
+            free((void*)page);
+            page = LOAD_ACQUIRE(&cache->pages[g >> 8]);
+        }
+    }
+    SdfGlyph *glyph = LOAD_ACQUIRE(&page[g & 255]);
+    if (!glyph) {
+        glyph = buildGlyph(font, g);
+        if (!CAS_POINTER(&page[g & 255], NULL, glyph)) {
+            free(glyph);
+            glyph = LOAD_ACQUIRE(&page[g & 255]);
+        }
+    }
+    return glyph;
+}
+
+// Bilinear filtering; the border texels are all outside so coordinates clamp to them
+static float sample(const SdfGlyph *glyph, float u, float v) {
+    u = u < 0? 0: u > glyph->width - 1? glyph->width - 1: u;
+    v = v < 0? 0: v > glyph->height - 1? glyph->height - 1: v;
+    int x = u;
+    int y = v;
+    float fx = u - x;
+    float fy = v - y;
+    const uint8_t *p = glyph->data + y * glyph->width + x;
+    int dx = x + 1 < glyph->width;
+    int dy = y + 1 < glyph->height? glyph->width: 0;
+    float top = p[0] + (p[dx] - p[0]) * fx;
+    float bottom = p[dy] + (p[dy + dx] - p[dy]) * fx;
+    return top + (bottom - top) * fy;
+}
+
+static void blend(uint32_t *pixel, uint32_t color, float d, float max_alpha) {
+    if (d > 1)
+        d = 1;
+    float coverage = d * d * (3 - 2 * d);
+    *pixel = pgBlend(*pixel, color, coverage * max_alpha);
+}
+// Rows of the field are filtered vertically once, leaving one lerp per pixel
+static void fillUnrotated(const Pg *g, const SdfGlyph *glyph, const PgMatrix *m, float texel, float scale,
+    int x1, int x2, int y1, int y2, uint32_t color)
+{
+    float *line = NEW_ARRAY(float, glyph->width + 1);
+    float max_alpha = color >> 24;
+    float du = 1 / m->a;
+    bool spans = texel >= .25f; // Edges are then under two texels wide
+    for (int y = y1; y < y2; y++) {
+        float v = (y + .5f - m->f) / m->d - glyph->origin.y - .5f;
+        v = v < 0? 0: v > glyph->height - 1? glyph->height - 1: v;
+        int r0 = v;
+        int r1 = MIN(r0 + 1, glyph->height - 1);
+        float fy = v - r0;
+        int first = 0, last = glyph->width - 1;
+        if (spans) {
+            first = MIN(glyph->spans[r0][0], glyph->spans[r1][0]);
+            last = MAX(glyph->spans[r0][1], glyph->spans[r1][1]);
+            if (first > last)
+                continue;
+            first = MAX(first - 1, 0);
+            last = MIN(last + 1, glyph->width - 1);
+        }
+        
+        const uint8_t *a = glyph->data + r0 * glyph->width;
+        const uint8_t *b = glyph->data + r1 * glyph->width;
+        for (int i = first; i <= last; i++)
+            line[i] = (a[i] + (b[i] - a[i]) * fy - 128) * scale + .5f;
+        line[last + 1] = line[last];
+        
+        float xa = (first + glyph->origin.x + .5f) * m->a + m->e - .5f;
+        float xb = (last + glyph->origin.x + .5f) * m->a + m->e - .5f;
+        int start = clamp(x1, floorf(MIN(xa, xb)), x2);
+        int end = clamp(x1, ceilf(MAX(xa, xb)) + 1, x2);
+        uint32_t *screen = ((PgBitmapCanvas*)g)->data + y * ((PgBitmapCanvas*)g)->stride;
+        float u = (start + .5f - m->e) * du - glyph->origin.x - .5f;
+        for (int x = start; x < end; x++, u += du) {
+            float t = u < first? first: u > last? last: u;
+            int i = t;
+            float d = line[i] + (line[i + 1] - line[i]) * (t - i);
+            if (d > 0)
+                blend(screen + x, color, d, max_alpha);
+        }
+    }
+    free(line);
+}
+
+// Draws through the canvas matrix with the glyph's origin at 'at' like fillGlyph()
+void _pgFillSdfGlyph(const Pg *g, const PgFont *font, PgPt at, unsigned glyph_index, uint32_t color) {
+    const SdfGlyph *glyph = getGlyph(font, glyph_index);
+    if (!glyph->width)
+        return;
+
+    // Field texels to the canvas
+    float s = $(getEm, font) / SDF_EM;
+    PgMatrix m = g->ctm;
+    m.a *= s;
+    m.b *= s;
+    m.c *= s;
+    m.d *= s;
+    pgTranslateMatrix(&m, at.x, at.y);
+    float det = m.a * m.d - m.b * m.c;
+    if (fabsf(det) < 1e-12f)
+        return;
+    float texel = sqrtf(fabsf(det)); // Canvas pixels per field texel
+
+    PgRect box = { { FLT_MAX, FLT_MAX }, { -FLT_MAX, -FLT_MAX } };
+    for (int i = 0; i < 4; i++) {
+        PgPt p = pgTransformPoint(&m, pgPt(
+            glyph->origin.x + (i & 1? glyph->width: 0),
+            glyph->origin.y + (i & 2? glyph->height: 0)));
+        box.a.x = MIN(box.a.x, p.x);
+        box.a.y = MIN(box.a.y, p.y);
+        box.b.x = MAX(box.b.x, p.x);
+        box.b.y = MAX(box.b.y, p.y);
+    }
+    int x1 = clamp(0, floorf(box.a.x), g->width);
+    int x2 = clamp(0, ceilf(box.b.x), g->width);
+    int y1 = clamp(0, floorf(box.a.y), g->height);
+    int y2 = clamp(0, ceilf(box.b.y), g->height);
+
+    // Walk the field's texels in step with the canvas pixels
+    float du = m.d / det, dv = -m.b / det;
+    float max_alpha = color >> 24;
+    float scale = texel * SDF_SPREAD / 127.0f;
+    if (m.b == 0 && m.c == 0) {
+        fillUnrotated(g, glyph, &m, texel, scale, x1, x2, y1, y2, color);
+        return;
+    }
+    for (int y = y1; y < y2; y++) {
+        uint32_t *screen = ((PgBitmapCanvas*)g)->data + y * ((PgBitmapCanvas*)g)->stride;
+        float px = x1 + .5f - m.e;
+        float py = y + .5f - m.f;
+        float u = (m.d * px - m.c * py) / det - glyph->origin.x - .5f;
+        float v = (m.a * py - m.b * px) / det - glyph->origin.y - .5f;
+        for (int x = x1; x < x2; x++, u += du, v += dv) {
+            float d = (sample(glyph, u, v) - 128) * scale + .5f;
+            if (d > 0)
+                blend(screen + x, color, d, max_alpha);
+        }
+    }
+}
+void _pgFreeSdfCache(PgSdfCache *cache) {
+    if (cache) {
+        for (int p = 0; p < 256; p++)
+            if (cache->pages[p]) {
+                for (int i = 0; i < 256; i++)
+                    free(cache->pages[p][i]);
+                free((void*)cache->pages[p]);
+            }
+        free(cache);
+    }
+}
@@ -0,0 +1,564 @@
+// GSUB lookups compiled for shaping runs of glyphs
+#define _USE_MATH_DEFINES
+#include <assert.h>
+#include <ctype.h>
+#include <float.h>
+#include <emmintrin.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include <pg/pg.h>
+#include <pg/platform.h>
+#include "common.h"
+
+#define MAX_NESTING 8
+
+typedef struct {
+    const uint16_t  *classes;   // Class or coverage of each glyph; NULL to match a glyph
+    int             value;      // -1 matches any covered glyph
+} Match;
+
+typedef struct {
+    int             nbacktrack;
+    int             ninput;     // Including the first glyph
+    int             nlookahead;
+    int             match;      // Backtrack (nearest first), the rest of the input, lookahead
+    int             naction;
+    int             action;
+} Rule;
+
+// What a glyph turns into for one subtable; the meaning depends on the lookup type:
+//  single, alternate:  glyphs[first]
+//  multiple:           glyphs[first..first+count]
+//  ligature:           trie rooted at nodes[first]
+//  context, chained:   rules[first..first+count]
+//  reverse chained:    rules[first] substituting glyph count
+typedef struct {
+    int             first;
+    int             count;
+    int             next;       // Set from a later subtable covering the same glyph
+} Set;
+
+typedef struct {
+    uint16_t        glyph;
+    uint16_t        ligature;   // 0 if no ligature ends here
+    int             child;
+    int             sibling;
+} Node;
+
+typedef struct {
+    int             type;       // 0 until compiled
+    uint16_t        *cover;     // 1 + first set of each glyph; 0 if not covered
+    Set             *sets;
+    int             nsets;
+    uint16_t        *glyphs;
+    int             nglyphs;
+    Node            *nodes;
+    int             nnodes;
+    Rule            *rules;
+    int             nrules;
+    Match           *matches;
+    int             nmatches;
+    uint16_t        (*actions)[2]; // Input position, lookup
+    int             nactions;
+} Lookup;
+
+typedef struct {
+    const uint8_t   *source;
+    bool            classes;
+    uint16_t        *dense;
+} Table;
+
+struct PgShaper {
+    const uint8_t   *gsub;
+    const uint8_t   *lookup_list;
+    int             nglyphs;
+    int             nlookups;
+    Lookup          *lookups;   // Indexed like the LookupList
+    uint16_t        *order;     // Lookups applied to a run, in LookupList order
+    int             norder;
+    Table           *tables;    // Coverage and class tables shared by all lookups
+    int             ntables;
+};
+
+typedef struct {
+    uint16_t        *glyphs;
+    int             n;
+    int             cap;
+} Run;
+
+static uint16_t u16(const uint8_t *p) {
+    return p[0] << 8 | p[1];
+}
+static uint32_t u32(const uint8_t *p) {
+    return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+// Arrays double whenever their count reaches a power of two
+static void *grow(void *array, int n, size_t size) {
+    if (n && (n < 8 || (n & (n - 1))))
+        return array;
+    return realloc(array, (n? n * 2: 8) * size);
+}
+#define PUSH(ARRAY, N) (*((ARRAY) = grow((ARRAY), (N), sizeof *(ARRAY)), &(ARRAY)[(N)++]))
+
+// Coverage maps glyphs to 1 + their coverage index; class definitions to their class
+static const uint16_t *denseTable(PgShaper *shaper, const uint8_t *source, bool classes) {
+    for (int i = 0; i < shaper->ntables; i++)
+        if (shaper->tables[i].source == source && shaper->tables[i].classes == classes)
+            return shaper->tables[i].dense;
+
+    int nglyphs = shaper->nglyphs;
+    uint16_t *dense = calloc(MAX(nglyphs, 1), sizeof *dense);
+    int format = u16(source);
+    int count = u16(source + 2);
+    if (!classes && format == 1)
+        for (int i = 0; i < count; i++) {
+            int g = u16(source + 4 + i * 2);
+            if (g < nglyphs) dense[g] = i + 1;
+        }
+    else if (!classes && format == 2)
+        for (int i = 0; i < count; i++) {
+            const uint8_t *range = source + 4 + i * 6;
+            int start = u16(range), end = u16(range + 2), index = u16(range + 4);
+            for (int g = start; g <= end && g < nglyphs; g++)
+                dense[g] = index + g - start + 1;
+        }
+    else if (classes && format == 1) {
+        int start = count;
+        count = u16(source + 4);
+        for (int i = 0; i < count && start + i < nglyphs; i++)
+            dense[start + i] = u16(source + 6 + i * 2);
+    } else if (classes && format == 2)
+        for (int i = 0; i < count; i++) {
+            const uint8_t *range = source + 4 + i * 6;
+            int start = u16(range), end = u16(range + 2), cls = u16(range + 4);
+            for (int g = start; g <= end && g < nglyphs; g++)
+                dense[g] = cls;
+        }
+
+    PUSH(shaper->tables, shaper->ntables) = (Table){ source, classes, dense };
+    return dense;
+}
+
+// Returns a new set that glyph g tries after any from earlier subtables
+static int addSet(Lookup *l, int g, int first, int count) {
+    int set = l->nsets;
+    PUSH(l->sets, l->nsets) = (Set){ first, count, -1 };
+    if (!l->cover[g])
+        l->cover[g] = set + 1;
+    else {
+        int last = l->cover[g] - 1;
+        while (l->sets[last].next >= 0)
+            last = l->sets[last].next;
+        l->sets[last].next = set;
+    }
+    return set;
+}
+static int addNode(Lookup *l, uint16_t glyph) {
+    int node = l->nnodes;
+    PUSH(l->nodes, l->nnodes) = (Node){ glyph, 0, -1, -1 };
+    return node;
+}
+static int childNode(Lookup *l, int parent, uint16_t glyph) {
+    int child;
+    for (child = l->nodes[parent].child; child >= 0; child = l->nodes[child].sibling)
+        if (l->nodes[child].glyph == glyph)
+            return child;
+    child = addNode(l, glyph);
+    l->nodes[child].sibling = l->nodes[parent].child;
+    l->nodes[parent].child = child;
+    return child;
+}
+
+// Sequence elements are glyphs, classes, or coverage offsets from base
+static void addMatches(PgShaper *shaper, Lookup *l, const uint8_t *p, int n, const uint16_t *classes, const uint8_t *base) {
+    for (int i = 0; i < n; i++, p += 2)
+        if (base)
+            PUSH(l->matches, l->nmatches) = (Match){ denseTable(shaper, base + u16(p), false), -1 };
+        else
+            PUSH(l->matches, l->nmatches) = (Match){ classes, u16(p) };
+}
+static void compileLookup(PgShaper *shaper, int index);
+
+static int addRule(PgShaper *shaper, Lookup *l, int nbacktrack, int ninput, int nlookahead, const uint8_t *records, int nrecords) {
+    int rule = l->nrules;
+    PUSH(l->rules, l->nrules) = (Rule){
+        .nbacktrack = nbacktrack,
+        .ninput = ninput,
+        .nlookahead = nlookahead,
+        .match = l->nmatches,
+        .naction = nrecords,
+        .action = l->nactions,
+    };
+    for (int i = 0; i < nrecords; i++, records += 4) {
+        uint16_t *action = PUSH(l->actions, l->nactions);
+        action[0] = u16(records);
+        action[1] = u16(records + 2);
+        compileLookup(shaper, action[1]);
+    }
+    return rule;
+}
+
+// Glyph and class based rules: one rule set for each covered glyph or class
+static void compileRuleSets(PgShaper *shaper, Lookup *l, const uint8_t *st, const uint8_t *offsets, int nsets, const uint16_t *input_classes, const uint16_t *classes[3]) {
+    bool chained = l->type == 6;
+    const uint16_t *cover = denseTable(shaper, st + u16(st + 2), false);
+    int *first = NEW_ARRAY(int, MAX(nsets, 1));
+    int *count = NEW_ARRAY(int, MAX(nsets, 1));
+
+    for (int s = 0; s < nsets; s++) {
+        first[s] = l->nrules;
+        count[s] = 0;
+        int offset = u16(offsets + s * 2);
+        if (!offset) continue;
+
+        const uint8_t *set = st + offset;
+        int nrules = u16(set);
+        for (int r = 0; r < nrules; r++) {
+            const uint8_t *p = set + u16(set + 2 + r * 2);
+            int nbacktrack = 0, ninput, nlookahead = 0, nrecords;
+            const uint8_t *backtrack = p, *input, *lookahead = p;
+            if (chained) {
+                nbacktrack = u16(p), backtrack = p + 2, p += 2 + nbacktrack * 2;
+                ninput = u16(p), input = p + 2, p += 2 + MAX(ninput - 1, 0) * 2;
+                nlookahead = u16(p), lookahead = p + 2, p += 2 + nlookahead * 2;
+                nrecords = u16(p), p += 2;
+            } else {
+                ninput = u16(p), nrecords = u16(p + 2);
+                input = p + 4, p += 4 + MAX(ninput - 1, 0) * 2;
+            }
+            if (ninput < 1) continue;
+
+            int match = l->nmatches;
+            addMatches(shaper, l, backtrack, nbacktrack, classes[0], NULL);
+            addMatches(shaper, l, input, ninput - 1, classes[1], NULL);
+            addMatches(shaper, l, lookahead, nlookahead, classes[2], NULL);
+            int rule = addRule(shaper, l, nbacktrack, ninput, nlookahead, p, nrecords);
+            l->rules[rule].match = match;
+            count[s]++;
+        }
+    }
+
+    for (int g = 0; g < shaper->nglyphs; g++)
+        if (cover[g]) {
+            int s = input_classes? input_classes[g]: cover[g] - 1;
+            if (s < nsets && count[s])
+                addSet(l, g, first[s], count[s]);
+        }
+    free(first);
+    free(count);
+}
+
+static void compileSubtable(PgShaper *shaper, Lookup *l, const uint8_t *st) {
+    int nglyphs = shaper->nglyphs;
+    int format = u16(st);
+
+    switch (l->type) {
+    case 1: { // Single
+            const uint16_t *cover = denseTable(shaper, st + u16(st + 2), false);
+            for (int g = 0; g < nglyphs; g++)
+                if (cover[g]) {
+                    uint16_t out = format == 1
+                        ? g + u16(st + 4)
+                        : u16(st + 6 + (cover[g] - 1) * 2);
+                    addSet(l, g, l->nglyphs, 1);
+                    PUSH(l->glyphs, l->nglyphs) = out;
+                }
+            break;
+        }
+    case 2:   // Multiple
+    case 3: { // Alternate keeps the first alternate
+            const uint16_t *cover = denseTable(shaper, st + u16(st + 2), false);
+            int nsequences = u16(st + 4);
+            for (int g = 0; g < nglyphs; g++)
+                if (cover[g] && cover[g] <= nsequences) {
+                    const uint8_t *seq = st + u16(st + 6 + (cover[g] - 1) * 2);
+                    int count = u16(seq);
+                    if (l->type == 3)
+                        count = MIN(count, 1);
+                    if (!count) continue;
+                    addSet(l, g, l->nglyphs, count);
+                    for (int i = 0; i < count; i++)
+                        PUSH(l->glyphs, l->nglyphs) = u16(seq + 2 + i * 2);
+                }
+            break;
+        }
+    case 4: { // Ligature
+            const uint16_t *cover = denseTable(shaper, st + u16(st + 2), false);
+            int nsets = u16(st + 4);
+            for (int g = 0; g < nglyphs; g++)
+                if (cover[g] && cover[g] <= nsets) {
+                    const uint8_t *set = st + u16(st + 6 + (cover[g] - 1) * 2);
+                    int root = addNode(l, g);
+                    int nligatures = u16(set);
+                    for (int i = 0; i < nligatures; i++) {
+                        const uint8_t *lig = set + u16(set + 2 + i * 2);
+                        int ncomponents = u16(lig + 2);
+                        int node = root;
+                        for (int c = 1; c < ncomponents; c++)
+                            node = childNode(l, node, u16(lig + 4 + (c - 1) * 2));
+                        if (!l->nodes[node].ligature) // The first of equal length wins
+                            l->nodes[node].ligature = u16(lig);
+                    }
+                    addSet(l, g, root, 1);
+                }
+            break;
+        }
+    case 5:   // Context
+    case 6: { // Chained context
+            bool chained = l->type == 6;
+            if (format == 1)
+                compileRuleSets(shaper, l, st, st + 6, u16(st + 4), NULL,
+                    (const uint16_t*[3]){ NULL, NULL, NULL });
+            else if (format == 2 && !chained) {
+                const uint16_t *classes = denseTable(shaper, st + u16(st + 4), true);
+                compileRuleSets(shaper, l, st, st + 8, u16(st + 6), classes,
+                    (const uint16_t*[3]){ NULL, classes, NULL });
+            } else if (format == 2) {
+                const uint16_t *classes[3] = {
+                    denseTable(shaper, st + u16(st + 4), true),
+                    denseTable(shaper, st + u16(st + 6), true),
+                    denseTable(shaper, st + u16(st + 8), true),
+                };
+                compileRuleSets(shaper, l, st, st + 12, u16(st + 10), classes[1], classes);
+            } else if (format == 3) {
+                const uint8_t *p = st + 2;
+                int nbacktrack = 0, ninput, nlookahead = 0, nrecords;
+                const uint8_t *backtrack = p, *input, *lookahead = p;
+                if (chained) {
+                    nbacktrack = u16(p), backtrack = p + 2, p += 2 + nbacktrack * 2;
+                    ninput = u16(p), input = p + 2, p += 2 + ninput * 2;
+                    nlookahead = u16(p), lookahead = p + 2, p += 2 + nlookahead * 2;
+                    nrecords = u16(p), p += 2;
+                } else {
+                    ninput = u16(p), nrecords = u16(p + 2);
+                    input = p + 4, p += 4 + ninput * 2;
+                }
+                if (ninput < 1) break;
+
+                int match = l->nmatches;
+                addMatches(shaper, l, backtrack, nbacktrack, NULL, st);
+                addMatches(shaper, l, input + 2, ninput - 1, NULL, st);
+                addMatches(shaper, l, lookahead, nlookahead, NULL, st);
+                int rule = addRule(shaper, l, nbacktrack, ninput, nlookahead, p, nrecords);
+                l->rules[rule].match = match;
+
+                const uint16_t *cover = denseTable(shaper, st + u16(input), false);
+                for (int g = 0; g < nglyphs; g++)
+                    if (cover[g])
+                        addSet(l, g, rule, 1);
+            }
+            break;
+        }
+    case 8: { // Reverse chained single
+            const uint8_t *p = st + 4;
+            int nbacktrack = u16(p);
+            const uint8_t *backtrack = p + 2;
+            p += 2 + nbacktrack * 2;
+            int nlookahead = u16(p);
+            const uint8_t *lookahead = p + 2;
+            p += 2 + nlookahead * 2;
+            int nsubstitutes = u16(p);
+            const uint8_t *substitutes = p + 2;
+
+            int match = l->nmatches;
+            addMatches(shaper, l, backtrack, nbacktrack, NULL, st);
+            addMatches(shaper, l, lookahead, nlookahead, NULL, st);
+            int rule = addRule(shaper, l, nbacktrack, 1, nlookahead, NULL, 0);
+            l->rules[rule].match = match;
+
+            const uint16_t *cover = denseTable(shaper, st + u16(st + 2), false);
+            for (int g = 0; g < nglyphs; g++)
+                if (cover[g] && cover[g] <= nsubstitutes)
+                    addSet(l, g, rule, u16(substitutes + (cover[g] - 1) * 2));
+            break;
+        }
+    }
+}
+
+static void compileLookup(PgShaper *shaper, int index) {
+    if (index >= shaper->nlookups || shaper->lookups[index].type)
+        return;
+
+    const uint8_t *lookup = shaper->lookup_list + u16(shaper->lookup_list + 2 + index * 2);
+    int type = u16(lookup);
+    int nsubtables = u16(lookup + 4);
+
+    // Extension subtables all wrap the same type
+    if (type == 7 && nsubtables)
+        type = u16(lookup + u16(lookup + 6) + 2);
+
+    // Mark it first so lookups nested in themselves stop here
+    Lookup *l = &shaper->lookups[index];
+    l->type = type;
+    l->cover = calloc(MAX(shaper->nglyphs, 1), sizeof *l->cover);
+
+    for (int i = 0; i < nsubtables; i++) {
+        const uint8_t *st = lookup + u16(lookup + 6 + i * 2);
+        if (u16(lookup) == 7)
+            st += u32(st + 4);
+        compileSubtable(shaper, &shaper->lookups[index], st);
+    }
+}
+
+PgShaper *_pgNewShaper(const uint8_t *gsub, int nglyphs) {
+    PgShaper *shaper = calloc(1, sizeof *shaper);
+    shaper->gsub = gsub;
+    shaper->lookup_list = gsub + u16(gsub + 8);
+    shaper->nglyphs = nglyphs;
+    shaper->nlookups = u16(shaper->lookup_list);
+    shaper->lookups = calloc(MAX(shaper->nlookups, 1), sizeof *shaper->lookups);
+    return shaper;
+}
+void _pgShaperUseLookup(PgShaper *shaper, int index) {
+    if (index >= shaper->nlookups)
+        return;
+
+    // Keep the order sorted; features share lookups
+    int i;
+    for (i = 0; i < shaper->norder && shaper->order[i] < index; i++);
+    if (i < shaper->norder && shaper->order[i] == index)
+        return;
+    (void)PUSH(shaper->order, shaper->norder);
+    memmove(shaper->order + i + 1, shaper->order + i, (shaper->norder - i - 1) * sizeof *shaper->order);
+    shaper->order[i] = index;
+    compileLookup(shaper, index);
+}
+void _pgFreeShaper(PgShaper *shaper) {
+    if (!shaper)
+        return;
+    for (int i = 0; i < shaper->nlookups; i++) {
+        Lookup *l = &shaper->lookups[i];
+        free(l->cover);
+        free(l->sets);
+        free(l->glyphs);
+        free(l->nodes);
+        free(l->rules);
+        free(l->matches);
+        free(l->actions);
+    }
+    for (int i = 0; i < shaper->ntables; i++)
+        free(shaper->tables[i].dense);
+    free(shaper->lookups);
+    free(shaper->order);
+    free(shaper->tables);
+    free(shaper);
+}
+
+static void splice(Run *run, int at, int len, const uint16_t *with, int count) {
+    if (run->n - len + count > run->cap) {
+        run->cap = MAX(run->cap * 2, run->n - len + count);
+        REALLOC(run->glyphs, uint16_t, run->cap);
+    }
+    memmove(run->glyphs + at + count, run->glyphs + at + len, (run->n - at - len) * sizeof *run->glyphs);
+    memcpy(run->glyphs + at, with, count * sizeof *with);
+    run->n += count - len;
+}
+static bool matches(const Match *m, uint16_t g) {
+    return  !m->classes? g == m->value:
+            m->value < 0? m->classes[g] != 0:
+            m->classes[g] == m->value;
+}
+static bool matchRule(const PgShaper *shaper, const Lookup *l, const Rule *rule, const Run *run, int i) {
+    const Match *m = l->matches + rule->match;
+    if (i < rule->nbacktrack || i + rule->ninput + rule->nlookahead > run->n)
+        return false;
+    for (int k = 0; k < rule->nbacktrack; k++, m++)
+        if (run->glyphs[i - 1 - k] >= shaper->nglyphs || !matches(m, run->glyphs[i - 1 - k]))
+            return false;
+    for (int k = 1; k < rule->ninput + rule->nlookahead; k++, m++)
+        if (run->glyphs[i + k] >= shaper->nglyphs || !matches(m, run->glyphs[i + k]))
+            return false;
+    return true;
+}
+
+// Returns how many glyphs the substitution left at i, or 0 if none applied
+static int applyAt(const PgShaper *shaper, const Lookup *l, Run *run, int i, int depth) {
+    uint16_t g = run->glyphs[i];
+    if (g >= shaper->nglyphs || !l->cover || !l->cover[g])
+        return 0;
+
+    for (int s = l->cover[g] - 1; s >= 0; s = l->sets[s].next) {
+        const Set *set = &l->sets[s];
+        switch (l->type) {
+        case 1:
+        case 3:
+            run->glyphs[i] = l->glyphs[set->first];
+            return 1;
+        case 2:
+            splice(run, i, 1, l->glyphs + set->first, set->count);
+            return set->count;
+        case 4: {
+                // Follow the trie as far as the run goes; the longest ligature wins
+                const Node *node = &l->nodes[set->first];
+                uint16_t ligature = node->ligature;
+                int len = 1;
+                for (int j = i + 1; j < run->n && node->child >= 0; j++) {
+                    int child;
+                    for (child = node->child; child >= 0; child = l->nodes[child].sibling)
+                        if (l->nodes[child].glyph == run->glyphs[j])
+                            break;
+                    if (child < 0)
+                        break;
+                    node = &l->nodes[child];
+                    if (node->ligature)
+                        ligature = node->ligature, len = j - i + 1;
+                }
+                if (ligature) {
+                    splice(run, i, len, &ligature, 1);
+                    return 1;
+                }
+                break;
+            }
+        case 5:
+        case 6:
+            for (int r = set->first; r < set->first + set->count; r++) {
+                const Rule *rule = &l->rules[r];
+                if (!matchRule(shaper, l, rule, run, i))
+                    continue;
+
+                // Nested lookups apply once each at their input position
+                int len = rule->ninput;
+                for (int a = 0; a < rule->naction && depth < MAX_NESTING; a++) {
+                    const uint16_t *action = l->actions[rule->action + a];
+                    if (action[0] >= len || action[1] >= shaper->nlookups)
+                        continue;
+                    int before = run->n;
+                    applyAt(shaper, &shaper->lookups[action[1]], run, i + action[0], depth + 1);
+                    len += run->n - before;
+                }
+                return MAX(len, 1);
+            }
+            break;
+        case 8:
+            if (matchRule(shaper, l, &l->rules[set->first], run, i)) {
+                run->glyphs[i] = set->count;
+                return 1;
+            }
+            break;
+        }
+    }
+    return 0;
+}
+
+uint16_t *_pgShape(const PgShaper *shaper, uint16_t *glyphs, int *np) {
+    Run run = { glyphs, *np, *np };
+    for (int o = 0; o < shaper->norder; o++) {
+        const Lookup *l = &shaper->lookups[shaper->order[o]];
+        if (l->type == 8)
+            for (int i = run.n - 1; i >= 0; i--)
+                applyAt(shaper, l, &run, i, 0);
+        else
+            for (int i = 0; i < run.n; ) {
+                int n = applyAt(shaper, l, &run, i, 0);
+                i += n? n: 1;
+            }
+    }
+    *np = run.n;
+    return run.glyphs;
+}
@@ -0,0 +1,202 @@
+// Double-buffered canvases in shared memory that other processes read without copying
+#define _USE_MATH_DEFINES
+#include <assert.h>
+#include <ctype.h>
+#include <float.h>
+#include <emmintrin.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include <pg/pg.h>
+#include <pg/platform.h>
+#include "common.h"
+
+#define ALIGNMENT 64
+
+static size_t align(size_t n) {
+    return (n + ALIGNMENT - 1) & ~(size_t)(ALIGNMENT - 1);
+}
+
+// The front buffer stays where readers expect it, so a back buffer that no
+// longer fits moves to the space before it or just after it. The memory only
+// grows as far as that needs, so space the back buffer leaves is used again.
+static void _resize(Pg *g, int width, int height) {
+    PgSharedCanvas *sc = (PgSharedCanvas*)g;
+    PgSharedBuffer *back = &sc->header->buffers[sc->back];
+    size_t bytes = (size_t)width * height * sizeof(uint32_t);
+    if (bytes > back->capacity) {
+        const PgSharedBuffer *front = &sc->header->buffers[sc->back ^ 1];
+        size_t offset = align(sizeof(PgSharedHeader));
+        size_t capacity = front->offset - offset;
+        if (offset + bytes > front->offset) {
+            offset = align(front->offset + front->capacity);
+            size_t size = MAX(sc->size, offset + bytes);
+            if (size > sc->size) {
+                PgSharedHeader *header = size <= UINT32_MAX
+                    ? _pgGrowShared(sc->header, sc->size, size, true, sc->handle)
+                    : NULL;
+                if (!header) // Memory that can't grow keeps the canvas at its old size
+                    return;
+                sc->header = header;
+                sc->size = size;
+                STORE_RELEASE(&header->size, size);
+            }
+            capacity = sc->size - offset;
+        }
+        back = &sc->header->buffers[sc->back];
+        back->offset = offset;
+        back->capacity = capacity;
+    }
+    back->width = width;
+    back->height = height;
+    back->stride = width;
+    pgSetBitmapData(g, (uint32_t*)((uint8_t*)sc->header + back->offset), width, height, width);
+}
+static void _free(Pg *g) {
+    if (g) {
+        PgSharedCanvas *sc = (PgSharedCanvas*)g;
+        _pgUnmapShared(sc->header, sc->size, sc->handle);
+        free(g);
+    }
+}
+
+PgSharedCanvas pgDefaultSharedCanvas() {
+    PgSharedCanvas g;
+    g._ = pgDefaultBitmapCanvas();
+    g._._.free = _free;
+    g._._.resize = _resize;
+    g.header = NULL;
+    g.size = 0;
+    g.handle = -1;
+    g.back = 0;
+    return g;
+}
+// A NULL name makes anonymous memory, which another process reads by
+// passing its handle to pgOpenSharedCanvasHandle()
+Pg *pgNewSharedCanvas(const wchar_t *name, int width, int height) {
+    size_t bytes = (size_t)width * height * sizeof(uint32_t);
+    size_t size = align(sizeof(PgSharedHeader)) + 2 * align(bytes);
+    if (width < 0 || height < 0 || size > UINT32_MAX)
+        return NULL;
+
+    PgSharedCanvas *sc = NEW(PgSharedCanvas);
+    *sc = pgDefaultSharedCanvas();
+    sc->header = _pgMapShared(name, &size, true, &sc->handle);
+    if (!sc->header) {
+        free(sc);
+        return NULL;
+    }
+    sc->size = size;
+
+    PgSharedHeader *h = sc->header;
+    h->magic = PG_SHARED_MAGIC;
+    h->format = PG_FORMAT_ARGB32;
+    h->size = size;
+    h->front = 0;
+    h->frame = 0;
+    for (int i = 0; i < 2; i++)
+        h->buffers[i] = (PgSharedBuffer) {
+            .frame = 0,
+            .offset = align(sizeof(PgSharedHeader)) + i * align(bytes),
+            .capacity = bytes,
+        };
+    _resize(&sc->_._, width, height);
+    return &sc->_._;
+}
+
+// Publishes the frame just drawn and moves drawing to the other buffer,
+// whose pixels are from two frames back
+uint32_t pgPresentSharedCanvas(Pg *g) {
+    PgSharedCanvas *sc = (PgSharedCanvas*)g;
+    PgSharedHeader *h = sc->header;
+    uint32_t frame = h->frame + 1;
+    if (!frame) frame = 1; // 0 marks a buffer being drawn
+    STORE_RELEASE(&h->buffers[sc->back].frame, frame);
+    STORE_RELEASE(&h->front, sc->back);
+    STORE_RELEASE(&h->frame, frame);
+
+    // Readers must see the other buffer retired before anything draws over it
+    sc->back ^= 1;
+    STORE_RELEASE(&h->buffers[sc->back].frame, 0);
+    FENCE();
+    _resize(g, g->width, g->height);
+    return frame;
+}
+
+static PgSharedReader *openReader(const wchar_t *name, intptr_t handle) {
+    PgSharedReader reader = { NULL, 0, handle };
+    reader.header = _pgMapShared(name, &reader.size, false, &reader.handle);
+    if (!reader.header)
+        return NULL;
+    if (reader.size < sizeof(PgSharedHeader) ||
+        reader.header->magic != PG_SHARED_MAGIC ||
+        reader.header->format != PG_FORMAT_ARGB32)
+    {
+        _pgUnmapShared(reader.header, reader.size, reader.handle);
+        return NULL;
+    }
+    PgSharedReader *r = NEW(PgSharedReader);
+    *r = reader;
+    return r;
+}
+PgSharedReader *pgOpenSharedCanvas(const wchar_t *name) {
+    return name? openReader(name, -1): NULL;
+}
+// Opens anonymous memory from the writer's handle: a file descriptor received
+// over a socket or inherited, or a section handle duplicated into this process.
+// The reader maps its own copy, so the caller still closes the one it passed.
+PgSharedReader *pgOpenSharedCanvasHandle(intptr_t handle) {
+    return openReader(NULL, handle);
+}
+// Finds the last presented frame; false if there is none yet
+bool pgReadSharedFrame(PgSharedReader *reader, PgSharedFrame *frame) {
+    for (;;) {
+        PgSharedHeader *h = reader->header;
+        size_t size = LOAD_ACQUIRE(&h->size);
+        if (size > reader->size) {
+            h = _pgGrowShared(reader->header, reader->size, size, false, reader->handle);
+            if (!h)
+                return false;
+            reader->header = h;
+            reader->size = size;
+        }
+
+        int front = LOAD_ACQUIRE(&h->front) & 1;
+        const PgSharedBuffer *buffer = &h->buffers[front];
+        uint32_t number = LOAD_ACQUIRE(&buffer->frame);
+        if (!number) { // Nothing presented yet, or the front moved on while we looked
+            if (!LOAD_ACQUIRE(&h->frame))
+                return false;
+            continue;
+        }
+        *frame = (PgSharedFrame) {
+            (const uint32_t*)((const uint8_t*)h + buffer->offset),
+            buffer->width,
+            buffer->height,
+            buffer->stride,
+            number,
+            front,
+        };
+
+        // A torn read of the layout is thrown away rather than trusted
+        size_t end = (const uint8_t*)frame->data - (const uint8_t*)h +
+            (size_t)frame->stride * frame->height * sizeof(uint32_t);
+        if (pgSharedFrameIntact(reader, frame) && end <= reader->size)
+            return true;
+    }
+}
+// Whether the writer has started drawing over a frame since it was read
+bool pgSharedFrameIntact(const PgSharedReader *reader, const PgSharedFrame *frame) {
+    FENCE();
+    return LOAD_ACQUIRE(&reader->header->buffers[frame->buffer].frame) == frame->frame;
+}
+void pgCloseSharedCanvas(PgSharedReader *reader) {
+    if (reader) {
+        _pgUnmapShared(reader->header, reader->size, reader->handle);
+        free(reader);
+    }
+}
@@ -0,0 +1,99 @@
+// Stage timings recorded as Chrome trace events (chrome://tracing, Perfetto)
+#define _USE_MATH_DEFINES
+#include <assert.h>
+#include <ctype.h>
+#include <float.h>
+#include <emmintrin.h>
+#include <math.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+#include <pg/pg.h>
+#include <pg/platform.h>
+#include "common.h"
+
+PgTrace *pgNewTrace(void) {
+    PgTrace *trace = NEW(PgTrace);
+    *trace = (PgTrace) { .origin = _pgTime() };
+    return trace;
+}
+void pgFreeTrace(PgTrace *trace) {
+    if (trace) {
+        free(trace->events);
+        free(trace);
+    }
+}
+
+// Ends an event begun at start; canvases on several threads may share the trace
+void _pgTraceEvent(const PgStats *stats, const char *name, double start, const char *arg, double value) {
+    PgTrace *trace = stats->trace;
+    double now = _pgTime();
+    _pgLock(&trace->lock);
+    if (trace->nevents == trace->cap) {
+        trace->cap = trace->cap? trace->cap * 2: 1024;
+        REALLOC(trace->events, PgTraceEvent, trace->cap);
+    }
+    trace->events[trace->nevents++] = (PgTraceEvent) {
+        name, start, now - start, stats->thread, arg, value,
+    };
+    _pgUnlock(&trace->lock);
+}
+
+typedef struct {
+    char    *data;
+    size_t  len;
+    size_t  cap;
+} Buffer;
+
+static void print(Buffer *b, const char *format, ...) {
+    va_list args;
+    for (;;) {
+        va_start(args, format);
+        int n = vsnprintf(b->data + b->len, b->cap - b->len, format, args);
+        va_end(args);
+        if (n < 0)
+            return;
+        if (b->len + n < b->cap) {
+            b->len += n;
+            return;
+        }
+        b->cap = MAX(b->cap * 2, b->len + n + 1);
+        REALLOC(b->data, char, b->cap);
+    }
+}
+
+// At most three decimal places, written without printf's floats, which follow the
+// host's LC_NUMERIC and could give JSON a decimal comma
+static void printFixed(Buffer *b, double x) {
+    long long thousandths = llround(fabs(x) * 1000);
+    print(b, "%s%lld", x < 0 && thousandths? "-": "", thousandths / 1000);
+    if (thousandths % 1000)
+        print(b, ".%03lld", thousandths % 1000);
+}
+
+bool pgWriteTrace(const PgTrace *trace, const wchar_t *filename) {
+    Buffer b = { NEW_ARRAY(char, 4096), 0, 4096 };
+    print(&b, "{\"traceEvents\":[\n");
+    for (int i = 0; i < trace->nevents; i++) {
+        const PgTraceEvent *e = &trace->events[i];
+        print(&b, "{\"name\":\"%s\",\"cat\":\"pg\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":",
+            e->name, e->thread);
+        printFixed(&b, (e->start - trace->origin) * 1e6);
+        print(&b, ",\"dur\":");
+        printFixed(&b, e->duration * 1e6);
+        if (e->arg) {
+            print(&b, ",\"args\":{\"%s\":", e->arg);
+            printFixed(&b, e->value);
+            print(&b, "}");
+        }
+        print(&b, "}%s\n", i + 1 < trace->nevents? ",": "");
+    }
+    print(&b, "],\"displayTimeUnit\":\"ns\"}\n");
+    bool ok = _pgWriteFile(filename, b.data, b.len);
+    free(b.data);
+    return ok;
+}
@@ -0,0 +1,200 @@
+// Batch renderer: draws a file of jobs across all cores and reports throughput
+#define _GNU_SOURCE
+#include <locale.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+
+#include <pg/pg.h>
+#include <pg/platform.h>
+#include <pg/common.h>
+
+// One job per line; blank lines and lines starting with # are skipped:
+//   output WIDTHxHEIGHT svg SCALE path-data
+//   output WIDTHxHEIGHT text SIZE utf-8 text
+// Outputs ending in .raw are written as raw canvas pixels, anything else as PPM.
+void usage(void) {
+    fprintf(stderr,
+        "usage: batch [-j threads] [-f family] [-c color] [-b background] [-r repeat] jobs.txt\n"
+        "  jobs.txt lines: output WIDTHxHEIGHT svg SCALE path-data\n"
+        "                  output WIDTHxHEIGHT text SIZE text\n");
+    exit(2);
+}
+
+void *load_file(const char *filename) {
+    FILE *file = strcmp(filename, "-")? fopen(filename, "rb"): stdin;
+    if (!file) return NULL;
+    size_t size = 0, cap = 1 << 16;
+    char *data = malloc(cap + 1);
+    for (size_t n; (n = fread(data + size, 1, cap - size, file)) > 0; ) {
+        size += n;
+        if (size == cap)
+            data = realloc(data, (cap *= 2) + 1);
+    }
+    data[size] = 0;
+    if (file != stdin)
+        fclose(file);
+    return data;
+}
+
+wchar_t *widen(const char *s) {
+    size_t n = mbstowcs(NULL, s, 0);
+    if (n == (size_t)-1)
+        return NULL;
+    wchar_t *w = NEW_ARRAY(wchar_t, n + 1);
+    mbstowcs(w, s, n + 1);
+    return w;
+}
+
+// Splits off the next space-delimited word, leaving *line at the rest
+char *next_word(char **line) {
+    char *s = *line;
+    while (*s == ' ' || *s == '\t') s++;
+    char *word = s;
+    while (*s && *s != ' ' && *s != '\t') s++;
+    if (*s) *s++ = 0;
+    while (*s == ' ' || *s == '\t') s++;
+    *line = s;
+    return *word? word: NULL;
+}
+
+bool parse_job(PgRenderJob *job, char *line, int number) {
+    char *output = next_word(&line);
+    char *size = next_word(&line);
+    char *kind = next_word(&line);
+    char *number_arg = next_word(&line);
+    char *end;
+    if (!output || !size || !kind || !number_arg || !*line)
+        goto bad;
+
+    job->width = strtol(size, &end, 10);
+    if (*end != 'x') goto bad;
+    job->height = strtol(end + 1, &end, 10);
+    if (*end || job->width <= 0 || job->height <= 0) goto bad;
+
+    float value = strtof(number_arg, &end);
+    if (*end || value <= 0) goto bad;
+    if (!strcmp(kind, "svg")) {
+        pgScaleMatrix(&job->matrix, value, value);
+        job->svg = line;
+    } else if (!strcmp(kind, "text")) {
+        job->size = value;
+        job->text = line;
+    } else
+        goto bad;
+
+    size_t len = strlen(output);
+    job->format = len > 4 && !strcmp(output + len - 4, ".raw")? PG_IMAGE_RAW: PG_IMAGE_PPM;
+    job->output = widen(output);
+    return job->output != NULL;
+bad:
+    fprintf(stderr, "batch: line %d: bad job\n", number);
+    return false;
+}
+
+int main(int argc, char **argv) {
+    int nthreads = 0;
+    int repeat = 1;
+    uint32_t color = 0xff000000;
+    uint32_t background = 0xffffffff;
+    const char *family = "DejaVu Sans";
+    const char *filename = NULL;
+
+    // Only file and family names need the user's locale; job numbers keep their points
+    setlocale(LC_CTYPE, "");
+    for (int i = 1; i < argc; i++)
+        if (!strcmp(argv[i], "-j") && i + 1 < argc)
+            nthreads = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-f") && i + 1 < argc)
+            family = argv[++i];
+        else if (!strcmp(argv[i], "-c") && i + 1 < argc)
+            color = strtoul(argv[++i], NULL, 16);
+        else if (!strcmp(argv[i], "-b") && i + 1 < argc)
+            background = strtoul(argv[++i], NULL, 16);
+        else if (!strcmp(argv[i], "-r") && i + 1 < argc)
+            repeat = atoi(argv[++i]);
+        else if (argv[i][0] == '-' && argv[i][1])
+            usage();
+        else
+            filename = argv[i];
+    if (!filename || repeat < 1)
+        usage();
+
+    char *text = load_file(filename);
+    if (!text) {
+        perror(filename);
+        return 2;
+    }
+
+    // Jobs point into the loaded text, so lines are cut in place
+    int cap = 64, njobs = 0, number = 0;
+    PgRenderJob *jobs = NEW_ARRAY(PgRenderJob, cap);
+    bool has_text = false;
+    for (char *line = text, *next; line; line = next) {
+        next = strchr(line, '\n');
+        if (next) *next++ = 0;
+        number++;
+        size_t len = strlen(line);
+        if (len && line[len - 1] == '\r')
+            line[len - 1] = 0;
+        while (*line == ' ' || *line == '\t') line++;
+        if (!*line || *line == '#')
+            continue;
+
+        if (njobs == cap)
+            REALLOC(jobs, PgRenderJob, cap *= 2);
+        jobs[njobs] = pgDefaultRenderJob();
+        jobs[njobs].color = color;
+        jobs[njobs].background = background;
+        if (!parse_job(&jobs[njobs], line, number))
+            return 2;
+        has_text |= jobs[njobs].text != NULL;
+        njobs++;
+    }
+
+    // Every worker draws from the same face
+    PgFont *font = NULL;
+    if (has_text) {
+        wchar_t *wide = widen(family);
+        font = wide? pgOpenFont(wide, 400, false, 0): NULL;
+        free(wide);
+        if (!font) {
+            fprintf(stderr, "batch: %s not found\n", family);
+            return 2;
+        }
+        for (int i = 0; i < njobs; i++)
+            jobs[i].font = font;
+    }
+
+    int ok = 0;
+    double start = _pgTime();
+    for (int i = 0; i < repeat; i++)
+        ok = pgRenderBatch(jobs, njobs, nthreads);
+    double seconds = _pgTime() - start;
+
+    double pixels = 0;
+    for (int i = 0; i < njobs; i++) {
+        if (!jobs[i].ok)
+            fprintf(stderr, "batch: failed %ls\n", jobs[i].output);
+        pixels += (double)jobs[i].width * jobs[i].height;
+    }
+    pixels *= repeat;
+    fprintf(stderr, "%d jobs, %d failed, %d threads: %.3f s, %.1f jobs/s, %.1f Mpixels/s\n",
+        njobs * repeat, njobs - ok,
+        nthreads > 0? MIN(nthreads, njobs): MIN(_pgGetProcessorCount(), njobs),
+        seconds,
+        seconds > 0? njobs * repeat / seconds: 0,
+        seconds > 0? pixels / seconds / 1e6: 0);
+
+    for (int i = 0; i < njobs; i++)
+        free((wchar_t*)jobs[i].output);
+    free(jobs);
+    free(text);
+    if (font)
+        $(free, font);
+    return ok == njobs? 0: 1;
+}
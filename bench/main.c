@@ -0,0 +1,510 @@
+// Headless rendering benchmark: fixed scenes timed per stage and reported as JSON
+#define _GNU_SOURCE
+#define _USE_MATH_DEFINES
+#include <locale.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+
+#include <pg/pg.h>
+#include <pg/platform.h>
+#include <pg/common.h>
+#include "../demo/test.h"
+
+#define WIDTH   1024
+#define HEIGHT  768
+#define MAX_ICONS 256
+
+typedef struct {
+    Pg          *g;
+    PgFont      *font;
+    PgLayout    *layout;
+    char        *alice;
+    PgPath      *icons[MAX_ICONS];
+    int         nicons;
+    Pg          *image;
+    PgPath      **shapes;
+    int         nshapes;
+    uint32_t    *colors;
+    uint32_t    seed;
+    PgTrace     *trace;
+    int         scene;
+} Bench;
+
+typedef struct {
+    const char  *name;
+    bool        text;
+    void        (*setup)(Bench *b);
+    void        (*run)(Bench *b);
+} Scene;
+
+typedef struct {
+    const char  *name;
+    double      ms;
+    PgStats     stats;
+} Result;
+
+void *load_file(const char *filename) {
+    FILE *file = fopen(filename, "rb");
+    if (!file) return NULL;
+    fseek(file, 0, SEEK_END);
+    int size = ftell(file);
+    rewind(file);
+    char *data = malloc(size + 1);
+    int read = fread(data, 1, size, file);
+    data[read > 0? read: 0] = 0;
+    fclose(file);
+    return data;
+}
+
+// Scenes draw the same pixels on every machine, so randomness comes from a fixed LCG
+float random_float(Bench *b, float lo, float hi) {
+    b->seed = b->seed * 1664525 + 1013904223;
+    return lo + (hi - lo) * (b->seed >> 8) / 16777216.f;
+}
+void free_shapes(Bench *b) {
+    for (int i = 0; i < b->nshapes; i++)
+        $(free, b->shapes[i]);
+    free(b->shapes);
+    free(b->colors);
+    b->shapes = NULL;
+    b->colors = NULL;
+    b->nshapes = 0;
+}
+void new_shapes(Bench *b, int n) {
+    free_shapes(b);
+    b->seed = 1;
+    b->nshapes = n;
+    b->shapes = NEW_ARRAY(PgPath*, n);
+    b->colors = NEW_ARRAY(uint32_t, n);
+    for (int i = 0; i < n; i++) {
+        b->shapes[i] = pgNewPath();
+        b->colors[i] = 0x80000000 | ((uint32_t)random_float(b, 0, 0xffffff) & 0xffffff);
+    }
+}
+
+// The test icons, parsed once and drawn at several angles
+void svg_setup(Bench *b) {
+    if (!b->nicons)
+        for ( ; TestSVG[b->nicons] && b->nicons < MAX_ICONS; b->nicons++)
+            b->icons[b->nicons] = pgInterpretSvgPath(TestSVG[b->nicons], NULL);
+}
+void svg_run(Bench *b) {
+    for (int angle = 0; angle < 360; angle += 45) {
+        PgMatrix m = PgIdentityMatrix;
+        pgTranslateMatrix(&m, -396/2, -468/2);
+        pgRotateMatrix(&m, angle * M_PI / 180);
+        pgTranslateMatrix(&m, WIDTH / 2, HEIGHT / 2);
+        for (int i = 0; i < b->nicons; i++)
+            $(fillTransformed, b->g, b->icons[i], &m, 0xff606050);
+    }
+}
+
+// Paragraph layout of the whole book, with nothing drawn
+void alice_setup(Bench *b) {
+    if (b->alice) return;
+    b->alice = load_file("../demo/alice.txt");
+    if (!b->alice) return;
+    for (char *c = b->alice; *c; c++)
+        if (c[0] == '\n' && c > b->alice && c[-1] != '\n' && c[1] && c[1] != '\n')
+            c[0] = ' ';
+}
+void layout_run(Bench *b) {
+    if (!b->alice) return;
+    PgLayout *layout = pgNewLayout(b->font, 500);
+    $(setText, layout, b->alice, -1);
+    $(update, layout);
+    $(free, layout);
+}
+
+// Pages of the laid out book drawn one after another
+void alice_draw_setup(Bench *b) {
+    alice_setup(b);
+    if (!b->alice || b->layout) return;
+    b->layout = pgNewLayout(b->font, 500);
+    $(setText, b->layout, b->alice, -1);
+    $(update, b->layout);
+}
+void alice_draw_run(Bench *b) {
+    if (!b->layout) return;
+    for (float y = 0; y < b->layout->height && y < HEIGHT * 8; y += HEIGHT)
+        $(fill, b->layout, b->g, pgPt(WIDTH / 2 - 250, -y), 0xff606050);
+}
+
+// Every glyph in the font, a page at a time
+void glyph_run(Bench *b) {
+    const float size = 24;
+    unsigned n = ((PgOpenTypeFace*)b->font->face)->nglyphs;
+    PgFont *font = $(sized, b->font, size, 0);
+    font->stats = b->font->stats;
+    for (unsigned g = 0; g < n; ) {
+        for (float y = 0; y < HEIGHT && g < n; y += size)
+        for (float x = 0; x < WIDTH && g < n; x += size)
+            $(fillGlyph, b->g, font, pgPt(x, y), g++, 0xff606050);
+    }
+    $(free, font);
+}
+
+// The icons drawn once into an image, then tiled, shrunk to thumbnails and spun
+void image_setup(Bench *b) {
+    svg_setup(b);
+    if (b->image) return;
+    b->image = pgNewBitmapCanvas(256, 256);
+    $(clear, b->image, 0xfff8f8f0);
+    PgMatrix m = PgIdentityMatrix;
+    pgScaleMatrix(&m, 256 / 468.f, 256 / 468.f);
+    for (int i = 0; i < b->nicons; i++)
+        $(fillTransformed, b->image, b->icons[i], &m, 0xff606050);
+}
+void image_run(Bench *b) {
+    PgRect all = pgRect(pgPt(0, 0), pgPt(256, 256));
+    for (int y = 0; y < HEIGHT; y += 256)
+        for (int x = 0; x < WIDTH; x += 256) {
+            PgMatrix m = PgIdentityMatrix;
+            pgTranslateMatrix(&m, x, y);
+            $(drawImage, b->g, b->image, all, &m, 1, PG_FILTER_NEAREST);
+        }
+    for (int y = 0; y < HEIGHT; y += 80)
+        for (int x = 0; x < WIDTH; x += 80) {
+            PgMatrix m = PgIdentityMatrix;
+            pgScaleMatrix(&m, .3f, .3f);
+            pgTranslateMatrix(&m, x, y);
+            $(drawImage, b->g, b->image, all, &m, .8f, PG_FILTER_BOX);
+        }
+    for (int angle = 0; angle < 360; angle += 45) {
+        PgMatrix m = PgIdentityMatrix;
+        pgTranslateMatrix(&m, -128, -128);
+        pgRotateMatrix(&m, angle * M_PI / 180);
+        pgScaleMatrix(&m, 1.5f, 1.5f);
+        pgTranslateMatrix(&m, WIDTH / 2, HEIGHT / 2);
+        $(drawImage, b->g, b->image, all, &m, .5f, PG_FILTER_BILINEAR);
+    }
+}
+
+// Large self-intersecting polygons covering most of the canvas
+void polygon_setup(Bench *b) {
+    new_shapes(b, 16);
+    for (int i = 0; i < b->nshapes; i++) {
+        PgPt points[64];
+        for (int j = 0; j < 64; j++)
+            points[j] = pgPt(random_float(b, -64, WIDTH + 64), random_float(b, -64, HEIGHT + 64));
+        $(lines, b->shapes[i], NULL, 64, points);
+        $(close, b->shapes[i]);
+    }
+}
+// Thin lines in every direction, one path each as a stroker would make them
+void line_setup(Bench *b) {
+    new_shapes(b, 4000);
+    for (int i = 0; i < b->nshapes; i++) {
+        PgPt a = pgPt(random_float(b, 0, WIDTH), random_float(b, 0, HEIGHT));
+        float angle = random_float(b, 0, 2 * M_PI);
+        float length = random_float(b, 8, 256);
+        float half = random_float(b, .25, 1);
+        PgPt d = pgPt(cosf(angle) * length, sinf(angle) * length);
+        PgPt n = pgPt(-sinf(angle) * half, cosf(angle) * half);
+        PgPt points[] = {
+            pgPt(a.x + n.x, a.y + n.y),
+            pgPt(a.x + d.x + n.x, a.y + d.y + n.y),
+            pgPt(a.x + d.x - n.x, a.y + d.y - n.y),
+            pgPt(a.x - n.x, a.y - n.y),
+        };
+        $(lines, b->shapes[i], NULL, 4, points);
+        $(close, b->shapes[i]);
+    }
+}
+void shapes_run(Bench *b) {
+    for (int i = 0; i < b->nshapes; i++)
+        $(fill, b->g, b->shapes[i], b->colors[i]);
+}
+
+// Cards with soft shadows, shadowed headings and a frosted panel
+void shadow_setup(Bench *b) {
+    new_shapes(b, 1);
+    PgPath *card = b->shapes[0];
+    $(move, card, NULL, pgPt(8, 0));
+    $(line, card, NULL, pgPt(152, 0));
+    $(quadratic, card, NULL, pgPt(160, 0), pgPt(160, 8));
+    $(line, card, NULL, pgPt(160, 92));
+    $(quadratic, card, NULL, pgPt(160, 100), pgPt(152, 100));
+    $(line, card, NULL, pgPt(8, 100));
+    $(quadratic, card, NULL, pgPt(0, 100), pgPt(0, 92));
+    $(line, card, NULL, pgPt(0, 8));
+    $(quadratic, card, NULL, pgPt(0, 0), pgPt(8, 0));
+    $(close, card);
+    card->cacheShadow = true;
+}
+void shadow_run(Bench *b) {
+    PgPath *card = b->shapes[0];
+    for (int y = 16; y + 100 <= HEIGHT; y += 128)
+        for (int x = 16; x + 160 <= WIDTH; x += 192) {
+            PgMatrix m = PgIdentityMatrix;
+            pgTranslateMatrix(&m, x, y);
+            pgFillShadow(b->g, card, &m, pgPt(0, 4), 6, 0x60000000);
+            $(fillTransformed, b->g, card, &m, 0xffffffff);
+        }
+    PgFont *font = $(sized, b->font, 32, 0);
+    font->stats = b->font->stats;
+    for (int y = 40; y < HEIGHT; y += 128) {
+        pgFillStringShadow(b->g, font, pgPt(24, y), L"Soft shadows", 12, pgPt(2, 2), 2, 0x80000000);
+        $(fillString, b->g, font, pgPt(24, y), L"Soft shadows", 12, 0xff204080);
+    }
+    $(free, font);
+    pgBlur(b->g, pgRect(pgPt(WIDTH / 4, HEIGHT / 4), pgPt(WIDTH * 3 / 4, HEIGHT * 3 / 4)), 12);
+}
+
+static const Scene Scenes[] = {
+    { "svg", false, svg_setup, svg_run },
+    { "layout", true, alice_setup, layout_run },
+    { "alice", true, alice_draw_setup, alice_draw_run },
+    { "glyphs", true, NULL, glyph_run },
+    { "polygons", false, polygon_setup, shapes_run },
+    { "lines", false, line_setup, shapes_run },
+    { "images", false, image_setup, image_run },
+    { "shadows", true, shadow_setup, shadow_run },
+};
+#define NSCENES (int)(sizeof Scenes / sizeof *Scenes)
+
+Result run_scene(Bench *b, const Scene *scene, int rounds) {
+    Result result = { scene->name };
+    if (scene->setup)
+        scene->setup(b);
+
+    // One untimed round warms caches and builds lazy font tables
+    $(clear, b->g, 0xffe0e0d0);
+    scene->run(b);
+
+    // Each scene is its own row in the trace
+    result.stats.trace = b->trace;
+    result.stats.thread = b->scene++;
+    b->g->stats = &result.stats;
+    if (b->font)
+        b->font->stats = &result.stats;
+    for (int i = 0; i < rounds; i++) {
+        $(clear, b->g, 0xffe0e0d0);
+        double start = _pgTime();
+        scene->run(b);
+        result.ms += (_pgTime() - start) * 1e3;
+    }
+    b->g->stats = NULL;
+    if (b->font)
+        b->font->stats = NULL;
+
+    // Report everything per round
+    result.ms /= rounds;
+    result.stats.flatten /= rounds;
+    result.stats.sort /= rounds;
+    result.stats.scan /= rounds;
+    result.stats.blend /= rounds;
+    result.stats.paths /= rounds;
+    result.stats.segments /= rounds;
+    result.stats.line_segments /= rounds;
+    result.stats.quadratic_segments /= rounds;
+    result.stats.cubic_segments /= rounds;
+    result.stats.edges /= rounds;
+    result.stats.pixels /= rounds;
+    result.stats.glyphs /= rounds;
+    result.stats.images /= rounds;
+    result.stats.glyph_paths /= rounds;
+    result.stats.cmap_lookups /= rounds;
+    result.stats.substitutions /= rounds;
+    result.stats.allocations /= rounds;
+    return result;
+}
+
+void write_json(FILE *file, const Result *results, int n, int rounds) {
+    fprintf(file, "{\n  \"rounds\": %d,\n  \"scenes\": [\n", rounds);
+    for (int i = 0; i < n; i++) {
+        const Result *r = &results[i];
+        const PgStats *s = &r->stats;
+        double seconds = r->ms / 1e3;
+        double staged = (s->flatten + s->sort + s->scan + s->blend) * 1e3;
+        fprintf(file,
+            "    { \"name\": \"%s\", \"ms\": %.4f,\n"
+            "      \"paths\": %lld, \"segments\": %lld, \"pixels\": %lld, \"glyphs\": %lld,\n"
+            "      \"line_segments\": %lld, \"quadratic_segments\": %lld, \"cubic_segments\": %lld, \"edges\": %lld,\n"
+            "      \"glyph_paths\": %lld, \"cmap_lookups\": %lld, \"substitutions\": %lld, \"allocations\": %lld, \"images\": %lld,\n"
+            "      \"ns_per_pixel\": %.3f, \"glyphs_per_s\": %.0f, \"segments_per_s\": %.0f,\n"
+            "      \"stages\": { \"flatten\": %.4f, \"sort\": %.4f, \"scan\": %.4f, \"blend\": %.4f, \"other\": %.4f } }%s\n",
+            r->name, r->ms,
+            (long long)s->paths, (long long)s->segments, (long long)s->pixels, (long long)s->glyphs,
+            (long long)s->line_segments, (long long)s->quadratic_segments, (long long)s->cubic_segments,
+            (long long)s->edges, (long long)s->glyph_paths, (long long)s->cmap_lookups,
+            (long long)s->substitutions, (long long)s->allocations, (long long)s->images,
+            s->pixels? r->ms * 1e6 / s->pixels: 0,
+            seconds > 0? s->glyphs / seconds: 0,
+            seconds > 0? s->segments / seconds: 0,
+            s->flatten * 1e3, s->sort * 1e3, s->scan * 1e3, s->blend * 1e3, MAX(r->ms - staged, 0),
+            i + 1 < n? ",": "");
+    }
+    fprintf(file, "  ]\n}\n");
+}
+
+// Reads a number from the baseline scene object, which runs up to the next scene
+double json_field(const char *object, const char *key) {
+    char pattern[64];
+    snprintf(pattern, sizeof pattern, "\"%s\":", key);
+    const char *end = strstr(object + 1, "\"name\":");
+    const char *at = strstr(object, pattern);
+    if (!at || (end && at > end))
+        return NAN;
+    return strtod(at + strlen(pattern), NULL);
+}
+const char *json_scene(const char *json, const char *name) {
+    char pattern[64];
+    snprintf(pattern, sizeof pattern, "\"name\": \"%s\"", name);
+    return strstr(json, pattern);
+}
+
+// Prints changes against the baseline and counts scenes slower than the tolerance
+int compare(const char *json, const Result *results, int n, double tolerance) {
+    static const char *stages[] = { "flatten", "sort", "scan", "blend" };
+    int regressions = 0;
+    fprintf(stderr, "\n%-10s %10s %10s %8s", "scene", "base ms", "ms", "change");
+    for (int i = 0; i < 4; i++)
+        fprintf(stderr, " %8s", stages[i]);
+    fprintf(stderr, "\n");
+    for (int i = 0; i < n; i++) {
+        const char *object = json_scene(json, results[i].name);
+        double base = object? json_field(object, "ms"): NAN;
+        if (!(base > 0)) {
+            fprintf(stderr, "%-10s %10s %10.3f\n", results[i].name, "-", results[i].ms);
+            continue;
+        }
+        double change = (results[i].ms - base) / base * 100;
+        fprintf(stderr, "%-10s %10.3f %10.3f %+7.1f%%", results[i].name, base, results[i].ms, change);
+
+        double now[] = {
+            results[i].stats.flatten, results[i].stats.sort,
+            results[i].stats.scan, results[i].stats.blend,
+        };
+        for (int j = 0; j < 4; j++) {
+            double stage = json_field(object, stages[j]);
+            if (stage > 0)
+                fprintf(stderr, " %+7.1f%%", (now[j] * 1e3 - stage) / stage * 100);
+            else
+                fprintf(stderr, " %8s", "-");
+        }
+        if (change > tolerance) {
+            fprintf(stderr, "  slower");
+            regressions++;
+        }
+        fprintf(stderr, "\n");
+    }
+    return regressions;
+}
+
+void usage(void) {
+    fprintf(stderr,
+        "usage: bench [-n rounds] [-f family] [-o output.json] [-b baseline.json] [-t percent] [-T trace.json] [scene...]\n"
+        "scenes:");
+    for (int i = 0; i < NSCENES; i++)
+        fprintf(stderr, " %s", Scenes[i].name);
+    fprintf(stderr, "\n");
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    int rounds = 10;
+    double tolerance = 10;
+    const char *family = "DejaVu Sans";
+    const char *output = NULL;
+    const char *baseline = NULL;
+    const char *trace = NULL;
+    bool chosen[NSCENES] = { false };
+    bool any = false;
+
+    // Only family names need the user's locale; JSON numbers must keep their points
+    setlocale(LC_CTYPE, "");
+    for (int i = 1; i < argc; i++)
+        if (!strcmp(argv[i], "-n") && i + 1 < argc)
+            rounds = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-f") && i + 1 < argc)
+            family = argv[++i];
+        else if (!strcmp(argv[i], "-o") && i + 1 < argc)
+            output = argv[++i];
+        else if (!strcmp(argv[i], "-b") && i + 1 < argc)
+            baseline = argv[++i];
+        else if (!strcmp(argv[i], "-T") && i + 1 < argc)
+            trace = argv[++i];
+        else if (!strcmp(argv[i], "-t") && i + 1 < argc)
+            tolerance = atof(argv[++i]);
+        else if (argv[i][0] == '-')
+            usage();
+        else {
+            int j = 0;
+            while (j < NSCENES && strcmp(argv[i], Scenes[j].name)) j++;
+            if (j == NSCENES)
+                usage();
+            chosen[j] = any = true;
+        }
+
+    if (rounds < 1)
+        usage();
+
+    Bench b = { pgNewBitmapCanvas(WIDTH, HEIGHT) };
+    if (trace)
+        b.trace = pgNewTrace();
+    wchar_t wide[256];
+    if (mbstowcs(wide, family, 256) < 256)
+        b.font = pgOpenFont(wide, 400, false, 0);
+    if (b.font)
+        $(scale, b.font, 15, 0);
+    else
+        fprintf(stderr, "bench: %s not found, skipping text scenes\n", family);
+
+    Result results[NSCENES];
+    int n = 0;
+    for (int i = 0; i < NSCENES; i++) {
+        if ((any && !chosen[i]) || (Scenes[i].text && !b.font))
+            continue;
+        results[n] = run_scene(&b, &Scenes[i], rounds);
+        fprintf(stderr, "%-10s %10.3f ms\n", results[n].name, results[n].ms);
+        n++;
+    }
+
+    FILE *file = output? fopen(output, "w"): stdout;
+    if (!file) {
+        perror(output);
+        return 2;
+    }
+    write_json(file, results, n, rounds);
+    if (output)
+        fclose(file);
+
+    if (trace) {
+        wchar_t *wide = NEW_ARRAY(wchar_t, strlen(trace) + 1);
+        mbstowcs(wide, trace, strlen(trace) + 1);
+        if (!pgWriteTrace(b.trace, wide))
+            perror(trace);
+        free(wide);
+        pgFreeTrace(b.trace);
+    }
+
+    int regressions = 0;
+    if (baseline) {
+        char *json = load_file(baseline);
+        if (!json) {
+            perror(baseline);
+            return 2;
+        }
+        regressions = compare(json, results, n, tolerance);
+        free(json);
+    }
+
+    free_shapes(&b);
+    if (b.image)
+        $(free, b.image);
+    for (int i = 0; i < b.nicons; i++)
+        $(free, b.icons[i]);
+    if (b.layout)
+        $(free, b.layout);
+    free(b.alice);
+    if (b.font)
+        $(free, b.font);
+    $(free, b.g);
+    return regressions? 1: 0;
+}
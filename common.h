@@ -17,10 +17,51 @@ static float fraction(float x) {
 #define MIN(X,Y) ((X) < (Y)? (X): (Y))
 #define MAX(X,Y) ((X) > (Y)? (X): (Y))
 
-#define $(ACTION, SELF, ...) ((SELF)->ACTION)((SELF),__VA_ARGS__)
-#define $$(ACTION, SELF, ...) ((SELF)->_.ACTION)(&(SELF)->_,__VA_ARGS__)
-#define _$(ACTION, SELF, ...) ((SELF) && (SELF)->ACTION? ((SELF)->ACTION)((SELF),__VA_ARGS__): 0)
-#define _$$(ACTION, SELF, ...) ((SELF) && (SELF)->ACTION? ((SELF->_)->ACTION)(&(SELF)->_,__VA_ARGS__): 0)
+#ifdef _MSC_VER
+    #define $(ACTION, SELF, ...) ((SELF)->ACTION)((SELF),__VA_ARGS__)
+    #define $$(ACTION, SELF, ...) ((SELF)->_.ACTION)(&(SELF)->_,__VA_ARGS__)
+    #define _$(ACTION, SELF, ...) ((SELF) && (SELF)->ACTION? ((SELF)->ACTION)((SELF),__VA_ARGS__): 0)
+    #define _$$(ACTION, SELF, ...) ((SELF) && (SELF)->ACTION? ((SELF->_)->ACTION)(&(SELF)->_,__VA_ARGS__): 0)
+#else
+    #define $(ACTION, SELF, ...) ((SELF)->ACTION)((SELF) __VA_OPT__(,) __VA_ARGS__)
+    #define $$(ACTION, SELF, ...) ((SELF)->_.ACTION)(&(SELF)->_ __VA_OPT__(,) __VA_ARGS__)
+    #define _$(ACTION, SELF, ...) ((SELF) && (SELF)->ACTION? ((SELF)->ACTION)((SELF) __VA_OPT__(,) __VA_ARGS__): 0)
+    #define _$$(ACTION, SELF, ...) ((SELF) && (SELF)->ACTION? ((SELF->_)->ACTION)(&(SELF)->_ __VA_OPT__(,) __VA_ARGS__): 0)
+#endif
+// Statistics on canvases and fonts compile away unless the library is built with PG_STATS
+#ifdef PG_STATS
+    #define STATS_NOW(X) ((X)->stats? _pgTime(): 0.0)
+    #define STATS_ADD(X, FIELD, N) ((X)->stats? (void)((X)->stats->FIELD += (N)): (void)0)
+    #define STATS_TRACE(X, NAME, START, ARG, VALUE) \
+        ((X)->stats && (X)->stats->trace? _pgTraceEvent((X)->stats, (NAME), (START), (ARG), (VALUE)): (void)0)
+#else
+    // Arguments are still consumed, so timers and counts kept for them aren't unused
+    #define STATS_NOW(X) ((void)(X), 0.0)
+    #define STATS_ADD(X, FIELD, N) ((void)(X), (void)(N))
+    #define STATS_TRACE(X, NAME, START, ARG, VALUE) ((void)(X), (void)(START), (void)(VALUE))
+#endif
+
 #define NEW(TYPE) malloc(sizeof(TYPE))
 #define NEW_ARRAY(TYPE, N) malloc(sizeof(TYPE)*(N))
 #define REALLOC(TARGET,TYPE,N) ((TARGET) = realloc((TARGET), sizeof(TYPE) * (N)))
+
+PgCff *_pgLoadCff(const uint8_t *table, bool cff2, int nglyphs);
+void _pgFreeCff(PgCff *cff);
+void _pgCffGlyphPath(PgPath *path, PgCff *cff, const PgMatrix *ctm, unsigned g);
+
+PgShaper *_pgNewShaper(const uint8_t *gsub, int nglyphs);
+void _pgShaperUseLookup(PgShaper *shaper, int index);
+void _pgFreeShaper(PgShaper *shaper);
+uint16_t *_pgShape(const PgShaper *shaper, uint16_t *glyphs, int *np);
+
+unsigned _pgDecodeUtf8(const uint8_t **inputp, const uint8_t *end);
+
+void _pgFillSdfGlyph(const Pg *g, const PgFont *font, PgPt at, unsigned glyph, uint32_t color);
+void _pgFreeSdfCache(PgSdfCache *cache);
+void _pgFreeSegmentCache(PgSegmentCache *cache);
+void _pgFreeShadowCache(PgShadowCache *cache);
+uint8_t *_pgPathCoverage(const Pg *g, const PgPath *path, const PgMatrix *matrix, int width, int height);
+void _pgDrawImage(const Pg *g, const Pg *image, PgRect from, const PgMatrix *matrix, float opacity, PgFilter filter);
+void _pgGammaTables(const uint16_t **linear, const uint8_t **encode);
+
+void _pgTraceEvent(const PgStats *stats, const char *name, double start, const char *arg, double value);
@@ -38,6 +38,7 @@ void _resize(Pg *g, int width, int height) {
         DIB_RGB_COLORS,
         &((PgBitmapCanvas*)g)->data,
         NULL, 0);
+    ((PgBitmapCanvas*)g)->stride = width;
 }
 PgDibCanvas pgDefaultDibCanvas() {
     PgDibCanvas g;
@@ -135,8 +136,9 @@ void *load_file(char *filename) {
     fseek(file, 0, SEEK_END);
     int size = ftell(file);
     rewind(file);
-    void *data = malloc(size);
+    char *data = malloc(size + 1);
     int read = fread(data, 1, size, file);
+    data[read > 0? read: 0] = 0;
     fclose(file);
     return data;
 }
@@ -190,73 +192,30 @@ void list_font_test() {
 }
 void alice_test() {
     static PgFont *font;
+    static PgLayout *layout;
+    static float skip;
     if (!font) {
         font = pgOpenFont(Family, 400, false, 0);
+        if (!font) return;
         $(useFeatures, font, "onum");
-    }
-    if (!font) return;
-
-
-    {
-        static char *alice;
-        static int skip;
-        if (!alice) alice = load_file("alice.txt");
-        float font_size = 15.f;
-        float line_height = (font_size * 1.125);
-        float measure = 500;
-        $(scale, font, font_size, 0);
-        for (int i = 0, start = skip; i < gs->height / line_height; i++) {
-            if (i + start == 0)
-                $(scale, font, font_size*1.75, 0);
-            else if (i == 1)
-                $(scale, font, font_size, 0);
-            float max_space = $(getCharWidth, font, ' ') * 3.f;
-            
-            // Segment into words
-            char buf[1024];
-            char *words[128];
-            int widths[128];
-            int nwords = 0;
-            
-            char *in = alice + start;
-            char *out = buf;
-            while (*in && *in!='\n') {
-                while (*in && isspace(*in)) in++;
-                if (!*in || *in=='\n') break;
-                words[nwords] = out;
-                
-                while (*in && !isspace(*in)) *out++ = *in++;
-                *out++ = 0;
-                widths[nwords] = $(getUtf8Width, font, words[nwords], -1);
-                nwords++;
-            }
-            
-            float space = measure;
-            for (int i = 0; i < nwords; i++)
-                space -= widths[i];
-            space /= nwords;
-            if (space > max_space)
-                space = $(getCharWidth, font, ' ');
-            
-            // Print word at a time
-            PgPt p = { gs->width / 2 - measure / 2, i * line_height };
-            for (int i = 0; i < nwords; i++) {
-                $(fillUtf8, gs,
-                    font,
-                    p,
-                    words[i],
-                    -1,
-                    fg);
-                p.x += widths[i] + space;
-            }
-                
-            int n = strcspn(alice + start, "\n");
-            start += n + 1;
-        }
+        $(scale, font, 15.f, 0);
         
-        if (animate)
-            skip += 1 + strcspn(alice + skip, "\n");
+        // The text is wrapped at 70 columns; rejoin lines so paragraphs fill the measure
+        char *alice = load_file("alice.txt");
+        if (!alice) return;
+        for (char *c = alice; *c; c++)
+            if (c[0] == '\n' && c > alice && c[-1] != '\n' && c[1] && c[1] != '\n')
+                c[0] = ' ';
+        layout = pgNewLayout(font, 500);
+        layout->line_height = 15.f * 1.125f;
+        $(setText, layout, alice, -1);
+        free(alice);
     }
+    if (!layout) return;
+    
+    $(fill, layout, gs, pgPt(gs->width / 2 - layout->measure / 2, -skip), fg);
+    if (animate)
+        skip = fmodf(skip + layout->line_spacing, max(layout->height, 1));
 }
 void letters_test(int language) {
     static PgFont *font;
@@ -295,34 +254,41 @@ void letters_test(int language) {
 void glyph_test() {
     PgFont *font = pgOpenFont(Family, 400, false, 0);
     if (!font) return;
-    float font_height = sqrt(gs->width * gs->height / ((PgOpenType*)font)->nglyphs);
+    float font_height = sqrt(gs->width * gs->height / ((PgOpenTypeFace*)font->face)->nglyphs);
+    PgFont *label = $(sized, font, 8, 0);
+    PgFont *glyph = $(sized, font, font_height-5, 0);
     
     unsigned g = 0;
-    unsigned n = ((PgOpenType*)font)->nglyphs;
+    unsigned n = ((PgOpenTypeFace*)font->face)->nglyphs;
     for (int y = 0; y < gs->height && g < n; y += font_height)
     for (int x = 0; x < gs->width && g < n; x += font_height) {
         wchar_t buf[5];
         swprintf(buf, 5, L"%04X", g);
-        $(scale, font, 8, 0);
-        $(fillString, gs, font, pgPt(x,y), buf, 4, 0xff000000);
-        
-        
-        $(scale, font, font_height-5, 0);
-        $(fillGlyph, gs, font, pgPt(x,y+5), g++, fg);
+        $(fillString, gs, label, pgPt(x,y), buf, 4, 0xff000000);
+        $(fillGlyph, gs, glyph, pgPt(x,y+5), g++, fg);
     }
+    $(free, label);
+    $(free, glyph);
     $(free, font);
 }
 
 void svg_test() {
+    static PgPath **paths;
+    static int npaths;
+    if (!paths) {
+        while (TestSVG[npaths]) npaths++;
+        paths = NEW_ARRAY(PgPath*, npaths);
+        for (int i = 0; i < npaths; i++) {
+            paths[i] = pgInterpretSvgPath(TestSVG[i], NULL);
+            paths[i]->cacheSegments = true;
+        }
+    }
+    
     $(translate, gs, -396/2, -468/2);
     $(rotate, gs, Tick / 3.f * M_PI / 180.f);
     $(translate, gs, gs->width / 2, gs->height / 2);
-    
-    for (int i = 0; TestSVG[i]; i++) {
-        PgPath *path = pgInterpretSvgPath(TestSVG[i], &gs->ctm);
-        $(fill, gs, path, fg);
-        $(free, path);
-    }
+    for (int i = 0; i < npaths; i++)
+        $(fillTransformed, gs, paths[i], &gs->ctm, fg);
 }
 void simple_test() {
     $(scale, gs, .5, .5);
@@ -348,6 +314,7 @@ void simple_test() {
     $(free, path);
 }
 
+
 void benchmark() {
     int start = GetTickCount();
     for (int i = 0; i < 100; i++)
@@ -14,22 +14,61 @@
 #include <pg/platform.h>
 #include "common.h"
 
-static float GammaTable[256];
+float PgGamma = 2.2f;
+
+typedef struct {
+    float       gamma;
+    float       power[256];         // Components raised to the gamma
+    uint16_t    linear[256];        // Components as 16-bit linear light
+    uint8_t     encode[1 << 16];    // And back
+} GammaTables;
+
+// Tables are built whole and then published, so threads drawing always see one
+// complete set. Replaced sets stay allocated, since a thread may still be using one.
+static GammaTables *volatile Gamma;
+
+static GammaTables *newGammaTables(float gamma) {
+    GammaTables *t = NEW(GammaTables);
+    t->gamma = gamma;
+    for (int i = 0; i < 256; i++)
+        t->power[i] = powf(i, gamma);
+    for (int i = 0; i < 256; i++)
+        t->linear[i] = powf(i / 255.0f, gamma) * 65535 + .5f;
+    for (int i = 0; i < 1 << 16; i++)
+        t->encode[i] = powf(i / 65535.0f, 1.0f / gamma) * 255 + .5f;
+    return t;
+}
 void pgSetGamma(float gamma) {
     PgGamma = gamma;
-    for (float i = 0; i < 256.0f; i++)
-        GammaTable[(int)i] = powf(i, PgGamma);
+    STORE_RELEASE(&Gamma, newGammaTables(gamma));
+}
+static const GammaTables *gammaTables(void) {
+    GammaTables *t = LOAD_ACQUIRE(&Gamma);
+    if (!t) {
+        t = newGammaTables(2.2f);
+        if (!CAS_POINTER(&Gamma, NULL, t)) {
+            free(t);
+            t = LOAD_ACQUIRE(&Gamma);
+        }
+    }
+    return t;
 }
 
+// Tables for blending many pixels without powf
+void _pgGammaTables(const uint16_t **linear, const uint8_t **encode) {
+    const GammaTables *t = gammaTables();
+    *linear = t->linear;
+    *encode = t->encode;
+}
 uint32_t pgBlend(uint32_t bg, uint32_t fg, uint32_t a255) {
     if (a255 == 255) return fg;
     if (a255 == 0) return bg;
-    if (!PgGamma) pgSetGamma(2.2f);
+    const GammaTables *t = gammaTables();
     float a = a255 / 255.0f;
     float na = 1.0f - a;
-    uint8_t r = powf(a * GammaTable[fg >> 16 & 255] + na * GammaTable[bg >> 16 & 255], 1.0f / PgGamma);
-    uint8_t g = powf(a * GammaTable[fg >>  8 & 255] + na * GammaTable[bg >>  8 & 255], 1.0f / PgGamma);
-    uint8_t b = powf(a * GammaTable[fg >>  0 & 255] + na * GammaTable[bg >>  0 & 255], 1.0f / PgGamma);
+    uint8_t r = powf(a * t->power[fg >> 16 & 255] + na * t->power[bg >> 16 & 255], 1.0f / t->gamma);
+    uint8_t g = powf(a * t->power[fg >>  8 & 255] + na * t->power[bg >>  8 & 255], 1.0f / t->gamma);
+    uint8_t b = powf(a * t->power[fg >>  0 & 255] + na * t->power[bg >>  0 & 255], 1.0f / t->gamma);
     return (r << 16) + (g << 8) + b;
 }
 
@@ -93,7 +132,33 @@ PgPt pgTransformPoint(const PgMatrix *ctm, PgPt p) {
 }
 
 #define trailing(n) ((input[n] & 0xC0) == 0x80)
-#define overlong(n) do { if (o[-1] < n) o[-1] = 0xfffd; } while(0)
+#define overlong(n) do { if (c < n) c = 0xfffd; } while(0)
+unsigned _pgDecodeUtf8(const uint8_t **inputp, const uint8_t *end) {
+    const uint8_t *input = *inputp;
+    unsigned c;
+    if (*input < 0x80)
+        c = *input++;
+    else if (~*input & 0x20 && input + 1 < end && trailing(1)) { // two byte
+        c =     (input[0] & 0x1f) << 6
+                |(input[1] & 0x3f);
+        input += 2;
+        overlong(0x80);
+    } else if (~*input & 0x10 && input + 2 < end && trailing(1) && trailing(2)) { // three byte
+        c =     (input[0] & 0x0f) << 12
+                |(input[1] & 0x3f) << 6
+                |(input[2] & 0x3f);
+        input += 3;
+        overlong(0x800);
+    } else {
+        // Discard malformed or non-BMP characters
+        do
+            input++;
+        while (input < end && (*input & 0xc0) == 0x80);
+        c = 0xfffd; /* replacement char */
+    }
+    *inputp = input;
+    return c;
+}
 uint16_t *pgUtf8To16(const uint8_t *input, int len, int *lenp) {
     if (len < 0) len = strlen(input);
     uint16_t *output = malloc((len + 1) * sizeof *output);
@@ -101,33 +166,14 @@ uint16_t *pgUtf8To16(const uint8_t *input, int len, int *lenp) {
     const uint8_t *end = input + len;
     
     while (input < end)
-        if (*input < 0x80)
-            *o++ = *input++;
-        else if (~*input & 0x20 && input + 1 < end && trailing(1)) { // two byte
-            *o++ =     (input[0] & 0x1f) << 6
-                    |(input[1] & 0x3f);
-            input += 2;
-            overlong(0x80);
-        } else if (~*input & 0x10 && input + 2 < end && trailing(1) && trailing(2)) { // three byte
-            *o++ =     (input[0] & 0x0f) << 12
-                    |(input[1] & 0x3f) << 6
-                    |(input[2] & 0x3f);
-            input += 3;
-            overlong(0x800);
-        } else {
-            // Discard malformed or non-BMP characters
-            do
-                input++;
-            while ((*input & 0xc0) == 0x80);
-            *o++ = 0xfffd; /* replacement char */
-        }
+        *o++ = _pgDecodeUtf8(&input, end);
     *o = 0;
     len = o - output;
     if (lenp) *lenp = len;
     return realloc(output, (len + 1) * sizeof *output);
 }
 uint8_t *pgUtf16To8(const uint16_t *input, int len, int *lenp) {
-    if (len < 0) len = wcslen(input);
+    if (len < 0) for (len = 0; input[len]; len++);
     uint8_t *o, *output = malloc(len * 3 + 1);
     for (o = output; len-->0; input++) {
         unsigned c = *input;
@@ -149,47 +195,220 @@ uint8_t *pgUtf16To8(const uint16_t *input, int len, int *lenp) {
 }
 
 
-PgPath *pgInterpretSvgPath(const char *svg, const PgMatrix *initial_ctm) {
-    static char params[256];
-    if (!params['m']) {
-        char *name = "mzlhvcsqt";
-        int n[] = { 2, 0, 2, 1, 1, 6, 4, 4, 2 };
-        memset(params, -1, 256);
-        for (int i = 0; name[i]; i++)
-            params[name[i]] = params[toupper(name[i])] = n[i];
+// Number of arguments to each path command plus one; zero if not a command
+static const uint8_t SvgParams[256] = {
+    ['m'] = 3, ['M'] = 3,
+    ['z'] = 1, ['Z'] = 1,
+    ['l'] = 3, ['L'] = 3,
+    ['h'] = 2, ['H'] = 2,
+    ['v'] = 2, ['V'] = 2,
+    ['c'] = 7, ['C'] = 7,
+    ['s'] = 5, ['S'] = 5,
+    ['q'] = 5, ['Q'] = 5,
+    ['t'] = 3, ['T'] = 3,
+    ['a'] = 8, ['A'] = 8,
+};
+
+static bool isSvgSpace(int c) {
+    return c == ' ' || c == ',' || c == '\n' || c == '\r' || c == '\t' || c == '\f';
+}
+static bool isDigit(int c) {
+    return c >= '0' && c <= '9';
+}
+// Locale independent; stops where the next number could start, so "1.5.5" and "-1-2" are two each
+static const char *scanNumber(const char *s, float *out) {
+    static const double Powers[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+        1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+    };
+    bool negative = *s == '-';
+    if (*s == '-' || *s == '+')
+        s++;
+    uint64_t mantissa = 0;
+    int exponent = 0, digits = 0;
+    for ( ; isDigit(*s); s++, digits++)
+        if (mantissa < 100000000000000000ull)
+            mantissa = mantissa * 10 + *s - '0';
+        else
+            exponent++;
+    if (*s == '.')
+        for (s++; isDigit(*s); s++, digits++)
+            if (mantissa < 100000000000000000ull) {
+                mantissa = mantissa * 10 + *s - '0';
+                exponent--;
+            }
+    if (!digits)
+        return NULL;
+    if ((*s == 'e' || *s == 'E') && (isDigit(s[1]) || ((s[1] == '-' || s[1] == '+') && isDigit(s[2])))) {
+        bool negative_exponent = *++s == '-';
+        if (*s == '-' || *s == '+')
+            s++;
+        int e = 0;
+        for ( ; isDigit(*s); s++)
+            if (e < 1000)
+                e = e * 10 + *s - '0';
+        exponent += negative_exponent? -e: e;
+    }
+    // Zero stays zero under any exponent, rather than becoming 0 * inf
+    double value = mantissa;
+    if (!mantissa)
+        value = 0;
+    else if (exponent >= -22 && exponent <= 22)
+        value = exponent < 0? value / Powers[-exponent]: value * Powers[exponent];
+    else
+        value *= pow(10, exponent);
+    if (value > FLT_MAX) // The magnitude, before the sign goes on
+        value = FLT_MAX;
+    *out = negative? -value: value;
+    return s;
+}
+static const char *scanFlag(const char *s, float *out) {
+    if (*s != '0' && *s != '1')
+        return NULL;
+    *out = *s - '0';
+    return s + 1;
+}
+
+// Elliptical arcs as cubics of at most a quarter turn each
+static void svgArc(PgPath *path, const PgMatrix *ctm, PgPt a, float rx, float ry, float degrees, bool large, bool sweep, PgPt b) {
+    if (a.x == b.x && a.y == b.y)
+        return;
+    rx = fabsf(rx);
+    ry = fabsf(ry);
+    if (rx == 0 || ry == 0) {
+        $(line, path, ctm, b);
+        return;
+    }
+    
+    // Centre parameterization from the SVG specification's implementation notes
+    double phi = degrees * M_PI / 180, cs = cos(phi), sn = sin(phi);
+    double hx = (a.x - b.x) / 2, hy = (a.y - b.y) / 2;
+    double x1 = cs * hx + sn * hy, y1 = -sn * hx + cs * hy;
+    double lambda = x1 * x1 / (rx * rx) + y1 * y1 / (ry * ry);
+    if (lambda > 1) {
+        rx *= sqrt(lambda);
+        ry *= sqrt(lambda);
     }
+    double rx2 = rx * rx, ry2 = ry * ry;
+    double num = rx2 * ry2 - rx2 * y1 * y1 - ry2 * x1 * x1;
+    double den = rx2 * y1 * y1 + ry2 * x1 * x1;
+    double coef = (large == sweep? -1: 1) * sqrt(MAX(0, num / den));
+    double cxp = coef * rx * y1 / ry, cyp = -coef * ry * x1 / rx;
+    double cx = cs * cxp - sn * cyp + (a.x + b.x) / 2;
+    double cy = sn * cxp + cs * cyp + (a.y + b.y) / 2;
+    double theta = atan2((y1 - cyp) / ry, (x1 - cxp) / rx);
+    double delta = atan2((-y1 - cyp) / ry, (-x1 - cxp) / rx) - theta;
+    if (sweep && delta < 0)
+        delta += 2 * M_PI;
+    else if (!sweep && delta > 0)
+        delta -= 2 * M_PI;
     
-    PgMatrix   ctm = initial_ctm? *initial_ctm: PgIdentityMatrix;
-    PgPath     *path = pgNewPath();
+    int n = MAX(1, ceil(fabs(delta) / (M_PI / 2) - 1e-6));
+    double step = delta / n;
+    double k = 4.0 / 3.0 * tan(step / 4);
+    PgPt p0 = a;
+    for (int i = 0; i < n; i++) {
+        double t0 = theta + i * step, t1 = t0 + step;
+        double d0x = -rx * sin(t0) * cs - ry * cos(t0) * sn, d0y = -rx * sin(t0) * sn + ry * cos(t0) * cs;
+        double d1x = -rx * sin(t1) * cs - ry * cos(t1) * sn, d1y = -rx * sin(t1) * sn + ry * cos(t1) * cs;
+        PgPt p1 = i == n - 1? b: pgPt(
+            cx + rx * cos(t1) * cs - ry * sin(t1) * sn,
+            cy + rx * cos(t1) * sn + ry * sin(t1) * cs);
+        $(cubic, path, ctm,
+            pgPt(p0.x + k * d0x, p0.y + k * d0y),
+            pgPt(p1.x - k * d1x, p1.y - k * d1y),
+            p1);
+        p0 = p1;
+    }
+}
+
+// Reads one command's parameters; NULL if they are malformed
+static const char *scanSvgParams(const char *svg, int cmd, float a[]) {
+    for (int i = 0; i < SvgParams[cmd] - 1 && svg; i++) {
+        while (isSvgSpace(*svg)) svg++;
+        bool flag = (cmd == 'a' || cmd == 'A') && (i == 3 || i == 4);
+        svg = flag? scanFlag(svg, &a[i]): scanNumber(svg, &a[i]);
+    }
+    return svg;
+}
+
+// Reserves what each command adds, reading them as pgAppendSvgPath() will so
+// nothing reallocates. Arcs may take up to four cubics.
+static void reserveSvgPath(PgPath *path, const char *svg) {
+    static const uint8_t Points[256] = {
+        ['m'] = 1, ['M'] = 1, ['z'] = 1, ['Z'] = 1,
+        ['l'] = 1, ['L'] = 1, ['h'] = 1, ['H'] = 1, ['v'] = 1, ['V'] = 1,
+        ['c'] = 3, ['C'] = 3, ['s'] = 3, ['S'] = 3,
+        ['q'] = 2, ['Q'] = 2, ['t'] = 2, ['T'] = 2,
+        ['a'] = 12, ['A'] = 12,
+    };
+    int nparts = 0, npoints = 0, cmd = 0;
+    float a[7];
+    for (;;) {
+        while (isSvgSpace(*svg)) svg++;
+        if (!*svg)
+            break;
+        if (SvgParams[(uint8_t)*svg])
+            cmd = *svg++;
+        else if (SvgParams[cmd] <= 1)
+            break;
+        if (!(svg = scanSvgParams(svg, cmd, a)))
+            break;
+        nparts += cmd == 'a' || cmd == 'A'? 4: 1;
+        npoints += Points[cmd];
+        if (cmd == 'm')
+            cmd = 'l';
+        else if (cmd == 'M')
+            cmd = 'L';
+    }
+    $(reserve, path, nparts, npoints);
+}
+
+// Parses as far as the first error, which it reports, as the specification asks
+bool pgAppendSvgPath(PgPath *path, const PgMatrix *ctm, const char *svg) {
+    if (!ctm) ctm = &PgIdentityMatrix;
+    reserveSvgPath(path, svg);
     PgPt        cur = {0,0};
     PgPt        start = {0,0};
-    PgPt        reflect = {0,0};
+    PgPt        reflect = {0,0};    // Last control point
+    int         last = 0;           // Kind of curve that set it
     PgPt        b;
-    int         cmd;
-    float       a[6];
-    while (*svg) {
-        while (isspace(*svg) || *svg==',') svg++;
-        if (params[*svg] >= 0) // continue last command
+    int         cmd = 0;
+    bool        started = false;
+    float       a[7];
+    for (;;) {
+        while (isSvgSpace(*svg)) svg++;
+        if (!*svg)
+            return true;
+        if (SvgParams[(uint8_t)*svg]) // otherwise continue last command
             cmd = *svg++;
+        else if (SvgParams[cmd] <= 1)
+            return false;
+        if (!started && cmd != 'm' && cmd != 'M') // Paths begin with a move
+            return false;
+        started = true;
         
-        for (int i = 0; i < params[cmd]; i++) {
-            while (isspace(*svg) || *svg==',') svg++;
-            a[i] = strtof(svg, (char**)&svg);
-        }
+        if (!(svg = scanSvgParams(svg, cmd, a)))
+            return false;
+        
+        // Smooth curves reflect the last control point only after a curve of their kind
+        int kind = cmd == 'c' || cmd == 'C' || cmd == 's' || cmd == 'S'? 'c':
+                   cmd == 'q' || cmd == 'Q' || cmd == 't' || cmd == 'T'? 'q':
+                   0;
+        if (kind != last)
+            reflect = cur;
+        last = kind;
         
-//        printf("%c", cmd);
-//        for (int i = 0; i < params[cmd]; i++)
-//            printf(" %g", a[i]);
-//        putchar('\n');
-
         switch (cmd) {
         case 'm':
             start = cur = pgPt(cur.x + a[0], cur.y + a[1]);
-            $(move, path, &ctm, cur);
+            $(move, path, ctm, cur);
+            cmd = 'l'; // Further pairs are lines
             break;
         case 'M':
             start = cur = pgPt(a[0], a[1]);
-            $(move, path, &ctm, cur);
+            $(move, path, ctm, cur);
+            cmd = 'L';
             break;
         case 'Z':
         case 'z':
@@ -198,77 +417,91 @@ PgPath *pgInterpretSvgPath(const char *svg, const PgMatrix *initial_ctm) {
             break;
         case 'L':
             cur = pgPt(a[0], a[1]);
-            $(line, path, &ctm, cur);
+            $(line, path, ctm, cur);
             break;
         case 'l':
             cur = pgPt(cur.x + a[0], cur.y + a[1]);
-            $(line, path, &ctm, cur);
+            $(line, path, ctm, cur);
             break;
         case 'h':
             cur = pgPt(cur.x + a[0], cur.y);
-            $(line, path, &ctm, cur);
+            $(line, path, ctm, cur);
             break;
         case 'H':
             cur = pgPt(a[0], cur.y);
-            $(line, path, &ctm, cur);
+            $(line, path, ctm, cur);
             break;
         case 'v':
             cur = pgPt(cur.x, cur.y + a[0]);
-            $(line, path, &ctm, cur);
+            $(line, path, ctm, cur);
             break;
         case 'V':
             cur = pgPt(cur.x, a[0]);
-            $(line, path, &ctm, cur);
+            $(line, path, ctm, cur);
             break;
         case 'c':
             b = pgPt(cur.x + a[0], cur.y + a[1]);
             reflect = pgPt(cur.x + a[2], cur.y + a[3]);
             cur = pgPt(cur.x + a[4], cur.y + a[5]);
-            $(cubic, path, &ctm, b, reflect, cur);
+            $(cubic, path, ctm, b, reflect, cur);
             break;
         case 'C':
             b = pgPt(a[0], a[1]);
             reflect = pgPt(a[2], a[3]);
             cur = pgPt(a[4], a[5]);
-            $(cubic, path, &ctm, b, reflect, cur);
+            $(cubic, path, ctm, b, reflect, cur);
             break;
         case 's':
             b = pgPt( cur.x + (cur.x - reflect.x),
                     cur.y + (cur.y - reflect.y));
             reflect = pgPt(cur.x + a[0], cur.y + a[1]);
             cur = pgPt(cur.x + a[2], cur.y + a[3]);
-            $(cubic, path, &ctm, b, reflect, cur);
+            $(cubic, path, ctm, b, reflect, cur);
             break;
         case 'S':
             b = pgPt( cur.x + (cur.x - reflect.x),
                     cur.y + (cur.y - reflect.y));
             reflect = pgPt(a[0], a[1]);
             cur = pgPt(a[2], a[3]);
-            $(cubic, path, &ctm, b, reflect, cur);
+            $(cubic, path, ctm, b, reflect, cur);
             break;
         case 'q':
             reflect = pgPt(cur.x + a[0], cur.y + a[1]);
             cur = pgPt(cur.x + a[2], cur.y + a[3]);
-            $(quadratic, path, &ctm, reflect, cur);
+            $(quadratic, path, ctm, reflect, cur);
             break;
         case 'Q':
             reflect = pgPt(a[0], a[1]);
             cur = pgPt(a[2], a[3]);
-            $(quadratic, path, &ctm, reflect, cur);
+            $(quadratic, path, ctm, reflect, cur);
             break;
         case 't':
             reflect = pgPt(cur.x + (cur.x - reflect.x),
                          cur.y + (cur.y - reflect.y));
             cur = pgPt(cur.x + a[0], cur.y + a[1]);
-            $(quadratic, path, &ctm, reflect, cur);
+            $(quadratic, path, ctm, reflect, cur);
             break;
         case 'T':
             reflect = pgPt(cur.x + (cur.x - reflect.x),
                          cur.y + (cur.y - reflect.y));
             cur = pgPt(a[0], a[1]);
-            $(quadratic, path, &ctm, reflect, cur);
+            $(quadratic, path, ctm, reflect, cur);
+            break;
+        case 'a':
+            b = pgPt(cur.x + a[5], cur.y + a[6]);
+            svgArc(path, ctm, cur, a[0], a[1], a[2], a[3], a[4], b);
+            cur = b;
+            break;
+        case 'A':
+            b = pgPt(a[5], a[6]);
+            svgArc(path, ctm, cur, a[0], a[1], a[2], a[3], a[4], b);
+            cur = b;
             break;
         }
     }
+}
+PgPath *pgInterpretSvgPath(const char *svg, const PgMatrix *initial_ctm) {
+    PgPath *path = pgNewPath();
+    pgAppendSvgPath(path, initial_ctm, svg);
     return path;
 }
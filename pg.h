@@ -3,24 +3,82 @@ typedef struct { float x, y; } PgPt;
 typedef struct { PgPt a, b; } PgRect;
 typedef struct { float a, b, c, d, e, f; } PgMatrix;
 typedef enum { PG_NONZERO_WINDING, PG_EVENODD_WINDING } PgFillRule;
+typedef enum { PG_FILTER_NEAREST, PG_FILTER_BILINEAR, PG_FILTER_BOX } PgFilter;
 typedef struct Pg Pg;
 typedef struct PgPath PgPath;
 typedef struct PgFont PgFont;
+typedef struct PgFace PgFace;
+typedef struct PgCff PgCff;
+typedef struct PgShaper PgShaper;
+typedef struct PgFeatureSet PgFeatureSet;
+typedef struct PgAdvances PgAdvances;
+typedef struct PgLayout PgLayout;
+typedef struct PgWordCache PgWordCache;
+typedef struct PgSdfCache PgSdfCache;
+typedef struct PgSegmentCache PgSegmentCache;
+typedef struct PgShadowCache PgShadowCache;
+typedef struct PgSceneFill PgSceneFill;
+
+// Stage timings as Chrome trace events; shareable between threads
+typedef struct {
+    const char  *name;
+    double      start;      // Seconds from _pgTime()
+    double      duration;
+    int         thread;
+    const char  *arg;       // Optional named value
+    double      value;
+} PgTraceEvent;
+
+typedef struct {
+    double          origin;
+    PgTraceEvent    *events;
+    int             nevents;
+    int             cap;
+    volatile long   lock;
+} PgTrace;
+
+// Where time goes on a canvas or font, gathered only when the library is built with
+// PG_STATS. Counts are not atomic, so give each thread its own.
+typedef struct {
+    double      flatten;    // Seconds decomposing curves into segments
+    double      sort;
+    double      scan;       // Seconds in scan conversion, less blending
+    double      blend;
+    int64_t     paths;
+    int64_t     segments;
+    int64_t     line_segments;
+    int64_t     quadratic_segments;
+    int64_t     cubic_segments;
+    int64_t     edges;      // Edges crossed, counted once per subsample row
+    int64_t     pixels;     // Pixels blended
+    int64_t     glyphs;
+    int64_t     images;
+    int64_t     glyph_paths;
+    int64_t     cmap_lookups;
+    int64_t     substitutions;  // Glyphs put through substitutions
+    int64_t     allocations;
+    PgTrace     *trace;     // Also records stages here when set
+    int         thread;     // Thread number given to trace events
+} PgStats;
 struct Pg {
     int         width;
     int         height;
     float       flatness;
     float       subsamples;
+    float       sdf_size;   // Glyphs this many pixels per em or more use distance fields; 0 never
     PgMatrix    ctm;
+    PgStats     *stats;     // Totals are added here when set
     void        (*free)(Pg *g);
     void        (*resize)(Pg *g, int width, int height);
     void        (*clear)(const Pg *g, uint32_t color);
     void        (*clearSection)(const Pg *g, PgRect rect, uint32_t color);
     void        (*fill)(const Pg *g, const PgPath *path, uint32_t color);
+    void        (*fillTransformed)(const Pg *g, const PgPath *path, const PgMatrix *matrix, uint32_t color);
     float       (*fillChar)(Pg *g, const PgFont *font, PgPt at, unsigned c, uint32_t color);
     float       (*fillUtf8)(Pg *g, const PgFont *font, PgPt at, const uint8_t chars[], int len, uint32_t color);
     float       (*fillString)(Pg *g, const PgFont *font, PgPt at, const wchar_t chars[], int len, uint32_t color);
     float       (*fillGlyph)(Pg *g, const PgFont *font, PgPt at, unsigned glyph, uint32_t color);
+    void        (*drawImage)(const Pg *g, const Pg *image, PgRect from, const PgMatrix *matrix, float opacity, PgFilter filter);
     void        (*identity)(Pg *g);
     void        (*translate)(Pg *g, float x, float y);
     void        (*scale)(Pg *g, float x, float y);
@@ -32,8 +90,86 @@ struct Pg {
 typedef struct {
     Pg          _;
     uint32_t    *data;
+    int         stride;     // Pixels from one row to the next
 } PgBitmapCanvas;
 
+// Canvases in shared memory: a header, then two buffers that frames alternate between.
+// Readers in other processes map the same memory and never wait for the writer.
+#define PG_SHARED_MAGIC 0x43534750 // "PGSC"
+typedef enum {
+    PG_FORMAT_ARGB32 = 1,   // 0xaarrggbb words in native byte order
+} PgPixelFormat;
+
+typedef struct {
+    volatile uint32_t   frame;      // Frame held; 0 while it is being drawn
+    uint32_t            width;
+    uint32_t            height;
+    uint32_t            stride;     // Pixels from one row to the next
+    uint32_t            offset;     // Bytes from the start of the header
+    uint32_t            capacity;   // Bytes available at offset
+} PgSharedBuffer;
+
+typedef struct {
+    uint32_t            magic;
+    uint32_t            format;
+    volatile uint32_t   size;       // Bytes in the memory; readers remap when it grows
+    volatile uint32_t   front;      // Buffer with the last presented frame
+    volatile uint32_t   frame;      // Frames presented so far
+    PgSharedBuffer      buffers[2];
+} PgSharedHeader;
+
+typedef struct {
+    PgBitmapCanvas  _;
+    PgSharedHeader  *header;
+    size_t          size;
+    intptr_t        handle;     // File descriptor or section handle, to hand to readers
+    int             back;       // Buffer being drawn
+} PgSharedCanvas;
+
+typedef struct {
+    PgSharedHeader  *header;
+    size_t          size;
+    intptr_t        handle;
+} PgSharedReader;
+
+typedef struct {
+    const uint32_t  *data;      // Valid until the next read
+    int             width;
+    int             height;
+    int             stride;
+    uint32_t        frame;
+    int             buffer;
+} PgSharedFrame;
+
+// Records fills as segments to render later in strips of rows, so images
+// too large for memory only ever hold one strip of pixels
+typedef struct {
+    PgBitmapCanvas  _;
+    uint32_t        background;
+    PgSceneFill     **fills;
+    int             nfills;
+    int             cap;
+} PgSceneCanvas;
+
+// Draws on a render thread of its own. Calls only copy commands into a ring,
+// which the thread plays into the back of two bitmap canvases.
+typedef struct {
+    PgBitmapCanvas  _;
+    Pg              *buffers[2];    // Frame n is drawn into buffers[n & 1]
+    uint8_t         *ring;
+    uint32_t        capacity;       // Bytes in the ring, a power of two
+    uint32_t        written;        // Bytes written, ahead of head while a command is encoded
+    volatile uint32_t head;         // Bytes the render thread may play
+    volatile uint32_t tail;         // Bytes it has played
+    volatile uint32_t renderSleeps; // Set while the render thread waits for commands
+    volatile uint32_t writerSleeps; // Set while the drawing thread waits for room
+    uint32_t        presented;      // Frames ended by pgPresentQueue()
+    volatile uint32_t completed;    // Frames finished by the render thread
+    volatile uint32_t drawing;      // Frame the render thread is drawing
+    volatile uint32_t shown;        // Frame last returned by pgWaitQueue(), which it keeps
+    intptr_t        thread;
+} PgQueueCanvas;
+
 typedef enum {
     PG_PATH_MOVE       = 0,
     PG_PATH_LINE       = 1,
@@ -72,33 +208,76 @@ struct PgPath {
     int             nparts;
     int             npoints;
     int             cap;
+    int             cappoints;
     PgPathPartType *types;
-    PgPt            *points;
+    float           *x;         // Points in the space of the ctm they were added under
+    float           *y;
     PgPt            start;
     PgFillRule      fillRule;
+    PgRect          bounds;     // Exact, kept by box() until the path changes
+    volatile long   bounded;
+    bool            cacheSegments;  // Keep the flattened path between fills of the same shape
+    PgSegmentCache  *segments;
+    volatile long   segmentsLock;   // Also taken to store the bounds
+    bool            cacheShadow;    // Keep the blurred mask between shadows of the same shape
+    PgShadowCache   *shadow;
+    volatile long   shadowLock;
     
     void            (*free)(PgPath *path);
+    // A NULL ctm keeps points in the path's own space, to be drawn with fillTransformed()
     void            (*move)(PgPath *path, const PgMatrix *ctm, PgPt p);
     void            (*close)(PgPath *path);
     void            (*line)(PgPath *path, const PgMatrix *ctm, PgPt b);
     void            (*quadratic)(PgPath *path, const PgMatrix *ctm, PgPt b, PgPt c);
     void            (*cubic)(PgPath *path, const PgMatrix *ctm, PgPt b, PgPt c, PgPt d);
+    
+    // Bulk construction
+    void            (*reserve)(PgPath *path, int nparts, int npoints);
+    void            (*append)(PgPath *path, const PgMatrix *ctm, int nparts, const PgPathPartType types[], const PgPt points[]);
+    void            (*lines)(PgPath *path, const PgMatrix *ctm, int npoints, const PgPt points[]);
+    void            (*appendPath)(PgPath *path, const PgMatrix *ctm, const PgPath *src);
     PgRect          (*box)(PgPath *path);
 };
+static PgPt pgPathPoint(const PgPath *path, int i) {
+    PgPt p = { path->x[i], path->y[i] };
+    return p;
+}
 
-struct PgFont {
+// A face is the parsed font file shared by every font opened on it
+struct PgFace {
     const void  *file;
     void        *host;
-    void        (*_freeHost)(PgFont *font);
+    void        (*_freeHost)(PgFace *face);
+    volatile long refs;
+    
+    // Set while the face is shared through pgOpenFontFile()
+    wchar_t     *filename;
+    int         index;
+    PgFace      *next;
+    
+    PgSdfCache  * volatile sdf; // Distance fields of glyphs drawn large
+    
+    void        (*free)(PgFace *face);
+    PgFont      *(*newFont)(PgFace *face);
+};
+
+// Fonts are light handles on a face that carry the size and features
+struct PgFont {
+    PgFace      *face;
+    PgStats     *stats;     // Totals are added here when set; sized handles start without
+    uint32_t    generation; // New whenever widths may change; no two fonts share one
     
     void        (*free)(PgFont *font);
     void        (*scale)(PgFont *font, float height, float width);
+    PgFont      *(*sized)(const PgFont *font, float height, float width);
     PgPath      *(*getCharPath)(const PgFont *font, const PgMatrix *ctm, unsigned c);
     PgPath      *(*getGlyphPath)(const PgFont *font, const PgMatrix *ctm, unsigned g);
     unsigned    (*getGlyph)(const PgFont *font, unsigned c);
+    uint16_t    *(*shapeString)(const PgFont *font, const wchar_t chars[], int len, int *countp);
     
     // Metrics
     float       (*getUtf8Width)(const PgFont *font, const char chars[], int len);
+    void        (*getUtf8Widths)(const PgFont *font, int n, const char *const strings[], const int lens[], float widths[]);
     float       (*getStringWidth)(const PgFont *font, const wchar_t chars[], int len);
     float       (*getAscender)(const PgFont *font);
     float       (*getDescender)(const PgFont *font);
@@ -137,10 +316,7 @@ typedef struct {
 } PgFontFamily;
 
 typedef struct {
-    PgFont      _;
-    
-    float       scale_x;
-    float       scale_y;
+    PgFace      _;
     
     int         nglyphs;
     int         nhmtx;
@@ -153,13 +329,11 @@ typedef struct {
     const void  *loca;
     const uint16_t *hmtx;
     const uint8_t *gsub;
+    PgCff       *cff;   // PostScript outlines when there is no 'glyf'
     
-    
-    uint8_t     (*features)[4];
-    uint32_t    script;
-    uint32_t    lang;
-    uint16_t    (*subst)[2];
-    int         nsubst;
+    // Features compiled by any handle, kept for all of them
+    PgFeatureSet *feature_sets;
+    volatile long feature_lock;
     
     // Metrics
     float       em;
@@ -181,10 +355,117 @@ typedef struct {
     const wchar_t *name;
         
     uint16_t    cmap[65536];
+} PgOpenTypeFace;
+
+typedef struct {
+    PgFont      _;
+    
+    float       scale_x;
+    float       scale_y;
+    
+    uint8_t     (*features)[4];
+    uint32_t    script;
+    uint32_t    lang;
+    uint16_t    (*subst)[2];
+    int         nsubst;
+    PgShaper    *shaper;    // Lookups that change the glyph sequence
+    const PgFeatureSet *feature_set;
+    
+    // Scaled advances, built on first use and dropped when the scale or
+    // substitutions change
+    PgAdvances  *volatile advances;
 } PgOpenType;
 
+struct PgFeatureSet {
+    uint32_t    script;
+    uint32_t    lang;
+    char        *features;  // NULL when this lists the available features
+    char        *available;
+    uint16_t    (*subst)[2];
+    int         nsubst;
+    PgShaper    *shaper;
+    PgFeatureSet *next;
+};
+
+// Paragraphs of UTF-8 text broken into justified lines
+typedef struct {
+    int         start;      // Byte offset in the paragraph
+    int         len;
+    float       width;
+    float       x;          // From the start of its line
+} PgLayoutWord;
+
+typedef struct {
+    int         word;
+    int         nwords;
+    float       width;      // With natural spacing
+} PgLayoutLine;
+
+typedef struct {
+    char        *text;
+    int         len;
+    float       y;
+    PgLayoutWord *words;
+    int         nwords;
+    int         capwords;
+    PgLayoutLine *lines;
+    int         nlines;
+    int         caplines;
+    bool        measured;   // Word widths are current
+    float       measure;    // Measure the lines were broken for
+} PgParagraph;
+
+struct PgLayout {
+    const PgFont *font;
+    float       measure;
+    float       line_height; // 0 uses the font's line spacing
+    bool        justify;
+    
+    PgParagraph *paragraphs;
+    int         nparagraphs;
+    int         capparagraphs;
+    float       height;
+    float       line_spacing;
+    uint32_t    generation; // The font's when the cached widths were measured
+    float       space;
+    PgWordCache *cache;
+    
+    void        (*free)(PgLayout *layout);
+    void        (*setFont)(PgLayout *layout, const PgFont *font);
+    void        (*setMeasure)(PgLayout *layout, float measure);
+    void        (*setText)(PgLayout *layout, const char *text, int len);
+    void        (*editText)(PgLayout *layout, int start, int end, const char *text, int len);
+    void        (*update)(PgLayout *layout);
+    float       (*fill)(PgLayout *layout, Pg *g, PgPt at, uint32_t color);
+};
+
+typedef enum {
+    PG_IMAGE_PPM,
+    PG_IMAGE_RAW,       // Canvas pixels as they are in memory
+} PgImageFormat;
+
+// One image of a batch; start from pgDefaultRenderJob()
+typedef struct PgRenderJob PgRenderJob;
+struct PgRenderJob {
+    int             width;
+    int             height;
+    uint32_t        background;
+    uint32_t        color;
+    PgMatrix        matrix;     // Applied to the path
+    const char      *svg;       // Path data to fill, or NULL
+    const PgFont    *font;      // Shared by all workers, each drawing with its own sized handle
+    float           size;
+    const char      *text;      // UTF-8 drawn at `at`, or NULL
+    PgPt            at;
+    const wchar_t   *output;    // Written once drawn, or NULL
+    PgImageFormat   format;
+    void            (*finish)(PgRenderJob *job, const Pg *g); // Sees the pixels before the canvas is reused
+    void            *data;
+    bool            ok;         // Set when the job was drawn and written
+};
+
 const static PgMatrix PgIdentityMatrix = { 1, 0, 0, 1, 0, 0 };
-float PgGamma;
+extern float PgGamma;
 
 // MISCELLANEOUS
     void pgSetGamma(float gamma);
@@ -200,6 +481,27 @@ float PgGamma;
 Pg pgDefaultCanvas();
 PgBitmapCanvas pgDefaultBitmapCanvas();
 Pg *pgNewBitmapCanvas(int width, int height);
+Pg *pgNewBitmapCanvasOn(uint32_t *data, int width, int height, int stride);
+Pg *pgNewBitmapView(Pg *parent, PgRect rect);
+void pgSetBitmapData(Pg *g, uint32_t *data, int width, int height, int stride);
+PgSharedCanvas pgDefaultSharedCanvas();
+Pg *pgNewSharedCanvas(const wchar_t *name, int width, int height);
+uint32_t pgPresentSharedCanvas(Pg *g);
+PgSharedReader *pgOpenSharedCanvas(const wchar_t *name);
+PgSharedReader *pgOpenSharedCanvasHandle(intptr_t handle);
+bool pgReadSharedFrame(PgSharedReader *reader, PgSharedFrame *frame);
+bool pgSharedFrameIntact(const PgSharedReader *reader, const PgSharedFrame *frame);
+void pgCloseSharedCanvas(PgSharedReader *reader);
+PgSceneCanvas pgDefaultSceneCanvas();
+Pg *pgNewSceneCanvas(int width, int height);
+bool pgRenderStrips(const Pg *scene, int rows, bool sink(void *data, int top, int height, const uint32_t *pixels, int stride), void *data);
+PgQueueCanvas pgDefaultQueueCanvas();
+Pg *pgNewQueueCanvas(int width, int height);
+uint32_t pgPresentQueue(Pg *g);
+const Pg *pgWaitQueue(Pg *g, uint32_t frame);
+void pgBlur(const Pg *g, PgRect rect, float sigma);
+void pgFillShadow(const Pg *g, const PgPath *path, const PgMatrix *matrix, PgPt offset, float sigma, uint32_t color);
+float pgFillStringShadow(Pg *g, const PgFont *font, PgPt at, const wchar_t chars[], int len, PgPt offset, float sigma, uint32_t color);
 
 PgPt pgTransformPoint(const PgMatrix *ctm, PgPt p);
 void pgIdentityMatrix(PgMatrix *mat);
@@ -218,5 +520,22 @@ int pgGetOpenTypeFontCount(PgOpenType *font);
 PgFont *pgOpenFont(const wchar_t *family, PgFontWeight weight, bool italic, PgFontStretch stretch);
 PgFont *pgOpenFontFile(const wchar_t *filename, int font_index, bool scan_only);
 PgFont *pgLoadFont(const void *file, int font_index, bool scan_only);
+void pgRetainFace(PgFace *face);
+void pgReleaseFace(PgFace *face);
+PgOpenType pgDefaultOpenType();
+PgOpenTypeFace pgDefaultOpenTypeFace();
 PgOpenType *pgLoadOpenType(const void *file, int font_index, bool scan_only);
+PgLayout pgDefaultLayout();
+PgLayout *pgNewLayout(const PgFont *font, float measure);
 PgPath *pgInterpretSvgPath(const char *svg, const PgMatrix *initial_ctm);
+bool pgAppendSvgPath(PgPath *path, const PgMatrix *ctm, const char *svg);
+uint8_t *pgWritePathData(const PgPath *path, float precision, int *lenp);
+bool pgAppendPathData(PgPath *path, const PgMatrix *ctm, const void *data, int len);
+PgPath *pgReadPathData(const void *data, int len, const PgMatrix *ctm);
+uint8_t *pgSvgToPathData(const char *svg, float precision, int *lenp);
+PgRenderJob pgDefaultRenderJob(void);
+int pgRenderBatch(PgRenderJob jobs[], int njobs, int nthreads);
+bool pgWriteImage(const Pg *g, const wchar_t *filename, PgImageFormat format);
+PgTrace *pgNewTrace(void);
+void pgFreeTrace(PgTrace *trace);
+bool pgWriteTrace(const PgTrace *trace, const wchar_t *filename);
@@ -1,11 +1,38 @@
 #ifdef _MSC_VER
+    #include <intrin.h>
     #define be32(x) _byteswap_ulong(x)
     #define be16(x) _byteswap_ushort(x)
+    #define FETCH_ADD(P, N) _InterlockedExchangeAdd((volatile long*)(P), (N))
+    #define LOAD_ACQUIRE(P) (*(P))
+    #define STORE_RELEASE(P, V) _InterlockedExchange((volatile long*)(P), (V))
+    #define CAS_POINTER(P, OLD, NEW) (_InterlockedCompareExchangePointer((void*volatile*)(P), (NEW), (OLD)) == (OLD))
+    #define CAS_64(P, OLD, NEW) (_InterlockedCompareExchange64((volatile long long*)(P), (NEW), (OLD)) == (OLD))
+    #define FENCE() _mm_mfence()
 #else
     #define be32(x) __builtin_bswap32(x)
     #define be16(x) __builtin_bswap16(x)
+    #define FETCH_ADD(P, N) __atomic_fetch_add((P), (N), __ATOMIC_SEQ_CST)
+    #define LOAD_ACQUIRE(P) __atomic_load_n((P), __ATOMIC_ACQUIRE)
+    #define STORE_RELEASE(P, V) __atomic_store_n((P), (V), __ATOMIC_RELEASE)
+    #define CAS_POINTER(P, OLD, NEW) __sync_bool_compare_and_swap((P), (OLD), (NEW))
+    #define CAS_64(P, OLD, NEW) __sync_bool_compare_and_swap((P), (OLD), (NEW))
+    #define FENCE() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+    #define wcsicmp wcscasecmp
 #endif
 
 void _pgScanDirectory(const wchar_t *dir, void per_file(const wchar_t *name, void *data));
-wchar_t **_pgListFonts(int *countp);
-PgFont *_pgOpenFontFile(const wchar_t *filename, int font_index, bool scan_only);
\ No newline at end of file
+wchar_t **_pgListFonts(const wchar_t *dir, int *countp);
+PgFont *_pgOpenFontFile(const wchar_t *filename, int font_index, bool scan_only);
+int _pgGetProcessorCount(void);
+double _pgTime(void);
+bool _pgWriteFile(const wchar_t *filename, const void *data, size_t size);
+void *_pgMapShared(const wchar_t *name, size_t *sizep, bool create, intptr_t *handlep);
+void *_pgGrowShared(void *view, size_t size, size_t new_size, bool writable, intptr_t handle);
+void _pgUnmapShared(void *view, size_t size, intptr_t handle);
+void _pgLock(volatile long *lock);
+void _pgUnlock(volatile long *lock);
+void _pgRunThreads(int nthreads, void worker(void *arg, int thread), void *arg);
+intptr_t _pgStartThread(void worker(void *arg, int thread), void *arg);
+void _pgJoinThread(intptr_t thread);
+void _pgWait(volatile uint32_t *address, uint32_t value);
+void _pgWake(volatile uint32_t *address);
\ No newline at end of file
@@ -0,0 +1,380 @@
+#ifndef _WIN32
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <wchar.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <pg/pg.h>
+#include <pg/platform.h>
+
+#define MAX_DIRECTORY_DEPTH 16
+#ifndef MFD_CLOEXEC
+    #define MFD_CLOEXEC 1
+#endif
+
+typedef struct {
+    void    *view;
+    size_t  size;
+} Host;
+
+struct linux_dirent64 {
+    uint64_t        d_ino;
+    int64_t         d_off;
+    unsigned short  d_reclen;
+    unsigned char   d_type;
+    char            d_name[];
+};
+
+typedef struct {
+    int     n;
+    int     cap;
+    wchar_t **files;
+} FileList;
+
+// File names are UTF-8 on disk but wchar_t (UCS-4) in the API
+static char *toUtf8(const wchar_t *input) {
+    char *o, *output = malloc(wcslen(input) * 4 + 1);
+    for (o = output; *input; input++) {
+        unsigned c = *input;
+        if (c < 0x80)
+            *o++ = c;
+        else if (c < 0x800) {
+            *o++ = ((c >> 6) & 0x1f) | 0xc0;
+            *o++ = ((c >> 0) & 0x3f) | 0x80;
+        } else if (c < 0x10000) {
+            *o++ = ((c >> 12) & 0x0f) | 0xe0;
+            *o++ = ((c >>  6) & 0x3f) | 0x80;
+            *o++ = ((c >>  0) & 0x3f) | 0x80;
+        } else {
+            *o++ = ((c >> 18) & 0x07) | 0xf0;
+            *o++ = ((c >> 12) & 0x3f) | 0x80;
+            *o++ = ((c >>  6) & 0x3f) | 0x80;
+            *o++ = ((c >>  0) & 0x3f) | 0x80;
+        }
+    }
+    *o = 0;
+    return output;
+}
+static wchar_t *fromUtf8(const char *path) {
+    const uint8_t *input = (const uint8_t*)path;
+    wchar_t *o, *output = malloc((strlen(path) + 1) * sizeof *output);
+    for (o = output; *input; )
+        if (*input < 0x80)
+            *o++ = *input++;
+        else {
+            int n = *input >= 0xf0? 3: *input >= 0xe0? 2: 1;
+            unsigned c = *input++ & (0x3f >> n);
+            while (n-- && (*input & 0xc0) == 0x80)
+                c = c << 6 | (*input++ & 0x3f);
+            *o++ = c;
+        }
+    *o = 0;
+    return output;
+}
+
+static void *loadFile(Host *host, const wchar_t *filename, bool scan_only) {
+    char *path = toUtf8(filename);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    free(path);
+    if (fd < 0)
+        return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        close(fd);
+        return NULL;
+    }
+
+    host->size = st.st_size;
+    host->view = mmap(NULL, host->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (host->view == MAP_FAILED)
+        return NULL;
+
+    // Scanning only reads a few header tables; fonts for drawing are read everywhere
+    madvise(host->view, host->size, scan_only? MADV_RANDOM: MADV_WILLNEED);
+    return host->view;
+}
+
+bool _pgWriteFile(const wchar_t *filename, const void *data, size_t size) {
+    char *path = toUtf8(filename);
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    free(path);
+    if (fd < 0)
+        return false;
+    
+    const char *p = data;
+    while (size) {
+        ssize_t n = write(fd, p, size);
+        if (n <= 0) {
+            close(fd);
+            return false;
+        }
+        p += n;
+        size -= n;
+    }
+    return !close(fd);
+}
+
+// Shared memory is a file, or an anonymous memfd when there is no name.
+// Creating sizes it to *sizep; opening reports its size there.
+void *_pgMapShared(const wchar_t *name, size_t *sizep, bool create, intptr_t *handlep) {
+    int fd;
+    if (name) {
+        char *path = toUtf8(name);
+        fd = open(path, (create? O_RDWR | O_CREAT: O_RDONLY) | O_CLOEXEC, 0666);
+        free(path);
+    } else if (create)
+        fd = syscall(SYS_memfd_create, "pg-canvas", MFD_CLOEXEC);
+    else // A descriptor passed on by the writer; the copy is ours to close
+        fd = fcntl(*handlep, F_DUPFD_CLOEXEC, 0);
+    if (fd < 0)
+        return NULL;
+
+    struct stat st;
+    if (create? ftruncate(fd, *sizep): fstat(fd, &st) || st.st_size == 0) {
+        close(fd);
+        return NULL;
+    }
+    if (!create)
+        *sizep = st.st_size;
+    void *view = mmap(NULL, *sizep, create? PROT_READ | PROT_WRITE: PROT_READ, MAP_SHARED, fd, 0);
+    if (view == MAP_FAILED) {
+        close(fd);
+        return NULL;
+    }
+    *handlep = fd;
+    return view;
+}
+// Writers extend the memory first; readers only follow a writer that did
+void *_pgGrowShared(void *view, size_t size, size_t new_size, bool writable, intptr_t handle) {
+    if (writable && ftruncate(handle, new_size))
+        return NULL;
+    view = mremap(view, size, new_size, MREMAP_MAYMOVE);
+    return view == MAP_FAILED? NULL: view;
+}
+void _pgUnmapShared(void *view, size_t size, intptr_t handle) {
+    munmap(view, size);
+    close(handle);
+}
+
+static void freeFileMapping(Host *host) {
+    munmap(host->view, host->size);
+}
+
+static bool isFontFile(const char *name) {
+    const char *ext = strrchr(name, '.');
+    return ext && (!strcasecmp(ext, ".ttf")
+                || !strcasecmp(ext, ".otf")
+                || !strcasecmp(ext, ".ttc")
+                || !strcasecmp(ext, ".otc"));
+}
+
+static void listDirectory(FileList *list, int dirfd, const char *path, int depth) {
+    char buf[8192];
+    long nread;
+
+    while ((nread = syscall(SYS_getdents64, dirfd, buf, sizeof buf)) > 0)
+        for (long off = 0; off < nread; ) {
+            struct linux_dirent64 *entry = (void*)(buf + off);
+            const char *name = entry->d_name;
+            int type = entry->d_type;
+            off += entry->d_reclen;
+
+            if (name[0] == '.')
+                continue;
+            if (type == DT_UNKNOWN || type == DT_LNK) {
+                struct stat st;
+                if (fstatat(dirfd, name, &st, 0))
+                    continue;
+                type = S_ISDIR(st.st_mode)? DT_DIR: S_ISREG(st.st_mode)? DT_REG: DT_UNKNOWN;
+            }
+
+            char *full = malloc(strlen(path) + strlen(name) + 2);
+            sprintf(full, "%s/%s", path, name);
+            if (type == DT_DIR && depth < MAX_DIRECTORY_DEPTH) {
+                int fd = openat(dirfd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+                if (fd >= 0) {
+                    listDirectory(list, fd, full, depth + 1);
+                    close(fd);
+                }
+            } else if (type == DT_REG && isFontFile(name)) {
+                if (list->n + 1 >= list->cap) {
+                    list->cap = list->cap? list->cap * 2: 64;
+                    list->files = realloc(list->files, list->cap * sizeof *list->files);
+                }
+                list->files[list->n++] = fromUtf8(full);
+            }
+            free(full);
+        }
+}
+
+static void listPath(FileList *list, const char *path) {
+    int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd >= 0) {
+        listDirectory(list, fd, path, 0);
+        close(fd);
+    }
+}
+
+wchar_t **_pgListFonts(const wchar_t *dir, int *countp) {
+    FileList list = { 0 };
+
+    if (dir) {
+        char *path = toUtf8(dir);
+        listPath(&list, path);
+        free(path);
+    } else {
+        const char *home = getenv("HOME");
+        listPath(&list, "/usr/share/fonts");
+        listPath(&list, "/usr/local/share/fonts");
+        if (home) {
+            char *path = malloc(strlen(home) + sizeof "/.local/share/fonts");
+            sprintf(path, "%s/.local/share/fonts", home);
+            listPath(&list, path);
+            free(path);
+        }
+    }
+    if (countp) *countp = list.n;
+    return list.files;
+}
+
+void _pgScanDirectory(const wchar_t *dir, void perFile(const wchar_t *name, void *data)) {
+    int nfiles;
+    wchar_t **files = _pgListFonts(dir, &nfiles);
+    for (int i = 0; i < nfiles; i++) {
+        Host host;
+        if (loadFile(&host, files[i], true)) {
+            perFile(files[i], host.view);
+            freeFileMapping(&host);
+        }
+        free(files[i]);
+    }
+    free(files);
+}
+
+static void freeHost(PgFace *face) {
+    freeFileMapping(face->host);
+    free(face->host);
+}
+
+PgFont *_pgOpenFontFile(const wchar_t *filename, int font_index, bool scan_only) {
+    Host *host = calloc(1, sizeof *host);
+    void *data = loadFile(host, filename, scan_only);
+    if (data) {
+        PgFont *font = pgLoadFont(data, font_index, scan_only);
+        if (font) {
+            font->face->host = host;
+            font->face->_freeHost = freeHost;
+        } else {
+            freeFileMapping(host);
+            free(host);
+        }
+        return font;
+    } else {
+        free(host);
+        return NULL;
+    }
+}
+
+int _pgGetProcessorCount(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0? n: 1;
+}
+
+// Monotonic seconds for timing
+double _pgTime(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+void _pgLock(volatile long *lock) {
+    while (__atomic_exchange_n(lock, 1, __ATOMIC_ACQUIRE))
+        sched_yield();
+}
+
+void _pgUnlock(volatile long *lock) {
+    __atomic_store_n(lock, 0, __ATOMIC_RELEASE);
+}
+
+typedef struct {
+    void    (*worker)(void *arg, int thread);
+    void    *arg;
+    int     thread;
+} ThreadStart;
+
+static void *threadStart(void *param) {
+    ThreadStart *start = param;
+    start->worker(start->arg, start->thread);
+    return NULL;
+}
+
+void _pgRunThreads(int nthreads, void worker(void *arg, int thread), void *arg) {
+    if (nthreads < 1)
+        nthreads = 1;
+    ThreadStart *starts = malloc(nthreads * sizeof *starts);
+    pthread_t *threads = malloc(nthreads * sizeof *threads);
+    bool *started = calloc(nthreads, sizeof *started);
+
+    // The calling thread works as thread 0
+    for (int i = 1; i < nthreads; i++) {
+        starts[i] = (ThreadStart){ worker, arg, i };
+        started[i] = !pthread_create(&threads[i], NULL, threadStart, &starts[i]);
+        if (!started[i])
+            worker(arg, i);
+    }
+    worker(arg, 0);
+
+    for (int i = 1; i < nthreads; i++)
+        if (started[i])
+            pthread_join(threads[i], NULL);
+    free(starts);
+    free(threads);
+    free(started);
+}
+
+static void *ownedStart(void *param) {
+    ThreadStart start = *(ThreadStart*)param;
+    free(param);
+    start.worker(start.arg, start.thread);
+    return NULL;
+}
+// A thread of its own that runs until joined; 0 if it couldn't start
+intptr_t _pgStartThread(void worker(void *arg, int thread), void *arg) {
+    ThreadStart *start = malloc(sizeof *start);
+    *start = (ThreadStart){ worker, arg, 0 };
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, ownedStart, start)) {
+        free(start);
+        return 0;
+    }
+    return (intptr_t)thread;
+}
+void _pgJoinThread(intptr_t thread) {
+    pthread_join((pthread_t)thread, NULL);
+}
+
+// Sleeps while *address holds value; may also wake for no reason
+void _pgWait(volatile uint32_t *address, uint32_t value) {
+    syscall(SYS_futex, address, FUTEX_WAIT_PRIVATE, value, NULL, NULL, 0);
+}
+void _pgWake(volatile uint32_t *address) {
+    syscall(SYS_futex, address, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+#endif
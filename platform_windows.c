@@ -1,3 +1,4 @@
+#ifdef _WIN32
 #define UNICODE
 #define WIN32_WINNT 0x0601
 #define WIN32_LEAN_AND_MEAN
@@ -10,6 +11,7 @@
 #include <wchar.h>
 #include <windows.h>
 #pragma comment(lib, "advapi32")
+#pragma comment(lib, "synchronization")
 #include <pg/pg.h>
 #include <pg/platform.h>
 
@@ -52,42 +54,207 @@ static void *loadFile(Host *host, const wchar_t *filename) {
     return host->view;
 }
 
+bool _pgWriteFile(const wchar_t *filename, const void *data, size_t size) {
+    HANDLE file = CreateFile(filename,
+        GENERIC_WRITE,
+        0,
+        NULL,
+        CREATE_ALWAYS,
+        FILE_ATTRIBUTE_NORMAL,
+        NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+    
+    const char *p = data;
+    while (size) {
+        DWORD n;
+        if (!WriteFile(file, p, size > 1 << 30? 1 << 30: (DWORD)size, &n, NULL) || !n) {
+            CloseHandle(file);
+            return false;
+        }
+        p += n;
+        size -= n;
+    }
+    return CloseHandle(file);
+}
+
+// Shared memory is a named or unnamed section backed by the paging file.
+// Creating sizes it to *sizep; opening reports its size there.
+void *_pgMapShared(const wchar_t *name, size_t *sizep, bool create, intptr_t *handlep) {
+    HANDLE mapping = NULL;
+    if (create)
+        mapping = CreateFileMapping(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+            (DWORD)((uint64_t)*sizep >> 32), (DWORD)*sizep, name);
+    else if (name)
+        mapping = OpenFileMapping(FILE_MAP_READ, FALSE, name);
+    else if (!DuplicateHandle(GetCurrentProcess(), (HANDLE)*handlep, // Passed on by the writer
+            GetCurrentProcess(), &mapping, FILE_MAP_READ, FALSE, 0))
+        mapping = NULL;
+    if (!mapping)
+        return NULL;
+    void *view = MapViewOfFile(mapping, create? FILE_MAP_WRITE: FILE_MAP_READ, 0, 0, 0);
+    if (!view) {
+        CloseHandle(mapping);
+        return NULL;
+    }
+    if (!create) {
+        MEMORY_BASIC_INFORMATION info;
+        VirtualQuery(view, &info, sizeof info);
+        *sizep = info.RegionSize;
+    }
+    *handlep = (intptr_t)mapping;
+    return view;
+}
+// Sections keep the size they were created with
+void *_pgGrowShared(void *view, size_t size, size_t new_size, bool writable, intptr_t handle) {
+    return NULL;
+}
+void _pgUnmapShared(void *view, size_t size, intptr_t handle) {
+    UnmapViewOfFile(view);
+    CloseHandle((HANDLE)handle);
+}
+
 static void freeFileMapping(Host *host) {
     UnmapViewOfFile(host->view);
     CloseHandle(host->mapping);
     CloseHandle(host->file);
 }
 
-void _pgScanDirectory(const wchar_t *dir, void perFile(const wchar_t *name, void *data)) {
+wchar_t **_pgListFonts(const wchar_t *dir, int *countp) {
     WIN32_FIND_DATA data;
+    wchar_t **files = NULL;
+    int nfiles = 0;
     if (!dir)
         dir = L"C:\\Windows\\Fonts";
     
     wchar_t search[MAX_PATH];
-    if (wcslen(dir) >= MAX_PATH - 2)
-        return;
-    wcscpy(search, dir);
-    wcscat(search, L"/*");
+    if (wcslen(dir) < MAX_PATH - 2) {
+        wcscpy(search, dir);
+        wcscat(search, L"/*");
+        
+        HANDLE h = FindFirstFile(search, &data);
+        if (h != INVALID_HANDLE_VALUE) {
+            do {
+                wchar_t full[MAX_PATH*2];
+                if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+                    continue;
+                swprintf(full, MAX_PATH*2, L"%ls\\%ls", dir, data.cFileName);
+                files = realloc(files, (nfiles + 1) * sizeof *files);
+                files[nfiles++] = wcsdup(full);
+            } while (FindNextFile(h, &data));
+            FindClose(h);
+        }
+    }
+    if (countp) *countp = nfiles;
+    return files;
+}
+
+void _pgScanDirectory(const wchar_t *dir, void perFile(const wchar_t *name, void *data)) {
+    int nfiles;
+    wchar_t **files = _pgListFonts(dir, &nfiles);
+    for (int i = 0; i < nfiles; i++) {
+        Host host;
+        if (loadFile(&host, files[i])) {
+            perFile(files[i], host.view);
+            freeFileMapping(&host);
+        }
+        free(files[i]);
+    }
+    free(files);
+}
+
+int _pgGetProcessorCount(void) {
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0? info.dwNumberOfProcessors: 1;
+}
+
+// Monotonic seconds for timing
+double _pgTime(void) {
+    static LARGE_INTEGER frequency;
+    LARGE_INTEGER now;
+    if (!frequency.QuadPart)
+        QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&now);
+    return (double)now.QuadPart / frequency.QuadPart;
+}
+
+void _pgLock(volatile long *lock) {
+    while (_InterlockedCompareExchange(lock, 1, 0))
+        SwitchToThread();
+}
+
+void _pgUnlock(volatile long *lock) {
+    _InterlockedExchange(lock, 0);
+}
+
+typedef struct {
+    void    (*worker)(void *arg, int thread);
+    void    *arg;
+    int     thread;
+} ThreadStart;
+
+static DWORD WINAPI threadStart(void *param) {
+    ThreadStart *start = param;
+    start->worker(start->arg, start->thread);
+    return 0;
+}
+
+void _pgRunThreads(int nthreads, void worker(void *arg, int thread), void *arg) {
+    if (nthreads < 1)
+        nthreads = 1;
+    ThreadStart *starts = malloc(nthreads * sizeof *starts);
+    HANDLE *threads = malloc(nthreads * sizeof *threads);
     
-    HANDLE h = FindFirstFile(search, &data);
-    if (h != INVALID_HANDLE_VALUE) {
-        do {
-            wchar_t full[MAX_PATH*2];
-            Host host;
-            
-            swprintf(full, MAX_PATH*2, L"%ls\\%ls", dir, data.cFileName);
-            if (loadFile(&host, full)) {
-                perFile(full, host.view);
-                freeFileMapping(&host);
-            }
-        } while (FindNextFile(h, &data));
-        FindClose(h);
+    // The calling thread works as thread 0
+    for (int i = 1; i < nthreads; i++) {
+        starts[i] = (ThreadStart){ worker, arg, i };
+        threads[i] = CreateThread(NULL, 0, threadStart, &starts[i], 0, NULL);
+        if (!threads[i])
+            worker(arg, i);
     }
+    worker(arg, 0);
+    
+    for (int i = 1; i < nthreads; i++)
+        if (threads[i]) {
+            WaitForSingleObject(threads[i], INFINITE);
+            CloseHandle(threads[i]);
+        }
+    free(starts);
+    free(threads);
+}
+
+static DWORD WINAPI ownedStart(void *param) {
+    ThreadStart start = *(ThreadStart*)param;
+    free(param);
+    start.worker(start.arg, start.thread);
+    return 0;
+}
+// A thread of its own that runs until joined; 0 if it couldn't start
+intptr_t _pgStartThread(void worker(void *arg, int thread), void *arg) {
+    ThreadStart *start = malloc(sizeof *start);
+    *start = (ThreadStart){ worker, arg, 0 };
+    HANDLE thread = CreateThread(NULL, 0, ownedStart, start, 0, NULL);
+    if (!thread)
+        free(start);
+    return (intptr_t)thread;
+}
+void _pgJoinThread(intptr_t thread) {
+    WaitForSingleObject((HANDLE)thread, INFINITE);
+    CloseHandle((HANDLE)thread);
+}
+
+// Sleeps while *address holds value; may also wake for no reason
+void _pgWait(volatile uint32_t *address, uint32_t value) {
+    WaitOnAddress(address, &value, sizeof value, INFINITE);
+}
+void _pgWake(volatile uint32_t *address) {
+    WakeByAddressAll((void*)address);
 }
 
-static void freeHost(PgFont *font) {
-    freeFileMapping(font->host);
-    free(font->host);
+static void freeHost(PgFace *face) {
+    freeFileMapping(face->host);
+    free(face->host);
 }
 
 PgFont *_pgOpenFontFile(const wchar_t *filename, int font_index, bool scan_only) {
@@ -96,12 +263,13 @@ PgFont *_pgOpenFontFile(const wchar_t *filename, int font_index, bool scan_only)
     if (data) {
         PgFont *font = pgLoadFont(data, font_index, scan_only);
         if (font) {
-            font->host = host;
-            font->_freeHost = freeHost;
+            font->face->host = host;
+            font->face->_freeHost = freeHost;
         }
         return font;
     } else {
         free(host);
         return NULL;
     }
-}
\ No newline at end of file
+}
+#endif
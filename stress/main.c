@@ -0,0 +1,144 @@
+// Thread stress test: renders scenes on many threads and compares them with the same scenes drawn on one
+#define _GNU_SOURCE
+#define _USE_MATH_DEFINES
+#include <locale.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+
+#include <pg/pg.h>
+#include <pg/platform.h>
+#include <pg/common.h>
+#include "../demo/test.h"
+
+#define SIZE    256
+#define BG      0xffffffff
+#define FG      0xff000000
+
+static const char *Strings[] = {
+    "The Quick brown fox",
+    "jumps over the lazy dog",
+    "Götter, Ærø, Ωμέγα",
+    "fi fl ffi 0123456789",
+};
+#define NSTRINGS (int)(sizeof Strings / sizeof *Strings)
+
+typedef struct {
+    Pg          **canvases;
+    float       (*widths)[NSTRINGS];
+    const wchar_t *family;
+    PgFont      *shared;    // One handle that every thread measures with
+    int         rounds;
+} Test;
+
+void usage(void) {
+    fprintf(stderr, "usage: stress [-j threads] [-r rounds] [-f family]\n");
+    exit(2);
+}
+
+void scene(Pg *g, PgFont *font, int variant) {
+    $(clear, g, BG);
+    $(identity, g);
+    $(translate, g, -396/2, -468/2);
+    $(rotate, g, variant * M_PI / 16);
+    $(scale, g, .5, .5);
+    $(translate, g, g->width / 2, g->height / 2);
+    for (int i = 0; TestSVG[i]; i++) {
+        PgPath *path = pgInterpretSvgPath(TestSVG[i], &g->ctm);
+        $(fill, g, path, FG);
+        $(free, path);
+    }
+    $(identity, g);
+    for (int i = 0; i < NSTRINGS; i++)
+        $(fillUtf8, g, font, pgPt(0, i * 20), Strings[i], -1, FG);
+}
+void measure(PgFont *font, float widths[NSTRINGS]) {
+    $(getUtf8Widths, font, NSTRINGS, Strings, NULL, widths);
+}
+
+void worker(void *arg, int thread) {
+    Test *test = arg;
+    
+    // Every thread opens the family and draws at its own size on the shared face
+    PgFont *font = pgOpenFont(test->family, 400, false, 0);
+    PgFont *sized = $(sized, font, 12 + thread, 0);
+    for (int i = 0; i < test->rounds; i++) {
+        scene(test->canvases[thread], sized, thread);
+        measure(test->shared, test->widths[thread]);
+    }
+    $(free, sized);
+    $(free, font);
+}
+
+int main(int argc, char **argv) {
+    int nthreads = _pgGetProcessorCount() * 2;
+    int rounds = 4;
+    const char *family = "DejaVu Sans";
+    
+    // Only family names need the user's locale
+    setlocale(LC_CTYPE, "");
+    for (int i = 1; i < argc; i++)
+        if (!strcmp(argv[i], "-j") && i + 1 < argc)
+            nthreads = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-r") && i + 1 < argc)
+            rounds = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-f") && i + 1 < argc)
+            family = argv[++i];
+        else
+            usage();
+    if (nthreads < 1 || rounds < 1)
+        usage();
+    
+    wchar_t wide[256];
+    PgFont *font = mbstowcs(wide, family, 256) < 256? pgOpenFont(wide, 400, false, 0): NULL;
+    if (!font) {
+        fprintf(stderr, "stress: %s not found\n", family);
+        return 1;
+    }
+    
+    // Fresh handles, so threads race to build their lazily built state
+    Test test = {
+        NEW_ARRAY(Pg*, nthreads),
+        NEW_ARRAY(float[NSTRINGS], nthreads),
+        wide,
+        $(sized, font, 15, 0),
+        rounds,
+    };
+    for (int i = 0; i < nthreads; i++)
+        test.canvases[i] = pgNewBitmapCanvas(SIZE, SIZE);
+    _pgRunThreads(nthreads, worker, &test);
+    
+    // Draw and measure everything again on this thread and compare
+    Pg *reference = pgNewBitmapCanvas(SIZE, SIZE);
+    PgFont *shared = $(sized, font, 15, 0);
+    float widths[NSTRINGS];
+    measure(shared, widths);
+    int mismatches = 0;
+    for (int i = 0; i < nthreads; i++) {
+        PgFont *sized = $(sized, font, 12 + i, 0);
+        scene(reference, sized, i);
+        $(free, sized);
+        bool same = !memcmp(((PgBitmapCanvas*)reference)->data,
+                ((PgBitmapCanvas*)test.canvases[i])->data,
+                SIZE * SIZE * sizeof(uint32_t)) &&
+            !memcmp(widths, test.widths[i], sizeof widths);
+        if (!same) {
+            fprintf(stderr, "stress: thread %d differs\n", i);
+            mismatches++;
+        }
+        $(free, test.canvases[i]);
+    }
+    $(free, reference);
+    $(free, shared);
+    $(free, test.shared);
+    $(free, font);
+    free(test.canvases);
+    free(test.widths);
+    
+    printf("%d threads, %d rounds, %d mismatches\n", nthreads, rounds, mismatches);
+    return mismatches? 1: 0;
+}